@@ -17,12 +17,59 @@
 #ifndef LIBQ_BLOCK_HPP
 #define LIBQ_BLOCK_HPP
 
+#include <q/pp.hpp>
+
 #include <vector>
+#include <deque>
 #include <string>
 #include <memory>
 
+#ifdef LIBQ_ON_POSIX
+#	include <sys/uio.h>
+#endif
+
 namespace q {
 
+/**
+ * Statistics of the pool from which byte_blocks allocate their data (e.g.
+ * when constructed from a string). Buffers of up to 64 KiB are allocated in
+ * power-of-two size classes, together with their shared_ptr control block,
+ * and when the last byte_block referring to one is destructed, it is put on
+ * a free list of the releasing thread for reuse.
+ */
+struct byte_block_pool_stats
+{
+	// Allocations served from the thread's free list
+	std::size_t hits = 0;
+	// Allocations of new pooled buffers
+	std::size_t misses = 0;
+	// Allocations too large for the pool
+	std::size_t oversized = 0;
+	// Released buffers put on a free list
+	std::size_t recycled = 0;
+	// Released buffers deleted, as the free list was full
+	std::size_t freed = 0;
+
+	std::size_t allocations( ) const
+	{
+		return hits + misses + oversized;
+	}
+
+	/**
+	 * The ratio of allocations served from a free list (0 to 1).
+	 */
+	double hit_rate( ) const
+	{
+		const auto total = allocations( );
+		return total ? static_cast< double >( hits ) / total : 0.0;
+	}
+};
+
+/**
+ * Returns the byte_block pool statistics, summed over all threads.
+ */
+byte_block_pool_stats get_byte_block_pool_stats( );
+
 class byte_block
 {
 public:
@@ -76,6 +123,148 @@ private:
 	std::uint8_t const* ptr_;
 };
 
+#ifdef LIBQ_ON_POSIX
+
+/**
+ * How a memory-mapped file is expected to be accessed, given to the kernel
+ * as a hint for read-ahead.
+ */
+enum class map_access
+{
+	normal,
+	sequential,
+	random
+};
+
+/**
+ * Memory-maps a file (read-only) and returns a byte_block of its content,
+ * or of `length` bytes from `offset`. The file is unmapped when the last
+ * byte_block referring to it (including slices) is destructed, so slices of
+ * large files can be passed around without copying.
+ *
+ * If `prefault` is true, the pages are read in up-front, rather than on the
+ * first access of every page.
+ *
+ * Will throw an errno exception if the file can't be opened or mapped, and
+ * `std::out_of_range` if the range isn't within the file.
+ */
+byte_block map_file(
+	const std::string& path,
+	map_access access = map_access::normal,
+	bool prefault = false
+);
+byte_block map_file(
+	const std::string& path,
+	std::size_t offset,
+	std::size_t length,
+	map_access access = map_access::normal,
+	bool prefault = false
+);
+
+#endif
+
+/**
+ * A sequence of byte_blocks, seen as one range of bytes. Appending and
+ * prepending blocks (or other chains) doesn't copy any data, and neither
+ * does slicing, which shares the underlying blocks.
+ *
+ * A contiguous byte_block is only created by flatten( ), which avoids
+ * copying if the chain consists of a single block. For scatter/gather I/O,
+ * to_iovec( ) fills an iovec array for writev( ) without copying.
+ */
+class byte_chain
+{
+public:
+	typedef std::deque< byte_block >::const_iterator const_iterator;
+
+	byte_chain( );
+	byte_chain( byte_block block );
+
+	/**
+	 * Adds a block (or the blocks of a chain) to the end of this chain.
+	 * Empty blocks are ignored.
+	 */
+	void append( byte_block block );
+	void append( const byte_chain& chain );
+
+	/**
+	 * Adds a block (or the blocks of a chain) to the beginning of this
+	 * chain. Empty blocks are ignored.
+	 */
+	void prepend( byte_block block );
+	void prepend( const byte_chain& chain );
+
+	/**
+	 * Drops the first `amount` bytes of this chain. Will throw
+	 * `std::out_of_range` if the chain is smaller than that.
+	 */
+	void advance( std::size_t amount );
+
+	void clear( );
+
+	/**
+	 * The total number of bytes in this chain.
+	 */
+	std::size_t size( ) const;
+
+	bool empty( ) const;
+
+	/**
+	 * The number of (non-empty) blocks in this chain.
+	 */
+	std::size_t blocks( ) const;
+
+	const_iterator begin( ) const;
+	const_iterator end( ) const;
+
+	/**
+	 * Returns a new byte_chain which is a slice of this byte_chain,
+	 * possibly spanning multiple blocks. Will throw `std::out_of_range`
+	 * if the offset and length aren't within the boundaries of this
+	 * byte_chain.
+	 */
+	byte_chain slice( std::size_t offset, std::size_t length ) const;
+	byte_chain slice( std::size_t offset ) const;
+
+	/**
+	 * Copies `length` bytes from `offset` into `dest`. Will throw
+	 * `std::out_of_range` if the offset and length aren't within the
+	 * boundaries of this byte_chain.
+	 */
+	void copy_to(
+		std::uint8_t* dest, std::size_t offset, std::size_t length )
+		const;
+
+	/**
+	 * Returns the content of this chain as one contiguous byte_block.
+	 * This only allocates and copies if the chain has more than one
+	 * block.
+	 */
+	byte_block flatten( ) const;
+
+	std::string to_string( ) const;
+
+#ifdef LIBQ_ON_POSIX
+	/**
+	 * Fills `vec` with up to `count` entries, one per block, starting
+	 * with block `first_block`.
+	 *
+	 * @return the number of entries filled
+	 */
+	std::size_t to_iovec(
+		struct iovec* vec,
+		std::size_t count,
+		std::size_t first_block = 0
+	) const;
+
+	std::vector< struct iovec > to_iovec( ) const;
+#endif
+
+private:
+	std::deque< byte_block > blocks_;
+	std::size_t size_;
+};
+
 } // namespace q
 
 #endif // LIBQ_BLOCK_HPP
@@ -0,0 +1,860 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_BROADCAST_HPP
+#define LIBQ_BROADCAST_HPP
+
+#include <q/channel.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <list>
+
+namespace q {
+
+/**
+ * A broadcast subscriber, with the disconnect policy, fell too far behind.
+ */
+Q_MAKE_SIMPLE_EXCEPTION( broadcast_lagged_exception );
+
+/**
+ * What to do when a subscriber falls behind the writer by more than its lag
+ * limit.
+ *
+ *   block:       Pause the writer (see broadcast::should_write( )) until the
+ *                subscriber catches up (default). As with channels, writes
+ *                are still accepted while paused.
+ *   drop_oldest: Skip the oldest values for the subscriber, so it never has
+ *                more than its limit unread. The skipped values are counted
+ *                in broadcast_subscriber::dropped( ).
+ *   disconnect:  Close the subscriber with a broadcast_lagged_exception.
+ */
+class broadcast_policy
+{
+public:
+	enum type
+	{
+		block,
+		drop_oldest,
+		disconnect
+	};
+
+	broadcast_policy( type value = block )
+	: value_( value )
+	{ }
+
+	type get( ) const
+	{
+		return value_;
+	}
+
+private:
+	type value_;
+};
+
+namespace detail {
+
+template< typename... T >
+struct broadcast_traits
+{
+	typedef std::tuple< T... > value_type;
+};
+
+template< typename T >
+struct broadcast_traits< T >
+{
+	typedef T value_type;
+};
+
+/**
+ * The state shared between the writer and the subscribers of a broadcast.
+ *
+ * Every value is stored once, as a shared constant, in a buffer which all
+ * subscribers read from with their own cursor (the sequence number of their
+ * next value). Values are removed from the buffer when all subscribers have
+ * read them.
+ *
+ * This is not a lock-free ring. The buffer is a deque of handles guarded by
+ * the mutex, which writes and reads both take, and every write allocates the
+ * value (with its reference count) with std::make_shared. The allocation is
+ * what allows readers to keep a value after it has left the buffer, and
+ * values are never copied, whatever the number of subscribers. The cost is
+ * one allocation per write, and contention on the mutex with many
+ * subscribers reading concurrently. Writing also walks all subscribers, to
+ * hand the value to waiting readers and apply the lag policies.
+ */
+template< typename... T >
+class shared_broadcast
+: public std::enable_shared_from_this< shared_broadcast< T... > >
+{
+public:
+	typedef typename broadcast_traits< T... >::value_type value_type;
+	typedef std::shared_ptr< const value_type > handle_type;
+	typedef defer< handle_type > defer_type;
+
+	struct subscription
+	{
+		subscription( std::size_t max_lag, broadcast_policy policy )
+		: max_lag( std::max< std::size_t >( max_lag, 1 ) )
+		, policy( policy.get( ) )
+		, cursor( 0 )
+		, dropped( 0 )
+		, closed( false )
+		, detached( false )
+		{ }
+
+		const std::size_t max_lag;
+		const broadcast_policy::type policy;
+		std::uint64_t cursor;
+		std::uint64_t dropped;
+		bool closed;
+		// Unsubscribed or disconnected, so it has no values left
+		bool detached;
+		std::exception_ptr exception;
+		std::list< std::shared_ptr< defer_type > > waiters;
+	};
+
+	typedef std::shared_ptr< subscription > subscription_ptr;
+
+	shared_broadcast(
+		const queue_ptr& queue,
+		std::size_t max_lag,
+		broadcast_policy policy
+	)
+	: queue_( queue )
+	, mutex_( Q_HERE, "broadcast" )
+	, max_lag_( max_lag )
+	, policy_( policy )
+	, first_( 0 )
+	, closed_( false )
+	, paused_( false )
+	{ }
+
+	const queue_ptr& get_queue( ) const
+	{
+		return queue_;
+	}
+
+	std::size_t max_lag( ) const
+	{
+		return max_lag_;
+	}
+
+	broadcast_policy policy( ) const
+	{
+		return policy_;
+	}
+
+	/**
+	 * Adds a subscriber, which will get the values written from now on.
+	 */
+	subscription_ptr
+	subscribe( std::size_t max_lag, broadcast_policy policy )
+	{
+		auto sub = std::make_shared< subscription >( max_lag, policy );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		sub->cursor = end( );
+
+		if ( closed_ )
+		{
+			sub->closed = true;
+			sub->exception = exception_;
+		}
+		else
+		{
+			subscriptions_.push_back( sub );
+		}
+
+		return sub;
+	}
+
+	void unsubscribe( const subscription_ptr& sub )
+	{
+		shared_task notification;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			sub->closed = true;
+			sub->detached = true;
+			close_waiters( *sub );
+			subscriptions_.remove( sub );
+
+			trim( );
+			notification = maybe_resume( );
+		}
+
+		if ( notification )
+			queue_->push( std::move( notification ) );
+	}
+
+	template< typename... Args >
+	bool write( Args&&... args )
+	{
+		auto handle = std::make_shared< const value_type >(
+			std::forward< Args >( args )... );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( closed_ )
+			return false;
+
+		if ( subscriptions_.empty( ) )
+		{
+			// Nobody to read it
+			first_ = end( ) + 1;
+			return true;
+		}
+
+		values_.push_back( std::move( handle ) );
+
+		for ( auto iter = subscriptions_.begin( );
+			iter != subscriptions_.end( ); )
+		{
+			auto& sub = **iter;
+
+			if ( !sub.waiters.empty( ) )
+			{
+				// The subscriber was waiting, so it had read
+				// everything but this value
+				auto defer = std::move( sub.waiters.front( ) );
+				sub.waiters.pop_front( );
+				defer->set_value( values_.back( ) );
+				++sub.cursor;
+			}
+			else if ( end( ) - sub.cursor > sub.max_lag )
+			{
+				switch ( sub.policy )
+				{
+				case broadcast_policy::block:
+					break;
+				case broadcast_policy::drop_oldest:
+					++sub.dropped;
+					++sub.cursor;
+					break;
+				case broadcast_policy::disconnect:
+					sub.closed = true;
+					sub.detached = true;
+					sub.exception = std::make_exception_ptr(
+						broadcast_lagged_exception( ) );
+					iter = subscriptions_.erase( iter );
+					continue;
+				}
+			}
+
+			if (
+				sub.policy == broadcast_policy::block &&
+				end( ) - sub.cursor >= sub.max_lag
+			)
+				paused_ = true;
+
+			++iter;
+		}
+
+		trim( );
+
+		return true;
+	}
+
+	/**
+	 * Takes the next value for @a sub, if there is one.
+	 */
+	bool try_read( subscription& sub, handle_type& handle )
+	{
+		shared_task notification;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( !sub.waiters.empty( ) || !pop( sub, handle ) )
+				return false;
+
+			notification = maybe_resume( );
+		}
+
+		if ( notification )
+			queue_->push( std::move( notification ) );
+
+		return true;
+	}
+
+	promise< handle_type > read( subscription& sub )
+	{
+		handle_type handle;
+
+		if ( try_read( sub, handle ) )
+			return q::with( queue_, std::move( handle ) );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		// A value may have been written after try_read( )
+		if ( sub.waiters.empty( ) && pop( sub, handle ) )
+			return q::with( queue_, std::move( handle ) );
+
+		if ( sub.closed )
+			return reject< handle_type >(
+				queue_,
+				sub.exception
+				? sub.exception
+				: std::make_exception_ptr(
+					channel_closed_exception( ) ) );
+
+		auto defer = ::q::make_shared< defer_type >( queue_ );
+		sub.waiters.push_back( defer );
+
+		return defer->get_promise( );
+	}
+
+	std::size_t lag( const subscription& sub ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return end( ) - sub.cursor;
+	}
+
+	std::uint64_t dropped( const subscription& sub ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return sub.dropped;
+	}
+
+	void close( std::exception_ptr e )
+	{
+		shared_task notification;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( closed_ )
+				return;
+
+			closed_ = true;
+			exception_ = e;
+
+			// Subscribers still read the values they have left, and
+			// are closed after that.
+			for ( auto& sub : subscriptions_ )
+			{
+				sub->closed = true;
+				sub->exception = e;
+				close_waiters( *sub );
+			}
+
+			notification = resume_notification_;
+		}
+
+		if ( notification )
+			queue_->push( std::move( notification ) );
+	}
+
+	bool is_closed( ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return closed_;
+	}
+
+	bool should_write( ) const
+	{
+		return !paused_ && !closed_;
+	}
+
+	void set_resume_notification( shared_task fn )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		resume_notification_ = std::move( fn );
+	}
+
+private:
+	/**
+	 * The sequence number of the next value to be written.
+	 */
+	std::uint64_t end( ) const
+	{
+		return first_ + values_.size( );
+	}
+
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	bool pop( subscription& sub, handle_type& handle )
+	{
+		if ( sub.detached || sub.cursor == end( ) )
+			return false;
+
+		handle = values_[ sub.cursor - first_ ];
+		++sub.cursor;
+
+		trim( );
+
+		return true;
+	}
+
+	/**
+	 * Removes the values which all subscribers have read.
+	 *
+	 * NOTE: The mutex must be held.
+	 */
+	void trim( )
+	{
+		auto min_cursor = end( );
+
+		for ( auto& sub : subscriptions_ )
+			min_cursor = std::min( min_cursor, sub->cursor );
+
+		while ( first_ < min_cursor )
+		{
+			values_.pop_front( );
+			++first_;
+		}
+	}
+
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	void close_waiters( subscription& sub )
+	{
+		auto e = sub.exception
+			? sub.exception
+			: std::make_exception_ptr(
+				channel_closed_exception( ) );
+
+		for ( auto& defer : sub.waiters )
+			defer->set_exception( e );
+
+		sub.waiters.clear( );
+	}
+
+	/**
+	 * Returns the resume notification if the writer was paused, and no
+	 * blocking subscriber is too far behind anymore.
+	 *
+	 * NOTE: The mutex must be held.
+	 */
+	shared_task maybe_resume( )
+	{
+		if ( !paused_ )
+			return shared_task( );
+
+		for ( auto& sub : subscriptions_ )
+			if (
+				sub->policy == broadcast_policy::block &&
+				end( ) - sub->cursor >=
+					default_resume_count( sub->max_lag )
+			)
+				return shared_task( );
+
+		paused_ = false;
+
+		return resume_notification_;
+	}
+
+	const queue_ptr queue_;
+	mutable mutex mutex_;
+	const std::size_t max_lag_;
+	const broadcast_policy policy_;
+	std::deque< handle_type > values_;
+	// The sequence number of the first value in values_
+	std::uint64_t first_;
+	std::list< subscription_ptr > subscriptions_;
+	std::atomic< bool > closed_;
+	std::atomic< bool > paused_;
+	std::exception_ptr exception_;
+	shared_task resume_notification_;
+};
+
+/**
+ * Unsubscribes when the last copy of a broadcast_subscriber is destructed.
+ */
+template< typename... T >
+class broadcast_subscription_owner
+{
+public:
+	typedef shared_broadcast< T... > broadcast_type;
+
+	broadcast_subscription_owner(
+		std::shared_ptr< broadcast_type > broadcast,
+		typename broadcast_type::subscription_ptr subscription
+	)
+	: broadcast_( std::move( broadcast ) )
+	, subscription_( std::move( subscription ) )
+	{ }
+
+	~broadcast_subscription_owner( )
+	{
+		broadcast_->unsubscribe( subscription_ );
+	}
+
+private:
+	std::shared_ptr< broadcast_type > broadcast_;
+	typename broadcast_type::subscription_ptr subscription_;
+};
+
+/**
+ * Calls a function with every value of a subscriber, one at a time.
+ */
+template< typename Fn, typename... T >
+class broadcast_consumer
+: public std::enable_shared_from_this< broadcast_consumer< Fn, T... > >
+{
+	typedef shared_broadcast< T... > broadcast_type;
+	typedef typename broadcast_type::handle_type handle_type;
+	typedef typename broadcast_type::subscription subscription;
+	typedef result_of_t< Fn > result_type;
+	typedef is_promise< result_type > is_async;
+
+public:
+	broadcast_consumer(
+		std::shared_ptr< broadcast_type > broadcast,
+		std::shared_ptr< subscription > sub,
+		Fn fn
+	)
+	: broadcast_( std::move( broadcast ) )
+	, subscription_( std::move( sub ) )
+	, fn_( std::move( fn ) )
+	, deferred_( ::q::make_shared< defer< > >(
+		broadcast_->get_queue( ) ) )
+	{ }
+
+	promise< > get_promise( )
+	{
+		return deferred_->get_promise( );
+	}
+
+	void next( )
+	{
+		auto self = this->shared_from_this( );
+
+		handle_type handle;
+
+		// Values already written are consumed without promises, unless
+		// the function is asynchronous
+		while ( broadcast_->try_read( *subscription_, handle ) )
+		{
+			if ( !call_sync( handle, is_async( ) ) )
+				return;
+		}
+
+		broadcast_->read( *subscription_ )
+		.then( [ self ]( handle_type handle )
+		{
+			return self->call( handle, is_async( ) );
+		} )
+		.then( [ self ]( )
+		{
+			self->next( );
+		} )
+		.fail( [ self ]( const channel_closed_exception& )
+		{
+			self->deferred_->set_value( );
+		} )
+		.fail( [ self ]( std::exception_ptr e )
+		{
+			self->deferred_->set_exception( std::move( e ) );
+		} );
+	}
+
+private:
+	bool call_sync( const handle_type& handle, std::false_type )
+	{
+		try
+		{
+			::q::call_with_args( fn_, *handle );
+			return true;
+		}
+		catch ( ... )
+		{
+			deferred_->set_exception( std::current_exception( ) );
+			return false;
+		}
+	}
+
+	bool call_sync( const handle_type& handle, std::true_type )
+	{
+		auto self = this->shared_from_this( );
+
+		call( handle, std::true_type( ) )
+		.then( [ self ]( )
+		{
+			self->next( );
+		} )
+		.fail( [ self ]( std::exception_ptr e )
+		{
+			self->deferred_->set_exception( std::move( e ) );
+		} );
+
+		return false;
+	}
+
+	promise< > call( const handle_type& handle, std::false_type )
+	{
+		::q::call_with_args( fn_, *handle );
+		return q::with( broadcast_->get_queue( ) );
+	}
+
+	result_type call( const handle_type& handle, std::true_type )
+	{
+		// The handle is kept until the function is done with the value
+		return ::q::call_with_args( fn_, *handle )
+		.tap( [ handle ]( ) { } );
+	}
+
+	std::shared_ptr< broadcast_type > broadcast_;
+	std::shared_ptr< subscription > subscription_;
+	Fn fn_;
+	std::shared_ptr< defer< > > deferred_;
+};
+
+} // namespace detail
+
+/**
+ * A subscriber of a broadcast. It gets every value written to the broadcast
+ * after it subscribed, as a shared handle to the same constant value that all
+ * other subscribers get.
+ *
+ * When the last copy of a subscriber is destructed, it is unsubscribed.
+ */
+template< typename... T >
+class broadcast_subscriber
+{
+	typedef detail::shared_broadcast< T... > broadcast_type;
+
+public:
+	typedef typename broadcast_type::value_type value_type;
+	typedef typename broadcast_type::handle_type handle_type;
+
+	broadcast_subscriber(
+		std::shared_ptr< broadcast_type > broadcast,
+		std::size_t max_lag,
+		broadcast_policy policy
+	)
+	: broadcast_( std::move( broadcast ) )
+	, subscription_( broadcast_->subscribe( max_lag, policy ) )
+	, owner_( std::make_shared<
+		detail::broadcast_subscription_owner< T... >
+	>( broadcast_, subscription_ ) )
+	{ }
+
+	/**
+	 * Reads the next value. If the broadcast is closed (and all values
+	 * have been read), the promise is rejected with a
+	 * channel_closed_exception, or the error the broadcast was closed
+	 * with. A subscriber disconnected for lagging gets a
+	 * broadcast_lagged_exception.
+	 */
+	Q_NODISCARD
+	promise< handle_type > read( )
+	{
+		return broadcast_->read( *subscription_ );
+	}
+
+	/**
+	 * Reads the next value into @a handle, if there is one, without
+	 * allocating a promise.
+	 */
+	Q_NODISCARD
+	bool try_read( handle_type& handle )
+	{
+		return broadcast_->try_read( *subscription_, handle );
+	}
+
+	/**
+	 * Calls @a fn with a const reference to every value, in order, until
+	 * the broadcast is closed. If @a fn returns a promise, the next value
+	 * isn't read until it is resolved.
+	 */
+	template< typename Fn >
+	Q_NODISCARD
+	promise< > consume( Fn&& fn )
+	{
+		typedef detail::broadcast_consumer<
+			decayed_function_t< Fn >, T...
+		> consumer_type;
+
+		auto consumer = std::make_shared< consumer_type >(
+			broadcast_,
+			subscription_,
+			decay_function( std::forward< Fn >( fn ) ) );
+
+		auto owner = owner_;
+		auto promise = consumer->get_promise( )
+			.tap( [ owner ]( ) { } )
+			.tap_error( [ owner ]( std::exception_ptr ) { } );
+
+		consumer->next( );
+
+		return promise;
+	}
+
+	/**
+	 * The number of written values this subscriber hasn't read yet.
+	 */
+	std::size_t lag( ) const
+	{
+		return broadcast_->lag( *subscription_ );
+	}
+
+	/**
+	 * The number of values skipped due to the drop_oldest policy.
+	 */
+	std::uint64_t dropped( ) const
+	{
+		return broadcast_->dropped( *subscription_ );
+	}
+
+	/**
+	 * Stops receiving values. Pending reads are rejected with a
+	 * channel_closed_exception.
+	 */
+	void unsubscribe( )
+	{
+		broadcast_->unsubscribe( subscription_ );
+	}
+
+private:
+	std::shared_ptr< broadcast_type > broadcast_;
+	typename broadcast_type::subscription_ptr subscription_;
+	std::shared_ptr< detail::broadcast_subscription_owner< T... > > owner_;
+};
+
+/**
+ * A one-to-many channel. Every value written is stored once, and every
+ * subscriber gets a shared handle to it (a std::shared_ptr to a const value),
+ * so publishing to many subscribers doesn't copy the value. Every write
+ * allocates the shared value, and writes and reads are serialized by a mutex
+ * (see detail::shared_broadcast).
+ *
+ * Every subscriber has a lag limit, the number of values it may have left to
+ * read, and a broadcast_policy deciding what happens when it falls further
+ * behind. Values are only kept until all subscribers have read them, and a
+ * broadcast without subscribers drops the values written to it.
+ *
+ * Subscribers only get the values written after they subscribed. When the
+ * broadcast is closed, they read the values they have left, and are then
+ * closed too.
+ */
+template< typename... T >
+class broadcast
+{
+	typedef detail::shared_broadcast< T... > broadcast_type;
+
+public:
+	typedef typename broadcast_type::value_type value_type;
+	typedef typename broadcast_type::handle_type handle_type;
+
+	broadcast(
+		const queue_ptr& queue,
+		std::size_t max_lag,
+		broadcast_policy policy = broadcast_policy( )
+	)
+	: broadcast_( q::make_shared< broadcast_type >(
+		queue, max_lag, policy ) )
+	{ }
+
+	/**
+	 * Subscribes with the lag limit and policy of the broadcast.
+	 */
+	broadcast_subscriber< T... > subscribe( )
+	{
+		return subscribe(
+			broadcast_->max_lag( ), broadcast_->policy( ) );
+	}
+
+	broadcast_subscriber< T... >
+	subscribe( std::size_t max_lag, broadcast_policy policy )
+	{
+		return broadcast_subscriber< T... >(
+			broadcast_, max_lag, policy );
+	}
+
+	/**
+	 * Writes a value, constructed from @a args, to all subscribers.
+	 *
+	 * @return false if the broadcast is closed
+	 */
+	template< typename... Args >
+	Q_NODISCARD
+	bool write( Args&&... args )
+	{
+		return broadcast_->write( std::forward< Args >( args )... );
+	}
+
+	void close( )
+	{
+		broadcast_->close( std::exception_ptr( ) );
+	}
+
+	void close( std::exception_ptr e )
+	{
+		broadcast_->close( std::move( e ) );
+	}
+
+	template< typename E >
+	typename std::enable_if<
+		!std::is_same<
+			typename std::decay< E >::type,
+			std::exception_ptr
+		>::value
+	>::type
+	close( E&& e )
+	{
+		close( std::make_exception_ptr( std::forward< E >( e ) ) );
+	}
+
+	bool is_closed( ) const
+	{
+		return broadcast_->is_closed( );
+	}
+
+	/**
+	 * False if a subscriber with the block policy has reached its lag
+	 * limit (or the broadcast is closed).
+	 */
+	bool should_write( ) const
+	{
+		return broadcast_->should_write( );
+	}
+
+	/**
+	 * Sets a function to be called (on the queue of the broadcast) when
+	 * the writer is no longer paused, or when the broadcast is closed.
+	 */
+	void set_resume_notification( shared_task fn )
+	{
+		broadcast_->set_resume_notification( std::move( fn ) );
+	}
+
+	void unset_resume_notification( )
+	{
+		broadcast_->set_resume_notification( shared_task( ) );
+	}
+
+	const queue_ptr& get_queue( ) const
+	{
+		return broadcast_->get_queue( );
+	}
+
+private:
+	std::shared_ptr< broadcast_type > broadcast_;
+};
+
+} // namespace q
+
+#endif // LIBQ_BROADCAST_HPP
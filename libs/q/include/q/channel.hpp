@@ -23,6 +23,9 @@
 #include <q/scope.hpp>
 #include <q/concurrency.hpp>
 #include <q/concurrency_counter.hpp>
+#include <q/options.hpp>
+#include <q/spill.hpp>
+#include <q/detail/ring_buffer.hpp>
 
 #include <list>
 #include <queue>
@@ -32,6 +35,216 @@ namespace q {
 
 Q_MAKE_SIMPLE_EXCEPTION( channel_closed_exception );
 
+/**
+ * How a channel stores its buffered values.
+ *
+ *   queue:     A queue guarded by the channel mutex (default).
+ *   spsc_ring: A lock-free ring buffer, for channels which are written to by
+ *              one thread at a time, and read from by one thread at a time.
+ *   mpmc_ring: A lock-free ring buffer, for any number of concurrent writers
+ *              and readers.
+ *
+ * With a ring buffer, writing and reading buffered values don't lock the
+ * channel mutex unless there are pending readers. Values written when the
+ * ring buffer is full are queued (under the mutex) after it, so they are
+ * still read in order.
+ */
+class channel_storage
+{
+public:
+	enum type
+	{
+		queue,
+		spsc_ring,
+		mpmc_ring
+	};
+
+	channel_storage( type value = queue )
+	: value_( value )
+	{ }
+
+	type get( ) const
+	{
+		return value_;
+	}
+
+private:
+	type value_;
+};
+
+/**
+ * How buffered values are counted against the buffer_count and resume_count of
+ * a channel.
+ *
+ *   values: Every value counts as one (default).
+ *   weight: Every value counts as its channel_value_weight (e.g. the size of a
+ *           byte_block), so buffer_count and resume_count are memory budgets.
+ *           A value is always accepted, so the buffer can exceed its budget
+ *           by at most the last value written.
+ */
+class channel_weight
+{
+public:
+	enum type
+	{
+		values,
+		weight
+	};
+
+	channel_weight( type value = values )
+	: value_( value )
+	{ }
+
+	type get( ) const
+	{
+		return value_;
+	}
+
+private:
+	type value_;
+};
+
+/**
+ * Spills the buffered values of a channel to memory-mapped files in a
+ * directory, when more than @c memory_threshold values (or weight, see
+ * channel_weight) are buffered in memory. The values are read back in order,
+ * and once the reader has caught up, values are buffered in memory again.
+ *
+ * Spilled values still count towards the buffer_count of the channel, so a
+ * channel which spills would typically have a large buffer_count (the total
+ * budget), and a smaller memory threshold.
+ *
+ * The values must be serializable by q::channel_serializer (which handles
+ * byte_block, std::string and arithmetic types), otherwise creating the
+ * channel throws std::invalid_argument. Writes throw if the file can't be
+ * written to.
+ */
+class channel_spill
+{
+public:
+	channel_spill( )
+	: memory_threshold_( 0 )
+	, segment_size_( 0 )
+	{ }
+
+	channel_spill(
+		std::string directory,
+		std::size_t memory_threshold,
+		std::size_t segment_size = 16 * 1024 * 1024
+	)
+	: directory_( std::move( directory ) )
+	, memory_threshold_( memory_threshold )
+	, segment_size_( segment_size )
+	{ }
+
+	bool enabled( ) const
+	{
+		return !directory_.empty( );
+	}
+
+	const std::string& directory( ) const
+	{
+		return directory_;
+	}
+
+	std::size_t memory_threshold( ) const
+	{
+		return memory_threshold_;
+	}
+
+	std::size_t segment_size( ) const
+	{
+		return segment_size_;
+	}
+
+private:
+	std::string directory_;
+	std::size_t memory_threshold_;
+	std::size_t segment_size_;
+};
+
+/**
+ * Lets a writer which runs on the queue of a channel call the callback of a
+ * waiting fast reader (e.g. consume( )) directly, instead of pushing it as a
+ * new task on the queue. This saves a queue round trip per value when the
+ * producer and the consumer share a queue.
+ *
+ * At most @c budget values are delivered inline per task run on the queue,
+ * after which they are queued as usual, so that a producer writing in a loop
+ * doesn't starve the rest of the queue. The default budget of 0 disables
+ * inline delivery.
+ *
+ * Only callbacks which don't return promises are called inline, and an
+ * exception thrown by the callback closes the channel, as it would when
+ * called from the queue.
+ */
+class channel_inline_consume
+{
+public:
+	channel_inline_consume( std::size_t budget = 0 )
+	: budget_( budget )
+	{ }
+
+	std::size_t budget( ) const
+	{
+		return budget_;
+	}
+
+private:
+	std::size_t budget_;
+};
+
+typedef options<
+	channel_storage,
+	channel_weight,
+	channel_spill,
+	channel_inline_consume
+> channel_options;
+
+namespace detail {
+
+template< typename T >
+class has_size_member
+{
+	template< typename U >
+	static auto test( int )
+	-> decltype( std::declval< const U& >( ).size( ), std::true_type( ) );
+
+	template< typename >
+	static std::false_type test( ... );
+
+public:
+	typedef decltype( test< T >( 0 ) ) type;
+};
+
+} // namespace detail
+
+/**
+ * The weight of a value in a channel with channel_weight::weight. Types with a
+ * size( ) weigh their size, other types weigh one. Specialize this for custom
+ * types.
+ */
+template<
+	typename T,
+	bool HasSize = detail::has_size_member< T >::type::value
+>
+struct channel_value_weight
+{
+	static std::size_t get( const T& )
+	{
+		return 1;
+	}
+};
+
+template< typename T >
+struct channel_value_weight< T, true >
+{
+	static std::size_t get( const T& t )
+	{
+		return t.size( );
+	}
+};
+
 template< typename... T >
 class readable;
 
@@ -43,11 +256,47 @@ class channel;
 
 namespace detail {
 
+struct channel_access;
+
+template< typename... T >
+struct stream_factory;
+
 static constexpr std::size_t default_resume_count( std::size_t count )
 {
 	return count < 3 ? count : ( ( count * 3 ) / 4 );
 }
 
+// The largest ring buffer of a weighted channel, where buffer_count is a
+// budget rather than a number of values
+static constexpr std::size_t max_weighted_ring_capacity = 1024;
+
+template<
+	typename Tuple,
+	std::size_t Index = 0,
+	bool Done = Index == std::tuple_size< Tuple >::value
+>
+struct tuple_weight
+{
+	static std::size_t get( const Tuple& t )
+	{
+		typedef typename std::tuple_element< Index, Tuple >::type
+			element_type;
+
+		return channel_value_weight< element_type >::get(
+			std::get< Index >( t ) ) +
+			tuple_weight< Tuple, Index + 1 >::get( t );
+	}
+};
+
+template< typename Tuple, std::size_t Index >
+struct tuple_weight< Tuple, Index, true >
+{
+	static std::size_t get( const Tuple& )
+	{
+		return 0;
+	}
+};
+
 template< typename... T >
 struct channel_traits
 {
@@ -215,9 +464,62 @@ public:
 	{
 		virtual ~waiter_type( ) { }
 
+		/**
+		 * Called (with the channel mutex held) before a value is
+		 * handed to the waiter. Waiters shared between channels (see
+		 * q::select) can only be claimed once, and are dropped by
+		 * the other channels.
+		 */
+		virtual bool claim( )
+		{
+			return true;
+		}
+
+		/**
+		 * Whether the waiter has been claimed by another channel.
+		 */
+		virtual bool is_done( ) const
+		{
+			return false;
+		}
+
+		/**
+		 * Called (with the channel mutex held) after the waiter has
+		 * been added to, and when it is removed from, the waiters of
+		 * the channel. A shared waiter stops counting as waiting in
+		 * all channels when it is claimed (see
+		 * shared_channel::uncount_waiter( )), in which case unlist( )
+		 * returns false, and the channel mustn't uncount it again.
+		 */
+		virtual void list( )
+		{ }
+
+		virtual bool unlist( )
+		{
+			return true;
+		}
+
+		/**
+		 * Whether set_value_inline( ) can be used for this waiter (see
+		 * channel_inline_consume).
+		 */
+		virtual bool is_inlinable( ) const
+		{
+			return false;
+		}
+
 		virtual void set_closed( ) = 0;
 		virtual void set_exception( std::exception_ptr ) = 0;
 		virtual void set_value( tuple_type&& ) = 0;
+
+		/**
+		 * Same as set_value( ), but calls the reader directly. This is
+		 * called without the channel mutex held.
+		 */
+		virtual void set_value_inline( tuple_type&& t )
+		{
+			set_value( std::move( t ) );
+		}
 	};
 
 	struct defer_waiter_type
@@ -245,6 +547,85 @@ public:
 		std::shared_ptr< defer_type > deferred;
 	};
 
+	/**
+	 * A waiter for a read with a deadline. The waiter and the timer share
+	 * the claimed flag, and whichever claims it first completes the read.
+	 */
+	struct deadline_waiter_type
+	: waiter_type
+	{
+		bool claim( ) override
+		{
+			return !claimed->exchange(
+				true, std::memory_order_acq_rel );
+		}
+		bool is_done( ) const override
+		{
+			return claimed->load( std::memory_order_acquire );
+		}
+		// Closing the channel doesn't claim the waiters, but the
+		// deadline may have passed already
+		void set_closed( ) override
+		{
+			if ( claim( ) )
+				inner->set_closed( );
+		}
+		void set_exception( std::exception_ptr e ) override
+		{
+			if ( claim( ) )
+				inner->set_exception( std::move( e ) );
+		}
+		void set_value( tuple_type&& t ) override
+		{
+			inner->set_value( std::move( t ) );
+		}
+
+		deadline_waiter_type(
+			std::unique_ptr< waiter_type > inner,
+			std::shared_ptr< std::atomic< bool > > claimed
+		)
+		: inner( std::move( inner ) )
+		, claimed( std::move( claimed ) )
+		{ }
+
+		std::unique_ptr< waiter_type > inner;
+		std::shared_ptr< std::atomic< bool > > claimed;
+	};
+
+	/**
+	 * The waiter of read( deadline ), which resolves with true and the
+	 * value.
+	 */
+	struct timed_defer_waiter_type
+	: waiter_type
+	{
+		typedef detail::defer< bool, T... > timed_defer_type;
+
+		void set_closed( ) override
+		{
+			deferred->set_exception(
+				std::make_exception_ptr(
+					channel_closed_exception( ) ) );
+		}
+		void set_exception( std::exception_ptr e ) override
+		{
+			deferred->set_exception( std::move( e ) );
+		}
+		void set_value( tuple_type&& t ) override
+		{
+			deferred->set_value( std::tuple_cat(
+				std::make_tuple( true ), std::move( t ) ) );
+		}
+
+		timed_defer_waiter_type(
+			std::shared_ptr< timed_defer_type > deferred
+		)
+		: deferred( deferred )
+		{ }
+
+		std::shared_ptr< timed_defer_type > deferred;
+	};
+
 	template< typename FnValue, typename FnClosed >
 	struct fast_waiter_type_traits
 	{
@@ -315,6 +696,8 @@ public:
 	: waiter_type
 	, fast_waiter_type_traits< FnValue, FnClosed >
 	{
+		typedef fast_waiter_type_traits< FnValue, FnClosed >
+			this_traits;
 		typedef detail::defer< bool > result_defer_type;
 
 		void set_closed( ) override
@@ -395,6 +778,70 @@ public:
 			);
 		}
 
+		typedef bool_type<
+			std::is_void< result_of_t< FnValue > >::value
+			and
+			(
+				this_traits::assignable_to_value_directly::value
+				or
+				this_traits::assignable_to_value_by_tuple::value
+			)
+		> inlinable;
+
+		bool is_inlinable( ) const override
+		{
+			return inlinable::value;
+		}
+
+		void set_value_inline( tuple_type&& t ) override
+		{
+			set_value_inline( std::move( t ), inlinable( ) );
+		}
+
+		void set_value_inline( tuple_type&& t, std::false_type )
+		{
+			set_value( std::move( t ) );
+		}
+
+		void set_value_inline( tuple_type&& t, std::true_type )
+		{
+			typedef typename this_traits
+				::assignable_to_value_directly directly;
+
+			try
+			{
+				call_value( std::move( t ), directly( ) );
+			}
+			catch ( ... )
+			{
+				auto e = std::current_exception( );
+
+				auto ch = shared_channel.lock( );
+				if ( ch )
+				{
+					ch->close( e );
+					ch->clear( );
+				}
+
+				deferred->set_exception( e );
+				return;
+			}
+
+			deferred->set_value( true );
+		}
+
+		void call_value( tuple_type&& t, std::true_type )
+		{
+			::q::call_with_args_by_tuple(
+				fn_value, std::move( t ) );
+		}
+
+		void call_value( tuple_type&& t, std::false_type )
+		{
+			::q::call_with_args(
+				fn_value, std::move( t ) );
+		}
+
 		template< typename _FnValue, typename _FnClosed >
 		fast_waiter_type(
 			_FnValue&& fn_value,
@@ -417,16 +864,47 @@ public:
 	shared_channel(
 		const queue_ptr& queue,
 		std::size_t buffer_count,
-		std::size_t resume_count
+		std::size_t resume_count,
+		channel_options options = channel_options( )
 	)
 	: default_queue_( queue )
 	, mutex_( Q_HERE, "channel" )
+	, waiting_( 0 )
+	, has_front_( false )
+	, queued_( 0 )
 	, close_exception_( std::make_tuple( false, std::exception_ptr( ) ) )
 	, closed_( false )
 	, paused_( false )
 	, buffer_count_( buffer_count )
 	, resume_count_( std::min( resume_count, buffer_count ) )
-	{ }
+	, weighted_(
+		options.get< channel_weight >( ).get( ) ==
+		channel_weight::weight )
+	, weight_( 0 )
+	, spill_threshold_( 0 )
+	, spilled_( 0 )
+	, spilled_weight_( 0 )
+	, inline_budget_( options.get< channel_inline_consume >( ).budget( ) )
+	{
+		auto storage = options.get< channel_storage >( ).get( );
+		const auto spill = options.get< channel_spill >( );
+
+		if ( spill.enabled( ) )
+		{
+			spill_ = detail::make_spill_buffer< tuple_type >(
+				spill.directory( ), spill.segment_size( ) );
+			spill_threshold_ = spill.memory_threshold( );
+		}
+
+		const auto ring_capacity = weighted_
+			? std::min( buffer_count, max_weighted_ring_capacity )
+			: buffer_count;
+
+		if ( storage == channel_storage::spsc_ring )
+			ring_.reset_spsc( ring_capacity );
+		else if ( storage == channel_storage::mpmc_ring )
+			ring_.reset_mpmc( ring_capacity );
+	}
 
 	Q_NODISCARD
 	std::size_t buffer_count( ) const
@@ -505,26 +983,46 @@ public:
 	Q_NODISCARD
 	bool write( tuple_type&& t )
 	{
-		Q_AUTO_UNIQUE_LOCK( mutex_ );
+		if ( ring_ && try_write_ring( t ) )
+			return true;
 
-		if ( closed_.load( std::memory_order_seq_cst ) )
-			return false;
+		std::unique_ptr< waiter_type > inline_waiter;
 
-		if ( waiters_.empty( ) )
 		{
-			if ( queue_.size( ) >= buffer_count_ )
-				paused_ = true;
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
 
-			queue_.push( std::move( t ) );
-		}
-		else
-		{
-			auto waiter = std::move( waiters_.front( ) );
-			waiters_.pop_front( );
+			if ( closed_.load( std::memory_order_seq_cst ) )
+				return false;
+
+			// Values which got into the ring buffer while readers
+			// were waiting must be delivered before this one.
+			deliver_buffered( );
+
+			auto waiter = pop_waiter( );
+
+			if ( !waiter )
+			{
+				buffer( std::move( t ) );
 
-			waiter->set_value( std::move( t ) );
+				// Pause when writing to an already full buffer
+				if ( buffered_size( ) > buffer_count_ )
+					paused_ = true;
+			}
+			else if ( should_deliver_inline( *waiter ) )
+			{
+				inline_waiter = std::move( waiter );
+			}
+			else
+			{
+				waiter->set_value( std::move( t ) );
+			}
 		}
 
+		// The reader is called after the mutex is released, as it
+		// may use the channel
+		if ( inline_waiter )
+			inline_waiter->set_value_inline( std::move( t ) );
+
 		return true;
 	}
 
@@ -534,17 +1032,193 @@ public:
 		return write( tuple_type( t ) );
 	}
 
+	/**
+	 * Writes all values in @a range (of tuple_type, or of the value type
+	 * for single-type channels) under one lock, in order. The values are
+	 * moved from if @a range is an rvalue.
+	 *
+	 * @return false if the channel was closed (and nothing was written)
+	 */
+	template< typename Range >
 	Q_NODISCARD
-	promise< T... > read( )
+	bool write_many( Range&& range )
 	{
 		Q_AUTO_UNIQUE_LOCK( mutex_ );
 
-		if ( queue_.empty( ) )
+		if ( closed_.load( std::memory_order_seq_cst ) )
+			return false;
+
+		deliver_buffered( );
+
+		for ( auto&& elem : range )
 		{
-			if ( closed_.load( std::memory_order_seq_cst ) )
-				return reject< T... >(
-					default_queue_,
-					std::get< 0 >( close_exception_ )
+			tuple_type t( to_tuple(
+				forward_element< Range >( elem ) ) );
+
+			auto waiter = pop_waiter( );
+
+			if ( waiter )
+				waiter->set_value( std::move( t ) );
+			else
+				buffer( std::move( t ) );
+		}
+
+		// As with single writes, pause if the last value was written
+		// to an already full buffer
+		if ( buffered_size( ) > buffer_count_ )
+			paused_ = true;
+
+		return true;
+	}
+
+	/**
+	 * Reads a buffered value into @a t, without allocating a promise.
+	 *
+	 * @return true if there was a value to read, false if there was none
+	 *         (or other readers were already waiting for values).
+	 */
+	Q_NODISCARD
+	bool try_read( tuple_type& t )
+	{
+		ring_value< tuple_type > value;
+
+		if ( !try_read( value ) )
+			return false;
+
+		t = std::move( value.get( ) );
+
+		return true;
+	}
+
+	/**
+	 * Same as try_read( tuple_type& ), but doesn't require the value type
+	 * to be default constructible.
+	 */
+	Q_NODISCARD
+	bool try_read( ring_value< tuple_type >& value )
+	{
+		if ( !try_read_ring( value ) )
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if (
+				waiting_.load( std::memory_order_seq_cst ) ||
+				!pop_buffered( value )
+			)
+				return false;
+		}
+
+		maybe_resume( );
+
+		return true;
+	}
+
+	/**
+	 * Moves up to @a count buffered values into @a batch, taking the
+	 * channel lock at most once, and checks for writer resumption once.
+	 *
+	 * @return the number of values read
+	 */
+	std::size_t read_buffered(
+		std::vector< tuple_type >& batch, std::size_t count
+	)
+	{
+		const auto size_before = batch.size( );
+		ring_value< tuple_type > value;
+
+		while ( count > batch.size( ) - size_before )
+		{
+			if ( !try_read_ring( value ) )
+				break;
+
+			batch.push_back( std::move( value.get( ) ) );
+			value.reset( );
+		}
+
+		if (
+			count > batch.size( ) - size_before &&
+			(
+				!ring_ ||
+				queued_.load( std::memory_order_seq_cst ) ||
+				spilled_.load( std::memory_order_seq_cst )
+			)
+		)
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			while (
+				!waiting_.load( std::memory_order_seq_cst ) &&
+				count > batch.size( ) - size_before &&
+				pop_buffered( value )
+			)
+			{
+				batch.push_back( std::move( value.get( ) ) );
+				value.reset( );
+			}
+		}
+
+		const auto num_read = batch.size( ) - size_before;
+
+		if ( num_read )
+			maybe_resume( );
+
+		return num_read;
+	}
+
+	/**
+	 * Reads up to @a count values as one batch. If values are buffered,
+	 * these are returned directly, otherwise the batch is the next value
+	 * written, together with whatever else was buffered by then.
+	 */
+	Q_NODISCARD
+	promise< std::vector< tuple_type > > read_up_to( std::size_t count )
+	{
+		typedef std::vector< tuple_type > batch_type;
+
+		batch_type batch;
+
+		if ( !count || read_buffered( batch, count ) )
+			return q::with( default_queue_, std::move( batch ) );
+
+		auto self = this->shared_from_this( );
+
+		return read( ).then( [ self, count ]( tuple_type&& t )
+		{
+			batch_type batch;
+			batch.reserve( count );
+			batch.push_back( std::move( t ) );
+
+			self->read_buffered( batch, count - 1 );
+
+			return batch;
+		} );
+	}
+
+	Q_NODISCARD
+	promise< T... > read( )
+	{
+		ring_value< tuple_type > value;
+
+		if ( try_read_ring( value ) )
+		{
+			maybe_resume( );
+
+			auto defer = ::q::make_shared< defer_type >(
+				default_queue_ );
+
+			defer->set_value( std::move( value.get( ) ) );
+
+			return defer->get_promise( );
+		}
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( !pop_buffered( value ) )
+		{
+			if ( closed_.load( std::memory_order_seq_cst ) )
+				return reject< T... >(
+					default_queue_,
+					std::get< 0 >( close_exception_ )
 					? std::get< 1 >( close_exception_ )
 					: std::make_exception_ptr(
 						channel_closed_exception( ) )
@@ -553,30 +1227,19 @@ public:
 			auto defer = ::q::make_shared< defer_type >(
 				default_queue_ );
 
-			waiters_.push_back(
-				::q::make_unique< defer_waiter_type >(
-					defer ) );
+			push_waiter( ::q::make_unique< defer_waiter_type >(
+				defer ) );
 
 			return defer->get_promise( );
 		}
 		else
 		{
-			tuple_type t = std::move( queue_.front( ) );
-			queue_.pop( );
-
-			if ( queue_.size( ) < resume_count_ && paused_ )
-			{
-				auto self = this->shared_from_this( );
-				default_queue_->push( [ self ]( )
-				{
-					self->resume( );
-				} );
-			}
+			maybe_resume( );
 
 			auto defer = ::q::make_shared< defer_type >(
 				default_queue_ );
 
-			defer->set_value( std::move( t ) );
+			defer->set_value( std::move( value.get( ) ) );
 
 			return defer->get_promise( );
 		}
@@ -614,8 +1277,6 @@ public:
 	>::type
 	read( FnValue&& fn_value, FnClosed&& fn_closed )
 	{
-		Q_AUTO_UNIQUE_LOCK( mutex_ );
-
 		typedef fast_waiter_type<
 			decayed_function_t< FnValue >,
 			decayed_function_t< FnClosed >
@@ -623,70 +1284,274 @@ public:
 		typedef typename specific_waiter_type::result_defer_type
 			specific_defer_type;
 
-		if ( queue_.empty( ) )
+		ring_value< tuple_type > value;
+
+		if ( try_read_ring( value ) )
+			return read_value(
+				std::move( value.get( ) ),
+				std::forward< FnValue >( fn_value ),
+				std::forward< FnClosed >( fn_closed ) );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( !pop_buffered( value ) )
 		{
 			if ( closed_.load( std::memory_order_seq_cst ) )
-			{
-				if ( std::get< 0 >( close_exception_ ) )
-					// There was a real error
-					return reject< bool >(
-						default_queue_,
-						std::get< 1 >(
-							close_exception_ ) );
-				else
-				{
-					// Nicely closed
-					auto self = this->shared_from_this( );
-
-					return q::make_promise(
-						default_queue_, fn_closed )
-					.then( [ ]( ) { return false; } );
-				}
-			}
+				return read_closed( fn_closed );
 
 			auto defer = ::q::make_shared< specific_defer_type >(
 				default_queue_ );
 
-			waiters_.push_back(
-				::q::make_unique< specific_waiter_type >(
-					std::forward< FnValue >( fn_value ),
-					std::forward< FnClosed >( fn_closed ),
-					defer,
-					this->shared_from_this( )
-				)
-			);
+			push_waiter( ::q::make_unique< specific_waiter_type >(
+				std::forward< FnValue >( fn_value ),
+				std::forward< FnClosed >( fn_closed ),
+				defer,
+				this->shared_from_this( )
+			) );
 			resume( );
 
 			return defer->get_promise( );
 		}
 		else
 		{
-			tuple_type t = std::move( queue_.front( ) );
-			queue_.pop( );
+			return read_value(
+				std::move( value.get( ) ),
+				std::forward< FnValue >( fn_value ),
+				std::forward< FnClosed >( fn_closed ) );
+		}
+	}
 
-			if ( queue_.size( ) < resume_count_ )
-			{
-				auto self = this->shared_from_this( );
-				default_queue_->push( [ self ]( )
-				{
-					self->resume( );
-				} );
-			}
+	/**
+	 * Reads the next value, or times out at @a deadline, without using
+	 * exceptions for the timeout. The promise resolves with true and the
+	 * value, or false and default constructed values on timeout. If the
+	 * channel is closed, it is rejected like for read( ).
+	 *
+	 * Only one waiter is added, and it is removed from the channel when
+	 * the deadline passes, so a late value is left for the next reader.
+	 */
+	Q_NODISCARD
+	promise< bool, T... > read( timer::point_type deadline )
+	{
+		typedef detail::defer< bool, T... > timed_defer_type;
 
-			auto defer = ::q::make_shared< specific_defer_type >(
-				default_queue_ );
+		auto defer = ::q::make_shared< timed_defer_type >(
+			default_queue_ );
+
+		ring_value< tuple_type > value;
+
+		if ( try_read_ring( value ) )
+		{
+			maybe_resume( );
+
+			timed_defer_waiter_type( defer )
+				.set_value( std::move( value.get( ) ) );
+
+			return defer->get_promise( );
+		}
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( pop_buffered( value ) )
+		{
+			maybe_resume( );
+
+			timed_defer_waiter_type( defer )
+				.set_value( std::move( value.get( ) ) );
+
+			return defer->get_promise( );
+		}
+
+		if ( closed_.load( std::memory_order_seq_cst ) )
+			return reject< bool, T... >(
+				default_queue_,
+				std::get< 0 >( close_exception_ )
+				? std::get< 1 >( close_exception_ )
+				: std::make_exception_ptr(
+					channel_closed_exception( ) )
+			);
+
+		auto claimed = std::make_shared< std::atomic< bool > >( false );
+
+		push_waiter( ::q::make_unique< deadline_waiter_type >(
+			::q::make_unique< timed_defer_waiter_type >( defer ),
+			claimed
+		) );
+		resume( );
+
+		set_deadline( deadline, claimed, [ defer ]( )
+		{
+			defer->set_value( std::tuple< bool, T... >( ) );
+		} );
+
+		return defer->get_promise( );
+	}
+
+	/**
+	 * Same as read( fn_value, fn_closed ), but if no value is read before
+	 * @a deadline (and the channel isn't closed by then), fn_timeout is
+	 * called instead, and the returned promise resolves with false.
+	 *
+	 * As for read( deadline ), the waiter is removed from the channel when
+	 * the deadline passes.
+	 */
+	template< typename FnValue, typename FnClosed, typename FnTimeout >
+	Q_NODISCARD
+	typename std::enable_if<
+		fast_waiter_type_traits<
+			decayed_function_t< FnValue >,
+			decayed_function_t< FnClosed >
+		>::callbacks_are_valid::value
+		and
+		fast_waiter_type_traits<
+			decayed_function_t< FnValue >,
+			decayed_function_t< FnTimeout >
+		>::callbacks_are_valid::value,
+		promise< bool >
+	>::type
+	read(
+		FnValue&& fn_value,
+		FnClosed&& fn_closed,
+		FnTimeout&& fn_timeout,
+		timer::point_type deadline
+	)
+	{
+		typedef fast_waiter_type<
+			decayed_function_t< FnValue >,
+			decayed_function_t< FnClosed >
+		> specific_waiter_type;
+		typedef typename specific_waiter_type::result_defer_type
+			specific_defer_type;
+
+		ring_value< tuple_type > value;
+
+		if ( try_read_ring( value ) )
+			return read_value(
+				std::move( value.get( ) ),
+				std::forward< FnValue >( fn_value ),
+				std::forward< FnClosed >( fn_closed ) );
 
-			specific_waiter_type waiter(
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( pop_buffered( value ) )
+			return read_value(
+				std::move( value.get( ) ),
+				std::forward< FnValue >( fn_value ),
+				std::forward< FnClosed >( fn_closed ) );
+
+		if ( closed_.load( std::memory_order_seq_cst ) )
+			return read_closed( fn_closed );
+
+		auto defer = ::q::make_shared< specific_defer_type >(
+			default_queue_ );
+		auto claimed = std::make_shared< std::atomic< bool > >( false );
+
+		push_waiter( ::q::make_unique< deadline_waiter_type >(
+			::q::make_unique< specific_waiter_type >(
 				std::forward< FnValue >( fn_value ),
 				std::forward< FnClosed >( fn_closed ),
 				defer,
 				this->shared_from_this( )
-			);
+			),
+			claimed
+		) );
+		resume( );
+
+		auto queue = default_queue_;
+		auto on_timeout = decay_function(
+			std::forward< FnTimeout >( fn_timeout ) );
+		Q_MOVE_INTO_MOVABLE( on_timeout );
+
+		set_deadline( deadline, claimed,
+			[ defer, queue, Q_MOVABLE_MOVE( on_timeout ) ]( )
+			mutable
+			{
+				auto fn = Q_MOVABLE_CONSUME( on_timeout );
+				auto promise = q::make_promise(
+					queue, std::move( fn ) );
 
-			waiter.set_value( std::move( t ) );
+				defer->satisfy( promise
+					.then( [ ]( ) { return false; } ) );
+			} );
 
-			return defer->get_promise( );
+		return defer->get_promise( );
+	}
+
+	/**
+	 * Adds a waiter which gets the next value (see q::select). If a value
+	 * is buffered, or the channel is closed, the waiter gets it directly.
+	 * If the waiter is shared with other channels and was claimed by any
+	 * of them already, the value is left in the channel.
+	 */
+	void add_waiter( std::unique_ptr< waiter_type > waiter )
+	{
+		ring_value< tuple_type > value;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( waiter->is_done( ) )
+				return;
+
+			if ( !pop_buffered( value ) )
+			{
+				if ( !closed_.load( std::memory_order_seq_cst ) )
+				{
+					push_waiter( std::move( waiter ) );
+					resume( );
+				}
+				else if ( std::get< 0 >( close_exception_ ) )
+					waiter->set_exception( std::get< 1 >(
+						close_exception_ ) );
+				else
+					waiter->set_closed( );
+
+				return;
+			}
+
+			if ( !waiter->claim( ) )
+			{
+				unread( value );
+				return;
+			}
+
+			waiter->set_value( std::move( value.get( ) ) );
 		}
+
+		maybe_resume( );
+	}
+
+	/**
+	 * Drops the waiters which were claimed by other channels.
+	 */
+	void purge_waiters( )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		waiters_.remove_if(
+			[ this ]( const std::unique_ptr< waiter_type >& waiter )
+			{
+				if ( !waiter->is_done( ) )
+					return false;
+
+				if ( waiter->unlist( ) )
+					uncount_waiter( );
+
+				return true;
+			}
+		);
+	}
+
+	/**
+	 * Stops counting a waiter as waiting, which lets lock-free reads and
+	 * writes through again once no waiters are left. This is called by
+	 * shared waiters (see q::select) as soon as they are claimed, from
+	 * any thread and without the mutex held, while the waiter itself is
+	 * dropped from the channel later on.
+	 */
+	void uncount_waiter( )
+	{
+		waiting_.fetch_sub( 1, std::memory_order_seq_cst );
 	}
 
 	Q_NODISCARD
@@ -739,129 +1604,905 @@ public:
 	}
 
 	/**
-	 * Adds a scope to this channel. This will cause the channel to "own"
-	 * the scope, and thereby destruct it when the channel is destructed.
+	 * Adds a scope to this channel. This will cause the channel to "own"
+	 * the scope, and thereby destruct it when the channel is destructed.
+	 */
+	void add_scope_until_closed( scope&& scope )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( closed_ )
+			// Already closed - don't keep scope
+			return;
+
+		scopes_.emplace_back( std::move( scope ) );
+	}
+
+	Q_NODISCARD
+	const queue_ptr& get_queue( ) const
+	{
+		return default_queue_;
+	}
+
+	// This will be called if this is a promise-valued channel with
+	// stop-on-async-errors enabled.
+	void clear( )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( spill_ )
+		{
+			spill_->clear( );
+			spilled_.store( 0, std::memory_order_seq_cst );
+			remove_weight( spilled_weight_.exchange( 0 ) );
+		}
+
+		ring_value< tuple_type > value;
+		while ( pop_buffered( value ) )
+			value.reset( );
+	}
+
+private:
+	template< typename... > friend class ::q::readable;
+
+	template< typename Range, typename Elem >
+	static typename std::conditional<
+		std::is_lvalue_reference< Range >::value,
+		Elem&,
+		Elem&&
+	>::type
+	forward_element( Elem& elem )
+	{
+		return static_cast< typename std::conditional<
+			std::is_lvalue_reference< Range >::value,
+			Elem&,
+			Elem&&
+		>::type >( elem );
+	}
+
+	template< typename Tuple >
+	static typename std::enable_if<
+		std::is_same< typename std::decay< Tuple >::type, tuple_type >
+			::value,
+		Tuple&&
+	>::type
+	to_tuple( Tuple&& t )
+	{
+		return std::forward< Tuple >( t );
+	}
+
+	template< typename Value >
+	static typename std::enable_if<
+		!std::is_same< typename std::decay< Value >::type, tuple_type >
+			::value,
+		tuple_type
+	>::type
+	to_tuple( Value&& value )
+	{
+		return tuple_type( std::forward< Value >( value ) );
+	}
+
+	/**
+	 * The result of a fast read from a closed (and empty) channel.
+	 *
+	 * NOTE: The mutex must be held.
+	 */
+	template< typename FnClosed >
+	promise< bool > read_closed( FnClosed& fn_closed )
+	{
+		if ( std::get< 0 >( close_exception_ ) )
+			// There was a real error
+			return reject< bool >(
+				default_queue_,
+				std::get< 1 >( close_exception_ ) );
+
+		// Nicely closed
+		return q::make_promise( default_queue_, fn_closed )
+		.then( [ ]( ) { return false; } );
+	}
+
+	/**
+	 * Calls @a on_timeout at @a deadline, unless the waiter sharing
+	 * @a claimed has been claimed by then, in which case it is removed
+	 * from the channel.
+	 */
+	void set_deadline(
+		timer::point_type deadline,
+		std::shared_ptr< std::atomic< bool > > claimed,
+		task on_timeout
+	)
+	{
+		std::weak_ptr< self_type > weak_self =
+			this->shared_from_this( );
+
+		Q_MOVE_INTO_MOVABLE( on_timeout );
+
+		default_queue_->push(
+			[ weak_self, claimed, Q_MOVABLE_MOVE( on_timeout ) ]( )
+			mutable
+			{
+				if ( claimed->exchange(
+					true, std::memory_order_acq_rel ) )
+					return;
+
+				auto self = weak_self.lock( );
+				if ( self )
+					self->purge_waiters( );
+
+				Q_MOVABLE_CONSUME( on_timeout )( );
+			},
+			deadline );
+	}
+
+	template< typename FnValue, typename FnClosed >
+	promise< bool >
+	read_value( tuple_type&& t, FnValue&& fn_value, FnClosed&& fn_closed )
+	{
+		typedef fast_waiter_type<
+			decayed_function_t< FnValue >,
+			decayed_function_t< FnClosed >
+		> specific_waiter_type;
+		typedef typename specific_waiter_type::result_defer_type
+			specific_defer_type;
+
+		if ( buffered_size( ) < resume_count_ )
+		{
+			auto self = this->shared_from_this( );
+			default_queue_->push( [ self ]( )
+			{
+				self->resume( );
+			} );
+		}
+
+		auto defer = ::q::make_shared< specific_defer_type >(
+			default_queue_ );
+
+		specific_waiter_type waiter(
+			std::forward< FnValue >( fn_value ),
+			std::forward< FnClosed >( fn_closed ),
+			defer,
+			this->shared_from_this( )
+		);
+
+		waiter.set_value( std::move( t ) );
+
+		return defer->get_promise( );
+	}
+
+	/**
+	 * The number of buffered values, or their total weight for weighted
+	 * channels. This is approximate for ring buffers, unless the mutex is
+	 * held and there are no concurrent lock-free writers or readers.
+	 */
+	std::size_t buffered_size( ) const
+	{
+		if ( weighted_ )
+			return weight_.load( std::memory_order_relaxed );
+
+		return memory_size( )
+			+ spilled_.load( std::memory_order_relaxed );
+	}
+
+	/**
+	 * Same as buffered_size( ), but without the spilled values.
+	 */
+	std::size_t memory_size( ) const
+	{
+		if ( weighted_ )
+			return weight_.load( std::memory_order_relaxed ) -
+				spilled_weight_.load(
+					std::memory_order_relaxed );
+
+		return ( ring_ ? ring_.size( ) : 0 )
+			+ queued_.load( std::memory_order_relaxed )
+			+ ( has_front_.load( std::memory_order_relaxed )
+				? 1 : 0 );
+	}
+
+	/**
+	 * Whether a value can be delivered to @a waiter by calling it directly
+	 * from the writer (see channel_inline_consume).
+	 */
+	bool should_deliver_inline( const waiter_type& waiter ) const
+	{
+		return inline_budget_ &&
+			waiter.is_inlinable( ) &&
+			default_queue_->is_current( ) &&
+			detail::take_inline_budget( inline_budget_ );
+	}
+
+	/**
+	 * Whether the next value must be spilled: once values are spilled,
+	 * the following ones are too, until all have been read back.
+	 */
+	bool should_spill( ) const
+	{
+		return spill_ && (
+			spilled_.load( std::memory_order_seq_cst ) ||
+			memory_size( ) >= spill_threshold_
+		);
+	}
+
+	/**
+	 * Buffers a value, in the ring buffer if possible, otherwise in the
+	 * queue, or in the spill file.
+	 *
+	 * NOTE: The mutex must be held.
+	 */
+	void buffer( tuple_type&& t )
+	{
+		const auto weight = weight_of( t );
+
+		if ( should_spill( ) )
+		{
+			spill_->push( t );
+			add_weight( weight );
+			spilled_weight_ += weight;
+			spilled_.store(
+				spill_->size( ), std::memory_order_seq_cst );
+			return;
+		}
+
+		add_weight( weight );
+
+		if (
+			!ring_ ||
+			!queue_.empty( ) ||
+			!ring_.try_push( std::move( t ) )
+		)
+		{
+			queue_.push( std::move( t ) );
+			queued_.store(
+				queue_.size( ), std::memory_order_seq_cst );
+		}
+	}
+
+	/**
+	 * The weight of a value, or 0 if the channel isn't weighted. Every
+	 * value weighs at least 1, so empty values can't fill the buffer
+	 * without pausing the writers.
+	 */
+	std::size_t weight_of( const tuple_type& t ) const
+	{
+		if ( !weighted_ )
+			return 0;
+
+		return std::max< std::size_t >(
+			1, detail::tuple_weight< tuple_type >::get( t ) );
+	}
+
+	/**
+	 * Accounts for a value being buffered. This is done before the value
+	 * is pushed, so that a concurrent lock-free reader never subtracts
+	 * its weight before it was added.
+	 */
+	void add_weight( std::size_t weight )
+	{
+		if ( weight )
+			weight_.fetch_add( weight, std::memory_order_seq_cst );
+	}
+
+	void remove_weight( std::size_t weight )
+	{
+		if ( weight )
+			weight_.fetch_sub( weight, std::memory_order_seq_cst );
+	}
+
+	/**
+	 * Schedules resuming the writers, if they were paused and enough
+	 * values have been read.
+	 */
+	void maybe_resume( )
+	{
+		if ( paused_ && buffered_size( ) < resume_count_ )
+		{
+			auto self = this->shared_from_this( );
+			default_queue_->push( [ self ]( )
+			{
+				self->resume( );
+			} );
+		}
+	}
+
+	/**
+	 * Lock-free write into the ring buffer, if no readers are waiting and
+	 * nothing has spilled over into the queue. Returns false (without
+	 * moving from @a t) if the write must be done under the mutex.
+	 */
+	bool try_write_ring( tuple_type& t )
+	{
+		if ( closed_.load( std::memory_order_seq_cst ) )
+			return false;
+
+		if ( waiting_.load( std::memory_order_seq_cst ) )
+			return false;
+
+		if ( queued_.load( std::memory_order_seq_cst ) )
+			return false;
+
+		if ( should_spill( ) )
+			return false;
+
+		const auto weight = weight_of( t );
+		add_weight( weight );
+
+		if ( !ring_.try_push( std::move( t ) ) )
+		{
+			remove_weight( weight );
+			return false;
+		}
+
+		// As with the queue, pause when writing to an already full
+		// buffer
+		if ( buffered_size( ) > buffer_count_ )
+			paused_ = true;
+
+		// A reader may have started waiting after we checked, without
+		// seeing the value we just pushed, so it must be delivered.
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if ( waiting_.load( std::memory_order_seq_cst ) )
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			deliver_buffered( );
+		}
+
+		return true;
+	}
+
+	/**
+	 * Lock-free read from the ring buffer, if no readers are waiting
+	 * (which would have precedence).
+	 */
+	bool try_read_ring( ring_value< tuple_type >& value )
+	{
+		if ( !ring_ || waiting_.load( std::memory_order_seq_cst ) )
+			return false;
+
+		// A value put back by unread( ) must be read (under the mutex)
+		// before the ring buffer.
+		if ( has_front_.load( std::memory_order_seq_cst ) )
+			return false;
+
+		if ( !ring_.try_pop( value ) )
+			return false;
+
+		remove_weight( weight_of( value.get( ) ) );
+
+		return true;
+	}
+
+	/**
+	 * Pops the next buffered value, in order (the ring buffer before the
+	 * values which spilled over into the queue).
+	 *
+	 * NOTE: The mutex must be held.
+	 */
+	bool pop_buffered( ring_value< tuple_type >& value )
+	{
+		if ( has_front_.load( std::memory_order_relaxed ) )
+		{
+			value.set( std::move( front_.get( ) ) );
+			front_.reset( );
+			has_front_.store( false, std::memory_order_seq_cst );
+		}
+		else if ( ring_ && ring_.try_pop( value ) )
+		{ }
+		else if ( !queue_.empty( ) )
+		{
+			value.set( std::move( queue_.front( ) ) );
+			queue_.pop( );
+			queued_.store(
+				queue_.size( ), std::memory_order_seq_cst );
+		}
+		else if ( spilled_.load( std::memory_order_relaxed ) )
+		{
+			spill_->pop( value );
+			spilled_weight_ -= weight_of( value.get( ) );
+			spilled_.store(
+				spill_->size( ), std::memory_order_seq_cst );
+		}
+		else
+		{
+			return false;
+		}
+
+		remove_weight( weight_of( value.get( ) ) );
+
+		return true;
+	}
+
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	void push_waiter( std::unique_ptr< waiter_type > waiter )
+	{
+		waiters_.push_back( std::move( waiter ) );
+		waiting_.fetch_add( 1, std::memory_order_seq_cst );
+		waiters_.back( )->list( );
+
+		// A lock-free writer may have pushed a value before seeing
+		// this waiter.
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		deliver_buffered( );
+	}
+
+	/**
+	 * Pops the first waiter which can be claimed, dropping the ones which
+	 * were claimed by other channels.
+	 *
+	 * @return the waiter, or nullptr if there was none
+	 *
+	 * NOTE: The mutex must be held.
+	 */
+	std::unique_ptr< waiter_type > pop_waiter( )
+	{
+		std::unique_ptr< waiter_type > waiter;
+
+		if ( waiters_.empty( ) )
+			return waiter;
+
+		while ( !waiter && !waiters_.empty( ) )
+		{
+			if ( waiters_.front( )->unlist( ) )
+				uncount_waiter( );
+			if ( waiters_.front( )->claim( ) )
+				waiter = std::move( waiters_.front( ) );
+			waiters_.pop_front( );
+		}
+
+		return waiter;
+	}
+
+	/**
+	 * Puts back a value which was popped from the buffer, but couldn't be
+	 * handed to any waiter. It will be the next value read.
+	 *
+	 * NOTE: The mutex must be held, and the value must have been popped
+	 *       while holding it.
+	 */
+	void unread( ring_value< tuple_type >& value )
+	{
+		add_weight( weight_of( value.get( ) ) );
+		front_.set( std::move( value.get( ) ) );
+		value.reset( );
+		has_front_.store( true, std::memory_order_seq_cst );
+	}
+
+	/**
+	 * Hands values from the ring buffer to waiting readers.
+	 *
+	 * NOTE: The mutex must be held.
+	 */
+	void deliver_buffered( )
+	{
+		if ( !ring_ )
+			return;
+
+		ring_value< tuple_type > value;
+
+		while (
+			waiting_.load( std::memory_order_seq_cst ) &&
+			ring_.try_pop( value )
+		)
+		{
+			remove_weight( weight_of( value.get( ) ) );
+
+			auto waiter = pop_waiter( );
+
+			if ( !waiter )
+			{
+				unread( value );
+				break;
+			}
+
+			waiter->set_value( std::move( value.get( ) ) );
+			value.reset( );
+		}
+	}
+
+	template< typename Tuple >
+	void _close( Tuple&& tup, bool force_exception = false )
+	{
+		shared_task notification;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			bool was_closed = closed_.exchange(
+				true, std::memory_order_seq_cst );
+
+			// When the channel is a channel of promises, and the
+			// channel is nicely closed, an inner promise that is
+			// rejected should close the channel with an error.
+			// In this case, we overwrite the non-error with this
+			// error.
+			bool has_exception = std::get< 0 >( close_exception_ );
+			bool overwrite = !has_exception && force_exception;
+
+			if ( !was_closed || overwrite )
+				close_exception_ = std::forward< Tuple >( tup );
+
+			for ( auto& waiter : waiters_ )
+			{
+				if ( waiter->unlist( ) )
+					uncount_waiter( );
+
+				if ( std::get< 0 >( close_exception_ ) )
+					waiter->set_exception( std::get< 1 >(
+						close_exception_ ) );
+				else
+					waiter->set_closed( );
+			}
+
+			waiters_.clear( );
+
+			scopes_.clear( );
+
+			notification = resume_notification_;
+		}
+
+		if ( notification )
+			notification( );
+	}
+
+	inline void resume( )
+	{
+		if ( paused_.exchange( false ) )
+		{
+			shared_task trigger_resume = resume_notification_;
+			if ( trigger_resume )
+				trigger_resume( );
+		}
+	}
+
+	queue_ptr default_queue_;
+	// TODO: Make this lock-free and consider other list types
+	mutable mutex mutex_;
+	std::list< std::unique_ptr< waiter_type > > waiters_;
+	// The number of waiters, readable without the mutex
+	std::atomic< std::size_t > waiting_;
+	any_ring_buffer< tuple_type > ring_;
+	// A value put back in front of the buffer, see unread( )
+	ring_value< tuple_type > front_;
+	std::atomic< bool > has_front_;
+	// Buffered values (which didn't fit in the ring buffer, if any)
+	std::queue< tuple_type > queue_;
+	std::atomic< std::size_t > queued_;
+	// True if arbitrary exception, false if "closed exception"
+	std::tuple< bool, std::exception_ptr > close_exception_;
+	std::atomic< bool > closed_;
+	std::atomic< bool > paused_;
+	const std::size_t buffer_count_;
+	const std::size_t resume_count_;
+	// Whether values are counted by their weight (see channel_weight)
+	const bool weighted_;
+	std::atomic< std::size_t > weight_;
+	// Values which didn't fit in memory (see channel_spill), after the
+	// values in the queue
+	std::unique_ptr< detail::spill_buffer_base< tuple_type > > spill_;
+	std::size_t spill_threshold_;
+	std::atomic< std::size_t > spilled_;
+	// The part of weight_ which is spilled
+	std::atomic< std::size_t > spilled_weight_;
+	// Values per task which may be delivered inline to fast readers (see
+	// channel_inline_consume)
+	const std::size_t inline_budget_;
+	shared_task resume_notification_;
+	std::vector< scope > scopes_;
+};
+
+template< typename... T >
+class shared_channel_owner
+{
+public:
+	shared_channel_owner( ) = delete;
+	shared_channel_owner( const shared_channel_owner& ) = default;
+	shared_channel_owner( shared_channel_owner&& ) = default;
+
+	shared_channel_owner& operator=( const shared_channel_owner& ) = default;
+	shared_channel_owner& operator=( shared_channel_owner&& ) = default;
+
+	shared_channel_owner(
+		std::shared_ptr< detail::shared_channel< T... > > ch )
+	: shared_channel_( std::move( ch ) )
+	{ }
+
+	~shared_channel_owner( )
+	{
+		shared_channel_->close( );
+	}
+
+protected:
+	std::shared_ptr< detail::shared_channel< T... > > shared_channel_;
+};
+
+/**
+ * The state machine behind readable::consume( ). It pulls values directly
+ * from the channel buffer and calls the user function with at most a fixed
+ * number of values in flight, so consuming a buffered value doesn't create
+ * any promises. Only when the buffer is empty, a single waiter is registered
+ * in the channel, which wakes up the consumer again.
+ *
+ * With a concurrency of 1, the function is called inline when pumping, in
+ * order. With a higher concurrency, every value is pushed as a task to the
+ * queue of the channel.
+ *
+ * The channel is any shared channel type with try_read( ring_value& ),
+ * read( fn_value, fn_closed ), close( exception_ptr ), clear( ) and
+ * get_queue( ), such as shared_channel and shared_priority_channel. The
+ * handle (e.g. the readable) is kept until the consumer is done, so that the
+ * channel isn't closed meanwhile by the destruction of the last one.
+ */
+template< typename Fn, typename Channel, typename Handle >
+class channel_consumer
+: public std::enable_shared_from_this<
+	channel_consumer< Fn, Channel, Handle >
+>
+{
+	typedef Channel channel_type;
+	typedef typename channel_type::tuple_type tuple_type;
+	typedef bool_type<
+		tuple_arguments_t< tuple_type >
+		::template is_convertible_to_incl_void<
+			arguments_of_t< Fn >
+		>::value
+	> call_directly;
+	typedef result_of_t< Fn > result_type;
+
+public:
+	channel_consumer(
+		Handle handle,
+		std::shared_ptr< channel_type > channel,
+		Fn&& fn,
+		std::size_t concurrency,
+		resolver< > resolve,
+		rejecter< > reject
+	)
+	: handle_( std::move( handle ) )
+	, channel_( std::move( channel ) )
+	, fn_( std::move( fn ) )
+	, queue_( channel_->get_queue( ) )
+	, concurrency_( std::max< std::size_t >( concurrency, 1 ) )
+	, mutex_( Q_HERE, "channel consumer" )
+	, in_flight_( 0 )
+	, pump_requests_( 0 )
+	, waiting_( false )
+	, stopping_( false )
+	, finished_( false )
+	, resolve_( std::move( resolve ) )
+	, reject_( std::move( reject ) )
+	{ }
+
+	/**
+	 * Reads and dispatches values until the in-flight window is full or
+	 * the buffer is empty. Only one thread pumps at a time; a pump
+	 * requested while another is running will make that one pump again.
+	 */
+	void pump( )
+	{
+		if ( pump_requests_.fetch_add( 1 ) != 0 )
+			return;
+
+		std::size_t handled = 1;
+		while ( true )
+		{
+			drain( );
+
+			const auto requests = pump_requests_.fetch_sub( handled );
+			if ( requests == handled )
+				break;
+			handled = requests - handled;
+		}
+	}
+
+private:
+	struct dispatch_task
+	{
+		std::shared_ptr< channel_consumer > self;
+		tuple_type value;
+
+		void operator( )( ) noexcept
+		{
+			self->invoke( std::move( value ) );
+		}
+	};
+
+	void drain( )
+	{
+		ring_value< tuple_type > value;
+
+		while ( !stopping_ && !waiting_ && in_flight_ < concurrency_ )
+		{
+			// Reserve a slot in the window, which is kept by the
+			// waiter if there was no buffered value
+			++in_flight_;
+
+			if ( channel_->try_read( value ) )
+			{
+				dispatch( std::move( value.get( ) ) );
+				value.reset( );
+			}
+			else
+			{
+				waiting_ = true;
+				wait( );
+			}
+		}
+
+		if ( stopping_ && in_flight_ == 0 && !finished_.exchange( true ) )
+			finish( );
+	}
+
+	void wait( )
+	{
+		auto self = this->shared_from_this( );
+
+		ignore_result(
+			channel_->read(
+				[ self ]( tuple_type&& value )
+				{
+					self->dispatch( std::move( value ) );
+				},
+				[ self ]( )
+				{
+					self->stopping_ = true;
+				}
+			)
+			.then( [ self ]( bool got_value )
+			{
+				if ( !got_value )
+					--self->in_flight_;
+				self->waiting_ = false;
+				self->pump( );
+			} )
+			.fail( [ self ]( std::exception_ptr err )
+			{
+				self->set_exception( std::move( err ), false );
+				--self->in_flight_;
+				self->waiting_ = false;
+				self->pump( );
+			} )
+		);
+	}
+
+	void dispatch( tuple_type&& value )
+	{
+		if ( concurrency_ == 1 )
+			invoke( std::move( value ) );
+		else
+			queue_->push( dispatch_task{
+				this->shared_from_this( ), std::move( value )
+			} );
+	}
+
+	void invoke( tuple_type&& value ) noexcept
+	{
+		std::exception_ptr err;
+
+		try
+		{
+			if ( !call( ::q::is_promise< result_type >( ), value ) )
+				return;
+		}
+		catch ( ... )
+		{
+			err = std::current_exception( );
+		}
+
+		complete( std::move( err ) );
+	}
+
+	/**
+	 * Calls the function synchronously.
+	 *
+	 * @return true, as the call is completed
+	 */
+	bool call( std::false_type, tuple_type& value )
+	{
+		call_fn( call_directly( ), value );
+		return true;
+	}
+
+	/**
+	 * Calls the function, and completes the call when the returned
+	 * promise is resolved or rejected.
+	 *
+	 * @return false, as the call is completed asynchronously
 	 */
-	void add_scope_until_closed( scope&& scope )
+	bool call( std::true_type, tuple_type& value )
 	{
-		Q_AUTO_UNIQUE_LOCK( mutex_ );
+		auto self = this->shared_from_this( );
 
-		if ( closed_ )
-			// Already closed - don't keep scope
-			return;
+		ignore_result(
+			call_fn( call_directly( ), value )
+			.then( [ self ]( )
+			{
+				self->complete( std::exception_ptr( ) );
+			} )
+			.fail( [ self ]( std::exception_ptr err )
+			{
+				self->complete( std::move( err ) );
+			} )
+		);
 
-		scopes_.emplace_back( std::move( scope ) );
+		return false;
 	}
 
-	Q_NODISCARD
-	const queue_ptr& get_queue( ) const
+	result_type call_fn( std::true_type, tuple_type& value )
 	{
-		return default_queue_;
+		return ::q::call_with_args_by_tuple(
+			fn_, std::move( value ) );
 	}
 
-	// This will be called if this is a promise-valued channel with
-	// stop-on-async-errors enabled.
-	void clear( )
+	result_type call_fn( std::false_type, tuple_type& value )
 	{
-		Q_AUTO_UNIQUE_LOCK( mutex_ );
-
-		while ( !queue_.empty( ) )
-			queue_.pop( );
+		return ::q::call_with_args( fn_, std::move( value ) );
 	}
 
-private:
-	template< typename... > friend class ::q::readable;
-
-	template< typename Tuple >
-	void _close( Tuple&& tup, bool force_exception = false )
+	void complete( std::exception_ptr err )
 	{
-		shared_task notification;
+		if ( err )
+			set_exception( std::move( err ), true );
+
+		--in_flight_;
+		pump( );
+	}
 
+	/**
+	 * Stops consuming with the first exception. If the exception came from
+	 * the user function, the channel is closed with it, as when reading.
+	 */
+	void set_exception( std::exception_ptr err, bool close_channel )
+	{
 		{
 			Q_AUTO_UNIQUE_LOCK( mutex_ );
 
-			bool was_closed = closed_.exchange(
-				true, std::memory_order_seq_cst );
-
-			// When the channel is a channel of promises, and the
-			// channel is nicely closed, an inner promise that is
-			// rejected should close the channel with an error.
-			// In this case, we overwrite the non-error with this
-			// error.
-			bool has_exception = std::get< 0 >( close_exception_ );
-			bool overwrite = !has_exception && force_exception;
-
-			if ( !was_closed || overwrite )
-				close_exception_ = std::forward< Tuple >( tup );
-
-			for ( auto& waiter : waiters_ )
-			{
-				if ( std::get< 0 >( close_exception_ ) )
-					waiter->set_exception( std::get< 1 >(
-						close_exception_ ) );
-				else
-					waiter->set_closed( );
-			}
-
-			waiters_.clear( );
+			if ( exception_ )
+				return;
+			exception_ = err;
+		}
 
-			scopes_.clear( );
+		stopping_ = true;
 
-			notification = resume_notification_;
+		if ( close_channel )
+		{
+			channel_->close( err );
+			channel_->clear( );
 		}
-
-		if ( notification )
-			notification( );
 	}
 
-	inline void resume( )
+	void finish( )
 	{
-		if ( paused_.exchange( false ) )
+		std::exception_ptr err;
 		{
-			shared_task trigger_resume = resume_notification_;
-			if ( trigger_resume )
-				trigger_resume( );
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+			err = exception_;
 		}
-	}
-
-	queue_ptr default_queue_;
-	// TODO: Make this lock-free and consider other list types
-	mutable mutex mutex_;
-	std::list< std::unique_ptr< waiter_type > > waiters_;
-	std::queue< tuple_type > queue_;
-	// True if arbitrary exception, false if "closed exception"
-	std::tuple< bool, std::exception_ptr > close_exception_;
-	std::atomic< bool > closed_;
-	std::atomic< bool > paused_;
-	const std::size_t buffer_count_;
-	const std::size_t resume_count_;
-	shared_task resume_notification_;
-	std::vector< scope > scopes_;
-};
 
-template< typename... T >
-class shared_channel_owner
-{
-public:
-	shared_channel_owner( ) = delete;
-	shared_channel_owner( const shared_channel_owner& ) = default;
-	shared_channel_owner( shared_channel_owner&& ) = default;
+		if ( err )
+			reject_( std::move( err ) );
+		else
+			resolve_( );
+	}
 
-	shared_channel_owner& operator=( const shared_channel_owner& ) = default;
-	shared_channel_owner& operator=( shared_channel_owner&& ) = default;
+	Handle handle_;
+	std::shared_ptr< channel_type > channel_;
+	Fn fn_;
+	queue_ptr queue_;
+	const std::size_t concurrency_;
 
-	shared_channel_owner(
-		std::shared_ptr< detail::shared_channel< T... > > ch )
-	: shared_channel_( std::move( ch ) )
-	{ }
+	mutex mutex_;
+	std::exception_ptr exception_;
 
-	~shared_channel_owner( )
-	{
-		shared_channel_->close( );
-	}
+	std::atomic< std::size_t > in_flight_;
+	std::atomic< std::size_t > pump_requests_;
+	std::atomic< bool > waiting_;
+	std::atomic< bool > stopping_;
+	std::atomic< bool > finished_;
 
-protected:
-	std::shared_ptr< detail::shared_channel< T... > > shared_channel_;
+	resolver< > resolve_;
+	rejecter< > reject_;
 };
 
 } // namespace detail
@@ -926,6 +2567,100 @@ public:
 		} ) );
 	}
 
+	/**
+	 * Reads the next value, or times out at @a deadline. The promise
+	 * resolves with true and the value, or with false (and default
+	 * constructed values) on timeout, so timeouts don't cost exceptions.
+	 * If the channel is closed, it is rejected like for read( ).
+	 *
+	 * Unlike racing read( ) against q::delay, the waiter is removed from
+	 * the channel when the deadline passes, so no value is lost.
+	 */
+	template< bool IsPromise = is_promise::value >
+	Q_NODISCARD
+	typename std::enable_if<
+		!IsPromise,
+		promise< bool, T... >
+	>::type
+	read( timer::point_type deadline )
+	{
+		return shared_channel_->read( deadline );
+	}
+
+	/**
+	 * Same as read( fn_value, fn_closed ), but calls @a fn_timeout (and
+	 * resolves the promise with false) if no value is read and the
+	 * channel isn't closed before @a deadline.
+	 */
+	template<
+		typename FnValue,
+		typename FnClosed,
+		typename FnTimeout,
+		bool IsPromise = is_promise::value
+	>
+	Q_NODISCARD
+	typename std::enable_if<
+		detail::shared_channel< T... >
+			::template fast_waiter_type_traits<
+				decayed_function_t< FnValue >,
+				decayed_function_t< FnClosed >
+			>
+			::inner_callbacks_are_valid::value
+		and
+		!IsPromise,
+		promise< bool >
+	>::type
+	read(
+		FnValue&& fn_value,
+		FnClosed&& fn_closed,
+		FnTimeout&& fn_timeout,
+		timer::point_type deadline
+	)
+	{
+		return shared_channel_->read(
+			std::forward< FnValue >( fn_value ),
+			std::forward< FnClosed >( fn_closed ),
+			std::forward< FnTimeout >( fn_timeout ),
+			deadline
+		);
+	}
+
+	/**
+	 * Reads a buffered value into @a t without waiting, and without
+	 * allocating a promise.
+	 *
+	 * @return true if a value was read, false if the channel was empty
+	 *         (or other readers were already waiting for values), or
+	 *         closed.
+	 */
+	template< bool IsPromise = is_promise::value >
+	Q_NODISCARD
+	typename std::enable_if< !IsPromise, bool >::type
+	try_read( tuple_type& t )
+	{
+		return shared_channel_->try_read( t );
+	}
+
+	/**
+	 * Reads up to @a count values at once. The returned promise resolves
+	 * with the values which are buffered, or if there are none, the next
+	 * value written (and whatever else is buffered by then). This way, a
+	 * whole batch of values costs one lock and one promise.
+	 *
+	 * If the channel is closed (and empty), the promise is rejected like
+	 * for read( ).
+	 */
+	template< bool IsPromise = is_promise::value >
+	Q_NODISCARD
+	typename std::enable_if<
+		!IsPromise,
+		promise< std::vector< tuple_type > >
+	>::type
+	read_up_to( std::size_t count )
+	{
+		return shared_channel_->read_up_to( count );
+	}
+
 	template<
 		typename FnValue,
 		typename FnClosed,
@@ -1000,7 +2735,66 @@ public:
 		);
 	}
 
-	template< typename Fn >
+	/**
+	 * Consumes the channel, calling @a fn for every value, until the
+	 * channel is closed. With a concurrency > 1, up to that many calls
+	 * (or returned promises) are in flight at once, on the channel queue.
+	 *
+	 * Buffered values are handed to @a fn without allocating any promise
+	 * per value.
+	 *
+	 * @return promise resolved when the channel is closed and all calls
+	 *         are completed, or rejected with the first exception (from
+	 *         @a fn or the channel)
+	 */
+	template< typename Fn, bool IsPromise = is_promise::value >
+	Q_NODISCARD
+	typename std::enable_if<
+		detail::shared_channel< T... >
+			::template fast_waiter_type_traits<
+				decayed_function_t< Fn >,
+				function< void( ) >
+			>
+			::inner_callbacks_are_valid::value
+		and
+		!IsPromise,
+		promise< >
+	>::type
+	consume( Fn&& fn, consume_options options = consume_options( ) )
+	{
+		typedef detail::channel_consumer<
+			decayed_function_t< Fn >,
+			detail::shared_channel< T... >,
+			readable< T... >
+		> consumer_type;
+
+		readable< T... > self = *this;
+		auto shared_channel = shared_channel_;
+
+		auto _fn = decay_function( fn );
+		Q_MOVE_INTO_MOVABLE( _fn );
+		auto _concurrency = options.template get< concurrency >( ).get( );
+
+		return q::make_promise(
+			get_queue( ),
+			[ self, shared_channel, Q_MOVABLE_MOVE( _fn ), _concurrency ]
+			( resolver< > resolve, rejecter< > reject )
+			mutable
+		{
+			auto consumer = std::make_shared< consumer_type >(
+				std::move( self ),
+				std::move( shared_channel ),
+				Q_MOVABLE_CONSUME( _fn ),
+				_concurrency,
+				std::move( resolve ),
+				std::move( reject )
+			);
+
+			consumer->pump( );
+		} );
+	}
+
+	template< typename Fn, bool IsPromise = is_promise::value >
 	Q_NODISCARD
 	typename std::enable_if<
 		detail::shared_channel< T... >
@@ -1008,7 +2802,9 @@ public:
 				decayed_function_t< Fn >,
 				function< void( ) >
 			>
-			::inner_callbacks_are_valid::value,
+			::inner_callbacks_are_valid::value
+		and
+		IsPromise,
 		promise< >
 	>::type
 	consume( Fn&& fn, consume_options options = consume_options( ) )
@@ -1016,7 +2812,7 @@ public:
 		readable< T... > self = *this;
 
 		auto _fn = decay_function( fn );
-		auto _concurrency = options.get< concurrency >( ).get( );
+		auto _concurrency = options.template get< concurrency >( ).get( );
 
 		auto counter =
 			std::make_shared< concurrency_counter >(
@@ -1259,6 +3055,75 @@ public:
 			::pipe( *this, writable );
 	}
 
+	/**
+	 * Stream operators (see q/stream.hpp). Consecutive map, filter, take,
+	 * batch and throttle stages are fused into one callback, and only a
+	 * terminal operation (consume or to_readable, or the timed window and
+	 * debounce operators) reads from this channel.
+	 */
+	template<
+		typename Fn,
+		typename Factory = detail::stream_factory< T... >
+	>
+	auto map( Fn&& fn ) const
+	-> decltype( Factory::make( std::declval< const readable& >( ) )
+		.map( std::forward< Fn >( fn ) ) )
+	{
+		return Factory::make( *this ).map( std::forward< Fn >( fn ) );
+	}
+
+	template<
+		typename Fn,
+		typename Factory = detail::stream_factory< T... >
+	>
+	auto filter( Fn&& fn ) const
+	-> decltype( Factory::make( std::declval< const readable& >( ) )
+		.filter( std::forward< Fn >( fn ) ) )
+	{
+		return Factory::make( *this )
+			.filter( std::forward< Fn >( fn ) );
+	}
+
+	template< typename Factory = detail::stream_factory< T... > >
+	auto take( std::size_t count ) const
+	-> decltype( Factory::make( std::declval< const readable& >( ) )
+		.take( count ) )
+	{
+		return Factory::make( *this ).take( count );
+	}
+
+	template< typename Factory = detail::stream_factory< T... > >
+	auto batch( std::size_t count ) const
+	-> decltype( Factory::make( std::declval< const readable& >( ) )
+		.batch( count ) )
+	{
+		return Factory::make( *this ).batch( count );
+	}
+
+	template< typename Factory = detail::stream_factory< T... > >
+	auto throttle( timer::duration_type duration ) const
+	-> decltype( Factory::make( std::declval< const readable& >( ) )
+		.throttle( duration ) )
+	{
+		return Factory::make( *this ).throttle( duration );
+	}
+
+	template< typename Factory = detail::stream_factory< T... > >
+	auto window( timer::duration_type duration ) const
+	-> decltype( Factory::make( std::declval< const readable& >( ) )
+		.window( duration ) )
+	{
+		return Factory::make( *this ).window( duration );
+	}
+
+	template< typename Factory = detail::stream_factory< T... > >
+	auto debounce( timer::duration_type duration ) const
+	-> decltype( Factory::make( std::declval< const readable& >( ) )
+		.debounce( duration ) )
+	{
+		return Factory::make( *this ).debounce( duration );
+	}
+
 	Q_NODISCARD
 	std::size_t buffer_count( ) const
 	{
@@ -1343,11 +3208,30 @@ private:
 	}
 
 	friend class channel< T... >;
+	friend struct detail::channel_access;
 
 	std::shared_ptr< detail::shared_channel< T... > > shared_channel_;
 	std::shared_ptr< detail::shared_channel_owner< T... > > shared_owner_;
 };
 
+namespace detail {
+
+/**
+ * Gives channel utilities (like q::select and streams) access to the shared
+ * channel behind a readable.
+ */
+struct channel_access
+{
+	template< typename... T >
+	static const std::shared_ptr< shared_channel< T... > >&
+	get( const readable< T... >& r )
+	{
+		return r.shared_channel_;
+	}
+};
+
+} // namespace detail
+
 template< typename... T >
 class writable
 {
@@ -1498,6 +3382,22 @@ public:
 		) ) );
 	}
 
+	/**
+	 * Writes all values in @a range in order, under one lock. The values
+	 * are either tuples, or (for single-type channels) plain values, and
+	 * they are moved from if @a range is an rvalue.
+	 *
+	 * @return false if the channel was closed (and nothing was written)
+	 */
+	template< typename Range, bool IsPromise = is_promise::value >
+	Q_NODISCARD
+	typename std::enable_if< !IsPromise, bool >::type
+	write_many( Range&& range )
+	{
+		return shared_channel_->write_many(
+			std::forward< Range >( range ) );
+	}
+
 	/**
 	 * Like write() but throws q::channel_closed_exception if the channel
 	 * was closed.
@@ -1616,11 +3516,25 @@ public:
 	channel(
 		const queue_ptr& queue,
 		std::size_t buffer_count,
-		std::size_t resume_count
+		channel_options options
+	)
+	: channel(
+		queue,
+		buffer_count,
+		detail::default_resume_count( buffer_count ),
+		std::move( options )
+	)
+	{ }
+
+	channel(
+		const queue_ptr& queue,
+		std::size_t buffer_count,
+		std::size_t resume_count,
+		channel_options options = channel_options( )
 	)
 	: shared_channel_(
 		q::make_shared< detail::shared_channel< T... > >(
-			queue, buffer_count, resume_count ) )
+			queue, buffer_count, resume_count, std::move( options ) ) )
 	, readable_( shared_channel_ )
 	, writable_( shared_channel_ )
 	{ }
@@ -1731,4 +3645,7 @@ private:
 
 } // namespace q
 
+// The stream operators on readable are implemented separately
+#include <q/stream.hpp>
+
 #endif // LIBQ_CHANNEL_HPP
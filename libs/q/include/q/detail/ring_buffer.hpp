@@ -0,0 +1,415 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_DETAIL_RING_BUFFER_HPP
+#define LIBQ_DETAIL_RING_BUFFER_HPP
+
+#include <q/pp.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace q { namespace detail {
+
+/**
+ * Storage for a value popped from a ring buffer. Values in ring buffers
+ * aren't required to be default constructible, so they are moved into this
+ * (initially empty) storage.
+ */
+template< typename T >
+class ring_value
+{
+public:
+	ring_value( ) noexcept
+	: has_value_( false )
+	{ }
+
+	ring_value( const ring_value& ) = delete;
+	ring_value& operator=( const ring_value& ) = delete;
+
+	~ring_value( )
+	{
+		reset( );
+	}
+
+	explicit operator bool( ) const noexcept
+	{
+		return has_value_;
+	}
+
+	T& get( ) noexcept
+	{
+		return *reinterpret_cast< T* >( &storage_ );
+	}
+
+	void reset( ) noexcept
+	{
+		if ( has_value_ )
+			get( ).~T( );
+		has_value_ = false;
+	}
+
+	void set( T&& t )
+	{
+		reset( );
+		emplace( std::move( t ) );
+	}
+
+	/**
+	 * Same as set( ), but the storage must be empty.
+	 */
+	void emplace( T&& t )
+	{
+		::new ( &storage_ ) T( std::move( t ) );
+		has_value_ = true;
+	}
+
+private:
+	typename std::aligned_storage< sizeof( T ), alignof( T ) >::type
+		storage_;
+	bool has_value_;
+};
+
+/**
+ * A bounded lock-free FIFO queue. The capacity is rounded up to a power of
+ * two.
+ *
+ * try_push( ) only moves from its argument if it succeeds, so the value can
+ * be put elsewhere if the ring buffer is full. try_pop( ) moves the value
+ * into an empty ring_value.
+ */
+template< typename T >
+class ring_buffer_base
+{
+public:
+	std::size_t capacity( ) const noexcept
+	{
+		return mask_ + 1;
+	}
+
+protected:
+	typedef typename std::aligned_storage< sizeof( T ), alignof( T ) >::type
+		storage_type;
+
+	// Padding between members written by different threads, so that they
+	// don't share a cache line. alignas( ) isn't used for this, since
+	// operator new doesn't honor extended alignment before C++17.
+	typedef char padding_type[ LIBQ_ASSUMED_CACHE_LINE_SIZE ];
+
+	static std::size_t round_capacity( std::size_t capacity )
+	{
+		std::size_t rounded = 2;
+		while ( rounded < capacity )
+			rounded <<= 1;
+		return rounded;
+	}
+
+	ring_buffer_base( std::size_t capacity )
+	: mask_( round_capacity( capacity ) - 1 )
+	{ }
+
+	~ring_buffer_base( )
+	{ }
+
+	static T* at( storage_type& storage )
+	{
+		return reinterpret_cast< T* >( &storage );
+	}
+
+	const std::size_t mask_;
+};
+
+/**
+ * Multi-producer multi-consumer ring buffer, where every slot has a sequence
+ * number telling whether it is free to write to or ready to be read from
+ * (by Dmitry Vyukov).
+ */
+template< typename T, bool SingleProducerSingleConsumer = false >
+class ring_buffer
+: public ring_buffer_base< T >
+{
+	typedef ring_buffer_base< T > base;
+	typedef typename base::storage_type storage_type;
+
+public:
+	ring_buffer( std::size_t capacity )
+	: base( capacity )
+	, cells_( new cell[ this->capacity( ) ] )
+	, push_pos_( 0 )
+	, pop_pos_( 0 )
+	{
+		for ( std::size_t i = 0; i < this->capacity( ); ++i )
+			cells_[ i ].sequence.store(
+				i, std::memory_order_relaxed );
+	}
+
+	~ring_buffer( )
+	{
+		ring_value< T > value;
+		while ( try_pop( value ) )
+			value.reset( );
+	}
+
+	bool try_push( T&& t )
+	{
+		cell* c;
+		std::size_t pos = push_pos_.load( std::memory_order_relaxed );
+
+		while ( true )
+		{
+			c = &cells_[ pos & this->mask_ ];
+			const std::size_t seq =
+				c->sequence.load( std::memory_order_acquire );
+			const auto diff =
+				static_cast< std::intptr_t >( seq ) -
+				static_cast< std::intptr_t >( pos );
+
+			if ( diff == 0 )
+			{
+				if ( push_pos_.compare_exchange_weak(
+					pos, pos + 1, std::memory_order_relaxed
+				) )
+					break;
+			}
+			else if ( diff < 0 )
+				// Full
+				return false;
+			else
+				pos = push_pos_.load(
+					std::memory_order_relaxed );
+		}
+
+		::new ( &c->storage ) T( std::move( t ) );
+		c->sequence.store( pos + 1, std::memory_order_release );
+
+		return true;
+	}
+
+	bool try_pop( ring_value< T >& value )
+	{
+		cell* c;
+		std::size_t pos = pop_pos_.load( std::memory_order_relaxed );
+
+		while ( true )
+		{
+			c = &cells_[ pos & this->mask_ ];
+			const std::size_t seq =
+				c->sequence.load( std::memory_order_acquire );
+			const auto diff =
+				static_cast< std::intptr_t >( seq ) -
+				static_cast< std::intptr_t >( pos + 1 );
+
+			if ( diff == 0 )
+			{
+				if ( pop_pos_.compare_exchange_weak(
+					pos, pos + 1, std::memory_order_relaxed
+				) )
+					break;
+			}
+			else if ( diff < 0 )
+				// Empty
+				return false;
+			else
+				pos = pop_pos_.load(
+					std::memory_order_relaxed );
+		}
+
+		T* t = base::at( c->storage );
+		value.emplace( std::move( *t ) );
+		t->~T( );
+		c->sequence.store(
+			pos + this->mask_ + 1, std::memory_order_release );
+
+		return true;
+	}
+
+	std::size_t size( ) const noexcept
+	{
+		const std::size_t pop = pop_pos_.load( std::memory_order_acquire );
+		const std::size_t push =
+			push_pos_.load( std::memory_order_acquire );
+
+		return push > pop ? push - pop : 0;
+	}
+
+private:
+	struct cell
+	{
+		std::atomic< std::size_t > sequence;
+		storage_type storage;
+	};
+
+	std::unique_ptr< cell[ ] > cells_;
+
+	typename base::padding_type pad_push_;
+	std::atomic< std::size_t > push_pos_;
+	typename base::padding_type pad_pop_;
+	std::atomic< std::size_t > pop_pos_;
+	typename base::padding_type pad_end_;
+};
+
+/**
+ * Single-producer single-consumer ring buffer. Only one thread may push at a
+ * time, and only one thread may pop at a time, but these roles can move
+ * between threads as long as the hand-over is synchronized.
+ *
+ * The producer caches the consumer position (and vice versa), so the other
+ * side's cache line is only read when the ring buffer looks full (or empty).
+ */
+template< typename T >
+class ring_buffer< T, true >
+: public ring_buffer_base< T >
+{
+	typedef ring_buffer_base< T > base;
+	typedef typename base::storage_type storage_type;
+
+public:
+	ring_buffer( std::size_t capacity )
+	: base( capacity )
+	, slots_( new storage_type[ this->capacity( ) ] )
+	, push_pos_( 0 )
+	, cached_pop_pos_( 0 )
+	, pop_pos_( 0 )
+	, cached_push_pos_( 0 )
+	{ }
+
+	~ring_buffer( )
+	{
+		ring_value< T > value;
+		while ( try_pop( value ) )
+			value.reset( );
+	}
+
+	bool try_push( T&& t )
+	{
+		const std::size_t pos =
+			push_pos_.load( std::memory_order_relaxed );
+
+		if ( pos - cached_pop_pos_ > this->mask_ )
+		{
+			cached_pop_pos_ =
+				pop_pos_.load( std::memory_order_acquire );
+			if ( pos - cached_pop_pos_ > this->mask_ )
+				// Full
+				return false;
+		}
+
+		::new ( &slots_[ pos & this->mask_ ] ) T( std::move( t ) );
+		push_pos_.store( pos + 1, std::memory_order_release );
+
+		return true;
+	}
+
+	bool try_pop( ring_value< T >& value )
+	{
+		const std::size_t pos =
+			pop_pos_.load( std::memory_order_relaxed );
+
+		if ( pos == cached_push_pos_ )
+		{
+			cached_push_pos_ =
+				push_pos_.load( std::memory_order_acquire );
+			if ( pos == cached_push_pos_ )
+				// Empty
+				return false;
+		}
+
+		T* t = base::at( slots_[ pos & this->mask_ ] );
+		value.emplace( std::move( *t ) );
+		t->~T( );
+		pop_pos_.store( pos + 1, std::memory_order_release );
+
+		return true;
+	}
+
+	std::size_t size( ) const noexcept
+	{
+		const std::size_t pop = pop_pos_.load( std::memory_order_acquire );
+		const std::size_t push =
+			push_pos_.load( std::memory_order_acquire );
+
+		return push > pop ? push - pop : 0;
+	}
+
+private:
+	std::unique_ptr< storage_type[ ] > slots_;
+
+	typename base::padding_type pad_push_;
+	std::atomic< std::size_t > push_pos_;
+	std::size_t cached_pop_pos_;
+
+	typename base::padding_type pad_pop_;
+	std::atomic< std::size_t > pop_pos_;
+	std::size_t cached_push_pos_;
+	typename base::padding_type pad_end_;
+};
+
+/**
+ * Either kind of ring buffer (or none), as chosen at runtime. The calls
+ * dispatch on which one is set, rather than through virtual functions, so
+ * that the lock-free push and pop can be inlined.
+ */
+template< typename T >
+class any_ring_buffer
+{
+public:
+	explicit operator bool( ) const noexcept
+	{
+		return spsc_ || mpmc_;
+	}
+
+	void reset_spsc( std::size_t capacity )
+	{
+		mpmc_.reset( );
+		spsc_.reset( new ring_buffer< T, true >( capacity ) );
+	}
+
+	void reset_mpmc( std::size_t capacity )
+	{
+		spsc_.reset( );
+		mpmc_.reset( new ring_buffer< T >( capacity ) );
+	}
+
+	// NOTE: The ring buffer must be set, for this and the functions below.
+	bool try_push( T&& t )
+	{
+		return spsc_
+			? spsc_->try_push( std::move( t ) )
+			: mpmc_->try_push( std::move( t ) );
+	}
+
+	bool try_pop( ring_value< T >& value )
+	{
+		return spsc_
+			? spsc_->try_pop( value )
+			: mpmc_->try_pop( value );
+	}
+
+	std::size_t size( ) const noexcept
+	{
+		return spsc_ ? spsc_->size( ) : mpmc_->size( );
+	}
+
+private:
+	std::unique_ptr< ring_buffer< T, true > > spsc_;
+	std::unique_ptr< ring_buffer< T > > mpmc_;
+};
+
+} } // namespace detail, namespace q
+
+#endif // LIBQ_DETAIL_RING_BUFFER_HPP
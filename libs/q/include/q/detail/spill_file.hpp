@@ -0,0 +1,85 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_DETAIL_SPILL_FILE_HPP
+#define LIBQ_DETAIL_SPILL_FILE_HPP
+
+#include <q/block.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace q { namespace detail {
+
+/**
+ * A FIFO queue of byte records, stored in memory-mapped segment files in a
+ * directory. The files are removed as soon as they are created, so they
+ * don't outlive the process.
+ *
+ * Records are appended to the last segment, and a new segment is created
+ * when a record doesn't fit. Popped records are byte_blocks pointing into the
+ * mapping (they keep their segment mapped), and a segment is unmapped when it
+ * has been read and no such byte_block remains.
+ *
+ * This is not thread safe.
+ */
+class spill_file
+{
+public:
+	spill_file( std::string directory, std::size_t segment_size );
+	~spill_file( );
+
+	spill_file( const spill_file& ) = delete;
+	spill_file& operator=( const spill_file& ) = delete;
+
+	void push( const std::uint8_t* data, std::size_t size );
+
+	/**
+	 * Pops the next record. The spill_file must not be empty.
+	 */
+	byte_block pop( );
+
+	void clear( );
+
+	/**
+	 * The number of records.
+	 */
+	std::size_t size( ) const
+	{
+		return size_;
+	}
+
+	bool empty( ) const
+	{
+		return size_ == 0;
+	}
+
+private:
+	struct segment;
+
+	std::shared_ptr< segment > make_segment( std::size_t size );
+
+	const std::string directory_;
+	const std::size_t segment_size_;
+	std::deque< std::shared_ptr< segment > > segments_;
+	std::size_t size_;
+};
+
+} } // namespace detail, namespace q
+
+#endif // LIBQ_DETAIL_SPILL_FILE_HPP
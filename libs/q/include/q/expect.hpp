@@ -90,17 +90,16 @@ protected:
 	std::exception_ptr e_;
 };
 
-template<
-	typename T,
-	bool Static =
-		q::is_default_constructible< T >::value &&
-		(
-			::q::is_copy_constructible< T >::value ||
-			!::q::is_copy_constructible< T >::value
-		) &&
-		::q::is_movable< T >::value
->
-class expect_value
+template< typename T >
+class expect_value;
+
+/**
+ * Holds either a value or an exception, never both, in one shared storage
+ * with a single discriminator. The value is stored inline (it is never heap
+ * allocated), and is moved or copied exactly once when the storage is.
+ */
+template< typename T >
+class expect_storage
 {
 public:
 	typedef q::is_nothrow_default_constructible< T >
@@ -109,27 +108,110 @@ public:
 		noexcept_move_constructor;
 	typedef q::is_nothrow_copy_constructible< T >
 		noexcept_copy_constructor;
+
+	bool has_exception( ) const
+	{
+		return has_exception_;
+	}
+
+	std::exception_ptr exception( ) const
+	{
+		return has_exception_ ? e_ : std::exception_ptr( );
+	}
+
+	void rethrow_on_exception( ) const
+	{
+		if ( has_exception_ )
+			std::rethrow_exception( e_ );
+	}
+
 protected:
-	expect_value( )
+	typedef typename std::conditional<
+		::q::is_movable< T >::value, T&&, const T&
+	>::type move_type;
+
+	expect_storage( )
 	noexcept( noexcept_default_constructor::value )
-	: t_( )
-	{ }
+	: has_exception_( false )
+	{
+		::new ( &t_ ) T( );
+	}
 
-	expect_value( T&& t )
+	expect_storage( T&& t )
 	noexcept( noexcept_move_constructor::value )
-	: t_( std::move( t ) )
-	{ }
+	: has_exception_( false )
+	{
+		::new ( &t_ ) T( static_cast< move_type >( t ) );
+	}
 
-	expect_value( const T& t )
+	expect_storage( const T& t )
 	noexcept( noexcept_copy_constructor::value )
-	: t_( t )
-	{ }
+	: has_exception_( false )
+	{
+		::new ( &t_ ) T( t );
+	}
+
+	expect_storage( std::exception_ptr&& e )
+	: has_exception_( true )
+	{
+		ensure_exception( e );
+		::new ( &e_ ) std::exception_ptr( std::move( e ) );
+	}
 
-	expect_value( expect_value< T, Static >&& ) = default;
-	expect_value( const expect_value< T, Static >& ) = default;
+	expect_storage( const std::exception_ptr& e )
+	: has_exception_( true )
+	{
+		ensure_exception( e );
+		::new ( &e_ ) std::exception_ptr( e );
+	}
 
-	expect_value& operator=( expect_value< T, Static >&& ) = default;
-	expect_value& operator=( const expect_value< T, Static >& ) = default;
+	expect_storage( expect_storage< T >&& ref )
+	noexcept( noexcept_move_constructor::value )
+	: has_exception_( ref.has_exception_ )
+	{
+		if ( has_exception_ )
+			::new ( &e_ ) std::exception_ptr( std::move( ref.e_ ) );
+		else
+			::new ( &t_ ) T( static_cast< move_type >( ref.t_ ) );
+	}
+
+	expect_storage( const expect_storage< T >& ref )
+	noexcept( noexcept_copy_constructor::value )
+	: has_exception_( ref.has_exception_ )
+	{
+		if ( has_exception_ )
+			::new ( &e_ ) std::exception_ptr( ref.e_ );
+		else
+			::new ( &t_ ) T( ref.t_ );
+	}
+
+	expect_storage& operator=( expect_storage< T >&& ref )
+	noexcept( noexcept_move_constructor::value )
+	{
+		if ( this != &ref )
+		{
+			destroy( );
+			if ( ref.has_exception_ )
+				construct_exception( std::move( ref.e_ ) );
+			else
+				construct_value(
+					static_cast< move_type >( ref.t_ ) );
+		}
+		return *this;
+	}
+
+	expect_storage& operator=( const expect_storage< T >& ref )
+	noexcept( noexcept_copy_constructor::value )
+	{
+		if ( this != &ref )
+			copy_assign( ref, noexcept_move_constructor( ) );
+		return *this;
+	}
+
+	~expect_storage( )
+	{
+		destroy( );
+	}
 
 	const T& _get( ) const
 	noexcept
@@ -140,62 +222,102 @@ protected:
 	T _consume( )
 	noexcept( noexcept_move_constructor::value )
 	{
-		return std::move( t_ );
+		return static_cast< move_type >( t_ );
 	}
 
-	T t_;
-};
+private:
+	static void ensure_exception( const std::exception_ptr& e )
+	{
+		if ( !e )
+			Q_THROW( invalid_exception_exception( ) );
+	}
 
-template< typename T >
-class expect_value< T, false >
-{
-public:
-	typedef q::is_nothrow_default_constructible< T >
-		noexcept_default_constructor;
-	typedef q::is_nothrow_move_constructible< T >
-		noexcept_move_constructor;
-	typedef q::is_nothrow_copy_constructible< T >
-		noexcept_copy_constructor;
-protected:
-	expect_value( )
-	noexcept( noexcept_default_constructor::value )
-	{ }
+	/**
+	 * Copies into a temporary first, so that if the copy throws, this is
+	 * left untouched.
+	 */
+	void copy_assign( const expect_storage< T >& ref, std::true_type )
+	{
+		expect_storage< T > copy( ref );
+		*this = std::move( copy );
+	}
 
-	expect_value( T&& t )
-	noexcept( noexcept_move_constructor::value )
-	: t_( nullptr )
+	void copy_assign( const expect_storage< T >& ref, std::false_type )
 	{
-		// TODO: Handle exceptions (uncaught exception or similar)
-		t_.reset( new T( std::move( t ) ) );
+		destroy( );
+		if ( ref.has_exception_ )
+			construct_exception( ref.e_ );
+		else
+			construct_value( ref.t_ );
 	}
 
-	expect_value( const T& t )
-	noexcept( noexcept_copy_constructor::value )
-	: t_( nullptr )
+	/**
+	 * NOTE: The storage must be destroyed.
+	 */
+	void construct_exception( std::exception_ptr e )
+	noexcept
 	{
-		// TODO: Handle exceptions (uncaught exception or similar)
-		t_.reset( new T( t ) );
+		::new ( &e_ ) std::exception_ptr( std::move( e ) );
+		has_exception_ = true;
 	}
 
-	expect_value( expect_value< T, false >&& ) = default;
-	expect_value( const expect_value< T, false >& ) = default;
+	/**
+	 * Constructs the value into destroyed storage. If this throws, the
+	 * storage holds the exception rather than being left destroyed, so
+	 * that it isn't destroyed twice.
+	 *
+	 * NOTE: The storage must be destroyed.
+	 */
+	template< typename U >
+	void construct_value( U&& u )
+	noexcept( noexcept( T( std::declval< U >( ) ) ) )
+	{
+		typedef std::integral_constant<
+			bool, noexcept( T( std::declval< U >( ) ) )
+		> noexcept_construct;
 
-	expect_value& operator=( expect_value< T, false >&& ) = default;
-	expect_value& operator=( const expect_value< T, false >& ) = default;
+		construct_value(
+			std::forward< U >( u ), noexcept_construct( ) );
+	}
 
-	const T& _get( ) const
+	template< typename U >
+	void construct_value( U&& u, std::true_type )
 	noexcept
 	{
-		return *t_;
+		::new ( &t_ ) T( std::forward< U >( u ) );
+		has_exception_ = false;
 	}
 
-	T _consume( )
-	noexcept( std::is_nothrow_move_assignable< T >::value )
+	template< typename U >
+	void construct_value( U&& u, std::false_type )
 	{
-		return std::move( *t_ );
+		try
+		{
+			::new ( &t_ ) T( std::forward< U >( u ) );
+			has_exception_ = false;
+		}
+		catch ( ... )
+		{
+			construct_exception( std::current_exception( ) );
+			throw;
+		}
+	}
+
+	void destroy( )
+	noexcept
+	{
+		if ( has_exception_ )
+			e_.~exception_ptr( );
+		else
+			t_.~T( );
 	}
 
-	std::unique_ptr< T > t_;
+	union
+	{
+		T t_;
+		std::exception_ptr e_;
+	};
+	bool has_exception_;
 };
 
 template< >
@@ -274,10 +396,9 @@ template<
 	bool MoveConstructible = ::q::is_movable< T >::value
 >
 class expect // copyable & movable
-: public detail::expect_exception
-, private detail::expect_value< T >
+: public detail::expect_storage< T >
 {
-	typedef detail::expect_value< T > base;
+	typedef detail::expect_storage< T > base;
 
 public:
 	typedef T value_type;
@@ -287,24 +408,20 @@ public:
 
 	expect( T&& t )
 	noexcept( base::noexcept_move_constructor::value )
-	: detail::expect_exception( )
-	, base( std::move( t ) )
+	: base( std::move( t ) )
 	{ }
 
 	expect( const T& t )
 	noexcept( base::noexcept_copy_constructor::value )
-	: detail::expect_exception( )
-	, base( t )
+	: base( t )
 	{ }
 
 	explicit expect( std::exception_ptr&& e )
-	noexcept( base::noexcept_default_constructor::value )
-	: detail::expect_exception( std::move( e ) )
+	: base( std::move( e ) )
 	{ }
 
 	explicit expect( const std::exception_ptr& e )
-	noexcept( base::noexcept_default_constructor::value )
-	: detail::expect_exception( e )
+	: base( e )
 	{ }
 
 	expect( self_type&& ) = default;
@@ -315,23 +432,22 @@ public:
 
 	const T& get( ) const
 	{
-		rethrow_on_exception( );
+		base::rethrow_on_exception( );
 		return base::_get( );
 	}
 
 	T consume( )
 	{
-		rethrow_on_exception( );
+		base::rethrow_on_exception( );
 		return base::_consume( );
 	}
 };
 
 template< typename T >
 class expect< T, false, true > // movable
-: public detail::expect_exception
-, private detail::expect_value< T >
+: public detail::expect_storage< T >
 {
-	typedef detail::expect_value< T > base;
+	typedef detail::expect_storage< T > base;
 
 public:
 	typedef T value_type;
@@ -341,18 +457,17 @@ public:
 
 	expect( T&& t )
 	noexcept( base::noexcept_move_constructor::value )
-	: detail::expect_exception( )
-	, base( std::move( t ) )
+	: base( std::move( t ) )
 	{ }
 
 	expect( const T& t ) = delete;
 
 	explicit expect( std::exception_ptr&& e )
-	: detail::expect_exception( std::move( e ) )
+	: base( std::move( e ) )
 	{ }
 
 	explicit expect( const std::exception_ptr& e )
-	: detail::expect_exception( e )
+	: base( e )
 	{ }
 
 	expect( self_type&& ) = default;
@@ -363,23 +478,22 @@ public:
 
 	const T& get( ) const
 	{
-		rethrow_on_exception( );
+		base::rethrow_on_exception( );
 		return base::_get( );
 	}
 
 	T consume( )
 	{
-		rethrow_on_exception( );
-		return std::move( base::_consume( ) );
+		base::rethrow_on_exception( );
+		return base::_consume( );
 	}
 };
 
 template< typename T >
 class expect< T, true, false > // copyable, not movable
-: public detail::expect_exception
-, private detail::expect_value< T >
+: public detail::expect_storage< T >
 {
-	typedef detail::expect_value< T > base;
+	typedef detail::expect_storage< T > base;
 
 public:
 	typedef T value_type;
@@ -389,22 +503,20 @@ public:
 
 	expect( T&& t )
 	noexcept( base::noexcept_move_constructor::value )
-	: detail::expect_exception( )
-	, base( t )
+	: base( t )
 	{ }
 
 	expect( const T& t )
 	noexcept( base::noexcept_copy_constructor::value )
-	: detail::expect_exception( )
-	, base( t )
+	: base( t )
 	{ }
 
 	explicit expect( std::exception_ptr&& e )
-	: detail::expect_exception( std::move( e ) )
+	: base( std::move( e ) )
 	{ }
 
 	explicit expect( const std::exception_ptr& e )
-	: detail::expect_exception( e )
+	: base( e )
 	{ }
 
 	expect( self_type&& ) = default;
@@ -415,13 +527,13 @@ public:
 
 	const T& get( ) const
 	{
-		rethrow_on_exception( );
+		base::rethrow_on_exception( );
 		return base::_get( );
 	}
 
 	T consume( )
 	{
-		rethrow_on_exception( );
+		base::rethrow_on_exception( );
 		return base::_get( );
 	}
 };
@@ -523,10 +635,10 @@ public:
 		return base::_get( );
 	}
 
-	std::exception_ptr&& consume( )
+	std::exception_ptr consume( )
 	{
 		rethrow_on_exception( );
-		return std::move( base::_consume( ) );
+		return base::_consume( );
 	}
 };
 
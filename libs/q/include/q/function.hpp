@@ -20,6 +20,10 @@
 #include <q/pp.hpp>
 #include <q/functional.hpp>
 
+#include <cstring>
+#include <map>
+#include <mutex>
+
 #ifdef LIBQ_ON_WINDOWS
 #	pragma warning( push )
 #	pragma warning( disable : 4521 )
@@ -34,7 +38,8 @@
  * The following macros are available:
  *
  *   Q_RECORD_FUNCTION_STATS:
- *     Define to enable function (type and size) statistics to be printed at
+ *     Define to enable function (type and size) statistics to be recorded.
+ *     They can be queried with q::get_function_stats( ), and are printed at
  *     program exit. This slows down the application slightly (not
  *     dramatically).
  *
@@ -47,17 +52,20 @@
  *   Q_USE_FUNCTION_ALIGN:
  *     The enforced alignment of the functions. Defaults to (assumed) cache
  *     line size.
+ *
+ *   Q_NO_FUNCTION_POOL:
+ *     Define to allocate function objects which don't fit inline with plain
+ *     new/delete (and std::make_shared), rather than from the size-class
+ *     pool in libq. This must be the same when building libq as when using
+ *     it.
  */
 
 #ifdef Q_RECORD_FUNCTION_STATS
-#	include <unordered_map>
-#	include <map>
 #	include <iostream>
-#	include <thread>
 #endif // Q_RECORD_FUNCTION_STATS
 
 #ifdef Q_USE_FUNCTION_SIZE
-#	define LIBQ__FUNCTION_INLINE_SIZE Q_USE_FUNCTION_INLINE_SIZE
+#	define LIBQ__FUNCTION_INLINE_SIZE Q_USE_FUNCTION_SIZE
 #else
 	// The default function size is twice the cache line size, which is
 	// assumed to be 8 words (e.g. 64 bytes in 64-bit systems)
@@ -71,14 +79,157 @@
 #	define LIBQ__FUNCTION_INLINE_ALIGN LIBQ_ASSUMED_CACHE_LINE_SIZE
 #endif
 #define LIBQ__FUNCTION_INLINE_STATE_SIZE sizeof( std::ptrdiff_t )
+#ifdef Q_NO_FUNCTION_ALIGN
+#	define LIBQ__FUNCTION_DATA_ALIGN sizeof( std::ptrdiff_t )
+#else
+#	define LIBQ__FUNCTION_DATA_ALIGN ( LIBQ__FUNCTION_INLINE_STATE_SIZE * 2 )
+#endif
 
 namespace q {
 
+/**
+ * Statistics of the function objects which have been stored in q::function,
+ * q::unique_function and q::custom_function. These are only recorded if
+ * Q_RECORD_FUNCTION_STATS is defined, otherwise all histograms are empty.
+ *
+ * Every histogram maps the size of function objects (in bytes) to the number
+ * of times such a function object has been stored with that storage method.
+ * Function objects in the unique_ptr and shared_ptr histograms didn't fit
+ * inline, or were not copyable, and were allocated on the heap.
+ */
+struct function_stats
+{
+	typedef std::map< std::size_t, std::size_t > histogram_type;
+
+	histogram_type plain;
+	histogram_type inlined;
+	histogram_type unique_ptr;
+	histogram_type shared_ptr;
+
+	std::size_t unique_functions = 0;
+	std::size_t shared_functions = 0;
+
+	/**
+	 * The total number of function objects in a histogram.
+	 */
+	static std::size_t count( const histogram_type& histogram )
+	{
+		std::size_t num = 0;
+		for ( auto& bucket : histogram )
+			num += bucket.second;
+		return num;
+	}
+};
+
+/**
+ * Statistics of the pool from which function objects that don't fit inline
+ * are allocated. Every thread has a cache of free blocks per size class,
+ * which is refilled from (and spilled to) a central free list, so blocks
+ * freed by another thread than the one that allocated them are reused too.
+ * Function objects larger than the largest size class are allocated with
+ * plain new.
+ */
+struct function_pool_stats
+{
+	// Allocations served from the thread cache
+	std::size_t cache_hits = 0;
+	// Allocations which refilled the thread cache from the central pool
+	std::size_t central_hits = 0;
+	// Allocations which required a new chunk of memory
+	std::size_t chunk_allocations = 0;
+	// Allocations too large for the pool
+	std::size_t oversized = 0;
+	// Deallocations (of pooled blocks)
+	std::size_t deallocations = 0;
+
+	std::size_t allocations( ) const
+	{
+		return cache_hits + central_hits + chunk_allocations
+			+ oversized;
+	}
+
+	/**
+	 * The ratio of allocations served without a lock (0 to 1).
+	 */
+	double hit_rate( ) const
+	{
+		const auto total = allocations( );
+		return total
+			? static_cast< double >( cache_hits ) / total
+			: 0.0;
+	}
+};
+
+/**
+ * Returns the function pool statistics, summed over all threads.
+ */
+function_pool_stats get_function_pool_stats( );
+
 namespace detail {
 
+void* function_pool_allocate( std::size_t size );
+void function_pool_deallocate( void* ptr, std::size_t size ) noexcept;
+
+/**
+ * Allocator for the shared_ptr control blocks (and the function objects
+ * they contain) of heap allocated function objects.
+ */
+template< typename T >
+struct function_allocator
+{
+	typedef T value_type;
+
+	function_allocator( ) noexcept { }
+
+	template< typename U >
+	function_allocator( const function_allocator< U >& ) noexcept { }
+
+	T* allocate( std::size_t n )
+	{
+#ifdef Q_NO_FUNCTION_POOL
+		return static_cast< T* >( ::operator new( n * sizeof( T ) ) );
+#else
+		return static_cast< T* >(
+			function_pool_allocate( n * sizeof( T ) ) );
+#endif
+	}
+
+	void deallocate( T* ptr, std::size_t n ) noexcept
+	{
+#ifdef Q_NO_FUNCTION_POOL
+		( void )n;
+		::operator delete( ptr );
+#else
+		function_pool_deallocate( ptr, n * sizeof( T ) );
+#endif
+	}
+
+	template< typename U >
+	bool operator==( const function_allocator< U >& ) const noexcept
+	{
+		return true;
+	}
+
+	template< typename U >
+	bool operator!=( const function_allocator< U >& ) const noexcept
+	{
+		return false;
+	}
+};
+
+template< typename T, typename... Args >
+std::shared_ptr< T > make_shared_function( Args&&... args )
+{
+	return std::allocate_shared< T >(
+		function_allocator< T >( ), std::forward< Args >( args )... );
+}
+
 template< typename Signature, typename Ret, typename... Args >
 struct function_base;
 
+template< typename Signature, typename Ret, typename... Args >
+struct function_ops;
+
 template<
 	typename Fn,
 	typename Signature,
@@ -101,17 +252,34 @@ struct function_base
 
 	virtual Ret operator( )( Args... ) = 0;
 
-	virtual this_type* move_to( void* ) = 0;
-
-	virtual std::shared_ptr< this_type > move_to_shared( ) = 0;
+	/**
+	 * Moves the wrapped function object (not this heap wrapper) into the
+	 * inline storage @a dest, if it fits within @a size bytes and
+	 * @a align alignment.
+	 *
+	 * @return The ops table for the inlined function object, or nullptr
+	 *         if it doesn't fit (in which case nothing is moved).
+	 */
+	virtual const function_ops< Signature, Ret, Args... >*
+	move_inline_to( void* dest, std::size_t size, std::size_t align ) = 0;
 
 	virtual std::shared_ptr< this_type > copy_to_shared( ) const = 0;
 
 	virtual std::unique_ptr< this_type > copy_to_unique( ) const = 0;
 
-	virtual this_type* copy_to( void* ) const = 0;
+#ifndef Q_NO_FUNCTION_POOL
+	// The virtual destructor ensures the size of the most derived type is
+	// passed to operator delete
+	static void* operator new( std::size_t size )
+	{
+		return function_pool_allocate( size );
+	}
 
-	virtual std::size_t size( ) const = 0;
+	static void operator delete( void* ptr, std::size_t size ) noexcept
+	{
+		function_pool_deallocate( ptr, size );
+	}
+#endif // Q_NO_FUNCTION_POOL
 
 protected:
 	function_base( ) { }
@@ -176,15 +344,9 @@ struct specific_function
 		return fn_( std::forward< Args >( args )... );
 	}
 
-	base* move_to( void* dest ) override
-	{
-		return ::new ( dest ) this_type( std::move( *this ) );
-	}
-
-	std::shared_ptr< base > move_to_shared( ) override
-	{
-		return std::make_shared< this_type >( std::move( *this ) );
-	}
+	const function_ops< Signature, Ret, Args... >*
+	move_inline_to( void* dest, std::size_t size, std::size_t align )
+	override;
 
 	std::shared_ptr< base > copy_to_shared( ) const override
 	{
@@ -196,33 +358,7 @@ struct specific_function
 		return _copy_to_unique( );
 	}
 
-	base* copy_to( void* dest ) const override
-	{
-		return _copy_to( dest );
-	}
-
-	std::size_t size( ) const override
-	{
-		return sizeof( *this );
-	}
-
 private:
-	template< bool C = Copyable >
-	typename std::enable_if< C, base* >::type
-	_copy_to( void* dest ) const
-	{
-		return ::new ( dest ) this_type( *this );
-	}
-
-	template< bool C = Copyable >
-	typename std::enable_if< !C, base* >::type
-	_copy_to( void* ) const
-	{
-		// This is just to make the compiler happy. We'll never try to
-		// copy Fn from unique_function's, so this is not an issue.
-		throw std::logic_error( "q::function internal error" );
-	}
-
 	template< bool C = Copyable >
 	typename std::enable_if< C, std::unique_ptr< base > >::type
 	_copy_to_unique( ) const
@@ -241,7 +377,7 @@ private:
 	typename std::enable_if< C, std::shared_ptr< base > >::type
 	_copy_to_shared( ) const
 	{
-		return std::make_shared< this_type >( fn_ );
+		return make_shared_function< this_type >( fn_ );
 	}
 
 	template< bool C = Copyable >
@@ -259,6 +395,120 @@ using specific_function_t = specific_function<
 	Fn, Signature, std::is_copy_constructible< Fn >::value, Ret, Args...
 >;
 
+/**
+ * The operations of a function object stored inline in a q::function, as a
+ * static table of plain function pointers (one table per function object
+ * type) rather than a v-table within the stored object. This leaves the
+ * entire inline storage for the function object itself.
+ *
+ * A null @c relocate means that the function object can be moved by
+ * copying its bytes (i.e. it is trivially copyable), and a null @c destroy
+ * means that it is trivially destructible.
+ */
+template< typename Signature, typename Ret, typename... Args >
+struct function_ops
+{
+	typedef function_base< Signature, Ret, Args... > base;
+
+	Ret ( *invoke )( void*, Args... );
+	void ( *relocate )( void* dest, void* src );
+	void ( *copy )( void* dest, const void* src );
+	void ( *destroy )( void* );
+	std::shared_ptr< base > ( *move_to_shared )( void* );
+	bool copyable;
+	bool is_mutable;
+};
+
+template< typename Fn, typename Signature, typename Ret, typename... Args >
+struct inline_function
+{
+	typedef function_ops< Signature, Ret, Args... > ops_type;
+	typedef specific_function_t< Fn, Signature, Ret, Args... > heap_type;
+	typedef std::is_copy_constructible< Fn > is_copyable;
+
+	static Ret invoke( void* fn, Args... args )
+	{
+		return ( *static_cast< Fn* >( fn ) )(
+			std::forward< Args >( args )... );
+	}
+
+	static void relocate( void* dest, void* src )
+	{
+		Fn* fn = static_cast< Fn* >( src );
+		::new ( dest ) Fn( std::move( *fn ) );
+		fn->~Fn( );
+	}
+
+	static void copy( void* dest, const void* src )
+	{
+		_copy( dest, src, is_copyable( ) );
+	}
+
+	static void destroy( void* fn )
+	{
+		static_cast< Fn* >( fn )->~Fn( );
+	}
+
+	static std::shared_ptr< typename ops_type::base >
+	move_to_shared( void* fn )
+	{
+		Fn* _fn = static_cast< Fn* >( fn );
+		auto ret = make_shared_function< heap_type >(
+			std::move( *_fn ) );
+		_fn->~Fn( );
+		return ret;
+	}
+
+	static const ops_type ops;
+
+private:
+	static void _copy( void* dest, const void* src, std::true_type )
+	{
+		::new ( dest ) Fn( *static_cast< const Fn* >( src ) );
+	}
+
+	static void _copy( void*, const void*, std::false_type )
+	{
+		// This is just to make the compiler happy. We'll never try to
+		// copy Fn from unique_function's, so this is not an issue.
+		throw std::logic_error( "q::function internal error" );
+	}
+};
+
+template< typename Fn, typename Signature, typename Ret, typename... Args >
+const typename inline_function< Fn, Signature, Ret, Args... >::ops_type
+inline_function< Fn, Signature, Ret, Args... >::ops = {
+	&inline_function::invoke,
+	std::is_trivially_copyable< Fn >::value
+		? nullptr
+		: &inline_function::relocate,
+	&inline_function::copy,
+	std::is_trivially_destructible< Fn >::value
+		? nullptr
+		: &inline_function::destroy,
+	&inline_function::move_to_shared,
+	is_copyable::value,
+	is_mutable_of_t< Fn >::value
+};
+
+template<
+	typename Fn,
+	typename Signature,
+	bool Copyable,
+	typename Ret,
+	typename... Args
+>
+const function_ops< Signature, Ret, Args... >*
+specific_function< Fn, Signature, Copyable, Ret, Args... >::
+move_inline_to( void* dest, std::size_t size, std::size_t align )
+{
+	if ( sizeof( Fn ) > size or alignof( Fn ) > align )
+		return nullptr;
+
+	::new ( dest ) Fn( std::move( fn_ ) );
+	return &inline_function< Fn, Signature, Ret, Args... >::ops;
+}
+
 enum class function_storage
 {
 	uninitialized = 0, // No function assigned
@@ -297,8 +547,9 @@ struct suitable_storage_method
 	typedef std::is_copy_constructible< Fn > is_copyable;
 
 	typedef bool_type<
-		sizeof( specific_function_t< Fn, Signature, Ret, Args... > )
-			<= DataSize
+		sizeof( Fn ) <= DataSize
+		and
+		alignof( Fn ) <= LIBQ__FUNCTION_DATA_ALIGN
 		and
 		// We shouldn't inline non-copyable lambdas into shared
 		// functions
@@ -326,19 +577,37 @@ struct function_size_recorder
 	void add( std::size_t sz, bool shared, function_storage type )
 	{
 		std::unique_lock< std::mutex > l( mut_ );
-		++recorded_sizes_[ sz ];
-		++shared_[ shared ];
-		++types_[ static_cast< std::uint16_t >( type ) ];
+		auto histogram = histogram_of( type );
+		if ( histogram )
+			++( *histogram )[ sz ];
+		++( shared
+			? stats_.shared_functions
+			: stats_.unique_functions );
 	}
 
-	std::unordered_map< std::size_t, std::size_t > recorded_sizes_;
-	std::unordered_map< bool, std::size_t > shared_;
-	std::unordered_map< std::int16_t, std::size_t > types_;
+	function_stats get( )
+	{
+		std::unique_lock< std::mutex > l( mut_ );
+		return stats_;
+	}
+
+	void reset( )
+	{
+		std::unique_lock< std::mutex > l( mut_ );
+		stats_ = function_stats( );
+	}
 
 	~function_size_recorder( )
 	{
-		std::map< std::size_t, std::size_t > ordered_sizes(
-			recorded_sizes_.begin( ), recorded_sizes_.end( ) );
+		std::map< std::size_t, std::size_t > ordered_sizes;
+		for ( auto histogram : {
+			&stats_.plain,
+			&stats_.inlined,
+			&stats_.unique_ptr,
+			&stats_.shared_ptr
+		} )
+			for ( auto& bucket : *histogram )
+				ordered_sizes[ bucket.first ] += bucket.second;
 
 		std::cout << "Function sizes:" << std::endl;
 
@@ -380,21 +649,34 @@ struct function_size_recorder
 		summarize( );
 
 		std::cout << "Methods: "
-			<< types_[ 1 ] << " plain "
-			<< types_[ 2 ] << " inlined "
-			<< types_[ 3 ] << " unique "
-			<< types_[ 4 ] << " shared."
+			<< function_stats::count( stats_.plain ) << " plain "
+			<< function_stats::count( stats_.inlined ) << " inlined "
+			<< function_stats::count( stats_.unique_ptr ) << " unique "
+			<< function_stats::count( stats_.shared_ptr ) << " shared."
 			<< std::endl;
 
 		std::cout << "Total: "
-			<< shared_[ false ] << " unique and "
-			<< shared_[ true ] << " shared."
+			<< stats_.unique_functions << " unique and "
+			<< stats_.shared_functions << " shared."
 			<< std::endl;
 	}
 
 	static function_size_recorder< T > instance;
 
 private:
+	function_stats::histogram_type* histogram_of( function_storage type )
+	{
+		switch ( type )
+		{
+			case function_storage::plain: return &stats_.plain;
+			case function_storage::inlined: return &stats_.inlined;
+			case function_storage::unique_ptr: return &stats_.unique_ptr;
+			case function_storage::shared_ptr: return &stats_.shared_ptr;
+			default: return nullptr;
+		}
+	}
+
+	function_stats stats_;
 	std::mutex mut_;
 };
 template< typename T >
@@ -514,16 +796,15 @@ public:
 
 #ifdef Q_RECORD_FUNCTION_STATS
 		function_size_recorder< >::instance.add(
-			sizeof( specific_base ), Shared::value, method::value );
+			sizeof( typename std::decay< Fn >::type ),
+			Shared::value,
+			method::value );
 #endif // Q_RECORD_FUNCTION_STATS
 
 		_set_plain< method::value >( std::forward< Fn >( fn ) );
+		_set_inline< method::value >( std::forward< Fn >( fn ) );
 
-		if ( method::value == function_storage::inlined )
-			ptr_ = ::new ( &base_ ) specific_base(
-				std::forward< Fn >( fn ) );
-
-		else if ( method::value == function_storage::unique_ptr )
+		if ( method::value == function_storage::unique_ptr )
 		{
 
 			::new ( &base_ ) unique_heap_type(
@@ -536,7 +817,7 @@ public:
 		else if ( method::value == function_storage::shared_ptr )
 		{
 			::new ( &base_ ) shared_heap_type(
-				std::make_shared< specific_base >(
+				make_shared_function< specific_base >(
 					std::forward< Fn >( fn ) ) );
 			ptr_ = reinterpret_cast< shared_heap_type* >( &base_ )
 					->get( );
@@ -578,15 +859,15 @@ public:
 
 #ifdef Q_RECORD_FUNCTION_STATS
 		function_size_recorder< >::instance.add(
-			sizeof( specific_base ), Shared::value, method::value );
+			sizeof( typename std::decay< Fn >::type ),
+			Shared::value,
+			method::value );
 #endif // Q_RECORD_FUNCTION_STATS
 
 		_set_plain< method::value >( std::forward< Fn >( fn ) );
+		_set_inline< method::value >( std::move( fn ) );
 
-		if ( method::value == function_storage::inlined )
-			ptr_ = ::new ( &base_ ) specific_base( std::move( fn ) );
-
-		else if ( method::value == function_storage::unique_ptr )
+		if ( method::value == function_storage::unique_ptr )
 		{
 			::new ( &base_ ) unique_heap_type(
 				q::make_unique< specific_base >(
@@ -598,7 +879,7 @@ public:
 		else if ( method::value == function_storage::shared_ptr )
 		{
 			::new ( &base_ ) shared_heap_type(
-				std::make_shared< specific_base >(
+				make_shared_function< specific_base >(
 					std::move( fn ) ) );
 			ptr_ = reinterpret_cast< shared_heap_type* >( &base_ )
 					->get( );
@@ -695,10 +976,8 @@ public:
 			return ret;
 		}
 
-		base* _base = _get_base( );
-
-		const bool is_copyable = _base->is_copyable( );
-		const bool is_mutable = _base->is_mutable( );
+		const bool is_copyable = _is_copyable( );
+		const bool is_mutable = _is_mutable( );
 
 		const bool keep_inlined = // 2a
 			method_ == function_storage::inlined && is_copyable;
@@ -718,14 +997,14 @@ public:
 		{
 			// We can place it inline, and later allow copying it
 			// if necessary.
-			ret.ptr_ = _base->copy_to( &ret.base_ );
+			ops_->copy( &ret.base_, &base_ );
+			ret.ops_ = ops_;
 			ret.method_ = function_storage::inlined;
 		}
 		else if ( inline_to_shared_ptr ) // 2b
 		{
-			shared_heap_type rebound( _base->move_to_shared( ) );
+			shared_heap_type rebound( ops_->move_to_shared( &base_ ) );
 			method_ = function_storage::uninitialized;
-			_base->~base( );
 
 			::new ( &base_ ) shared_heap_type( rebound );
 			ptr_ = rebound.get( );
@@ -738,7 +1017,7 @@ public:
 		else if ( keep_unique_ptr ) // 3a
 		{
 			::new ( &ret.base_ ) unique_heap_type(
-				_base->copy_to_unique( ) );
+				_get_base( )->copy_to_unique( ) );
 			ret.ptr_ = reinterpret_cast< unique_heap_type* >(
 				&ret.base_
 			)->get( );
@@ -751,7 +1030,10 @@ public:
 			auto this_unique_ptr =
 				reinterpret_cast< unique_heap_type* >( &base_ );
 
-			shared_heap_type rebound( this_unique_ptr->release( ) );
+			shared_heap_type rebound(
+				this_unique_ptr->release( ),
+				std::default_delete< base >( ),
+				detail::function_allocator< base >( ) );
 			method_ = function_storage::uninitialized;
 			this_unique_ptr->~unique_ptr( );
 
@@ -811,6 +1093,11 @@ public:
 		{
 			return ( *sig_ )( std::forward< Args >( args )... );
 		}
+		else if ( method_ == function_storage::inlined )
+		{
+			return ops_->invoke(
+				&base_, std::forward< Args >( args )... );
+		}
 
 		base* _base = _get_base( );
 
@@ -851,16 +1138,71 @@ private:
 	_set_plain( Fn&& )
 	{ }
 
+	template< function_storage method, typename Fn >
+	typename std::enable_if<
+		method == function_storage::inlined
+	>::type
+	_set_inline( Fn&& fn )
+	{
+		typedef typename std::decay< Fn >::type decayed_type;
+
+		::new ( &base_ ) decayed_type( std::forward< Fn >( fn ) );
+		ops_ = &detail::inline_function<
+			decayed_type, Signature, Ret, Args...
+		>::ops;
+	}
+
+	template< function_storage method, typename Fn >
+	typename std::enable_if<
+		method != function_storage::inlined
+	>::type
+	_set_inline( Fn&& )
+	{ }
+
+	/**
+	 * Moves an inlined function object from @a other into this, and marks
+	 * @a other as uninitialized, as the function object in it is gone.
+	 * Trivially copyable function objects (such as lambdas capturing
+	 * pointers and integers) are simply memcpy'd.
+	 */
+	template< typename Other >
+	void _relocate_from( Other& other )
+	{
+		ops_ = other.ops_;
+		if ( ops_->relocate )
+			ops_->relocate( &base_, &other.base_ );
+		else
+			std::memcpy( &base_, &other.base_, sizeof base_ );
+		other.method_ = function_storage::uninitialized;
+	}
+
 	// Beware, the constness is lost
 	base* _get_base( ) const
 	{
 		return reinterpret_cast< base* >( ptr_ );
 	}
 
+	bool _is_copyable( ) const
+	{
+		return method_ == function_storage::inlined
+			? ops_->copyable
+			: _get_base( )->is_copyable( );
+	}
+
+	bool _is_mutable( ) const
+	{
+		return method_ == function_storage::inlined
+			? ops_->is_mutable
+			: _get_base( )->is_mutable( );
+	}
+
 	void _reset( )
 	{
 		if ( method_ == function_storage::inlined )
-			_get_base( )->~base( );
+		{
+			if ( ops_->destroy )
+				ops_->destroy( &base_ );
+		}
 		else if ( method_ == function_storage::unique_ptr )
 			reinterpret_cast< unique_heap_type* >( &base_ )
 				->~unique_ptr( );
@@ -889,9 +1231,7 @@ private:
 		}
 		else if ( om == function_storage::inlined )
 		{
-			auto ref_base = ref._get_base( );
-
-			ptr_ = ref_base->move_to( &base_ );
+			_relocate_from( ref );
 		}
 		else if ( om == function_storage::unique_ptr )
 		{
@@ -957,10 +1297,8 @@ private:
 			return *this;
 		}
 
-		const base* _base = ref._get_base( );
-
-		const bool is_copyable = _base->is_copyable( );
-		const bool is_mutable = _base->is_mutable( );
+		const bool is_copyable = ref._is_copyable( );
+		const bool is_mutable = ref._is_mutable( );
 
 		const bool keep_unique_ptr =
 			om == function_storage::unique_ptr &&
@@ -972,7 +1310,8 @@ private:
 
 		if ( om == function_storage::inlined ) // 2
 		{
-			ptr_ = _base->copy_to( &base_ );
+			ref.ops_->copy( &base_, &ref.base_ );
+			ops_ = ref.ops_;
 		}
 		else if ( convert_unique_ptr_to_shared_ptr ) // 3a
 		{
@@ -980,7 +1319,7 @@ private:
 			// copy this unique_ptr to shared_ptr and then rely on
 			// copying (ref-increment) that.
 			::new ( &base_ ) shared_heap_type(
-				_base->copy_to_shared( ) );
+				ref._get_base( )->copy_to_shared( ) );
 			ptr_ = reinterpret_cast< shared_heap_type* >( &base_ )
 					->get( );
 			method_ = function_storage::shared_ptr;
@@ -989,7 +1328,7 @@ private:
 		else if ( keep_unique_ptr ) // 3b
 		{
 			::new ( &base_ ) unique_heap_type(
-				_base->copy_to_unique( ) );
+				ref._get_base( )->copy_to_unique( ) );
 			ptr_ = reinterpret_cast< unique_heap_type* >( &base_ )
 					->get( );
 		}
@@ -1039,15 +1378,12 @@ private:
 			return *this;
 		}
 
-		auto other_base = other._get_base( );
-
 		if ( om == function_storage::inlined ) // 2
 		{
 			// We can place it inline, and later allow copying it
 			// if necessary.
-			ptr_ = other_base->move_to( &base_ );
+			_relocate_from( other );
 			method_ = function_storage::inlined;
-			other._reset( );
 			return *this;
 		}
 		else if ( om == function_storage::unique_ptr ) // 3
@@ -1077,14 +1413,16 @@ private:
 		auto other_shared_ptr =
 			reinterpret_cast< shared_heap_type* >( &other.base_ );
 
-		const bool should_inline =
-			other_base->size( ) <= DataSize::value
-			and
-			other_shared_ptr->unique( );
+		const auto inlined = other_shared_ptr->unique( )
+			? other._get_base( )->move_inline_to(
+				&base_,
+				DataSize::value,
+				LIBQ__FUNCTION_DATA_ALIGN )
+			: nullptr;
 
-		if ( should_inline )
+		if ( inlined )
 		{
-			ptr_ = other_base->move_to( &base_ );
+			ops_ = inlined;
 			method_ = function_storage::inlined;
 		}
 		else
@@ -1126,9 +1464,8 @@ private:
 		}
 		else if ( om == function_storage::inlined ) // 2
 		{
-			const auto other_base = other._get_base( );
-
-			ptr_ = other_base->copy_to( &base_ );
+			other.ops_->copy( &base_, &other.base_ );
+			ops_ = other.ops_;
 			method_ = function_storage::inlined;
 		}
 		else if ( om == function_storage::unique_ptr ) // 3
@@ -1160,22 +1497,106 @@ private:
 
 	typedef typename std::aligned_storage<
 		DataSize::value,
-#ifdef Q_NO_FUNCTION_ALIGN
-		sizeof( std::ptrdiff_t )
-#else
-		LIBQ__FUNCTION_INLINE_STATE_SIZE * 2
-#endif
+		LIBQ__FUNCTION_DATA_ALIGN
 	>::type data_type;
 
+	typedef detail::function_ops< Signature, Ret, Args... > ops_type;
+
 	data_type base_;
 	function_storage method_;
 	union
 	{
 		base* ptr_;
 		Signature* sig_;
+		const ops_type* ops_;
 	};
 };
 
+template< typename Signature, typename Ret, typename... Args >
+class function_ref
+{
+	typedef void ( *plain_function_type )( );
+
+public:
+	template<
+		typename Fn,
+		typename DecayedFn = typename std::decay< Fn >::type
+	>
+	using matching_function = bool_type<
+		is_function_t< DecayedFn >::value
+		and
+		!std::is_same< DecayedFn, function_ref >::value
+		and
+		arguments_of_t< Signature >
+		::template is_convertible_to<
+			arguments_of_t< DecayedFn >
+		>::value
+		and
+		result_of_as_argument_t< DecayedFn >
+		::template is_convertible_to<
+			result_of_as_argument_t< Signature >
+		>::value
+	>;
+
+	template< typename Fn >
+	function_ref(
+		Fn&& fn,
+		typename std::enable_if<
+			matching_function< Fn >::value
+			and
+			// Functions and function pointers are referred to
+			// directly
+			!std::is_function< typename std::remove_pointer<
+				typename std::decay< Fn >::type
+			>::type >::value
+		>::type* = 0
+	) noexcept
+	: invoke_( &invoke_object<
+		typename std::remove_reference< Fn >::type
+	> )
+	{
+		object_ = const_cast< void* >(
+			static_cast< const void* >( std::addressof( fn ) ) );
+	}
+
+	template< typename FnRet, typename... FnArgs >
+	function_ref( FnRet ( *fn )( FnArgs... ) ) noexcept
+	: invoke_( &invoke_plain< FnRet ( * )( FnArgs... ) > )
+	{
+		plain_ = reinterpret_cast< plain_function_type >( fn );
+	}
+
+	function_ref( const function_ref& ) = default;
+	function_ref& operator=( const function_ref& ) = default;
+
+	Ret operator( )( Args... args ) const
+	{
+		return invoke_( *this, std::forward< Args >( args )... );
+	}
+
+private:
+	template< typename Fn >
+	static Ret invoke_object( const function_ref& ref, Args... args )
+	{
+		return ( *static_cast< Fn* >( ref.object_ ) )(
+			std::forward< Args >( args )... );
+	}
+
+	template< typename Fn >
+	static Ret invoke_plain( const function_ref& ref, Args... args )
+	{
+		return reinterpret_cast< Fn >( ref.plain_ )(
+			std::forward< Args >( args )... );
+	}
+
+	union
+	{
+		void* object_;
+		plain_function_type plain_;
+	};
+	Ret ( *invoke_ )( const function_ref&, Args... );
+};
+
 template< typename Signature, bool Shared, std::size_t TotalSize >
 using any_function_t = typename ::q::arguments_of_t< Signature >
 	::template prepend<
@@ -1186,6 +1607,14 @@ using any_function_t = typename ::q::arguments_of_t< Signature >
 	>
 	::template apply< any_function >;
 
+template< typename Signature >
+using function_ref_t = typename ::q::arguments_of_t< Signature >
+	::template prepend<
+		Signature,
+		::q::result_of_t< Signature >
+	>
+	::template apply< function_ref >;
+
 } // namespace detail
 
 template< typename Signature >
@@ -1202,15 +1631,71 @@ using function = detail::any_function_t<
 	LIBQ__FUNCTION_INLINE_SIZE
 >;
 
+/**
+ * A non-owning reference to a function object (or function pointer), for
+ * callbacks which are only invoked synchronously and never stored. It is two
+ * pointers large, never allocates, and is cheap to pass by value.
+ *
+ * The function object must outlive the function_ref, so it should generally
+ * only be used as a function parameter type.
+ */
+template< typename Signature >
+using function_ref = detail::function_ref_t< Signature >;
+
+/**
+ * A function with room for (at least) @a Words words of function object
+ * inline, for use sites where the common function object sizes are known
+ * (e.g. from q::get_function_stats( )). Larger function objects are
+ * allocated on the heap, just like with q::function and q::unique_function.
+ */
 template< typename Signature, bool Shared, std::size_t Words >
 using custom_function = detail::any_function_t<
 	Signature,
 	Shared,
-	// Add three words (two for the any_function, one for the v-table),
-	// then round up to nearest 8-word (assumed cache line size).
-	sizeof( std::ptrdiff_t ) * ( ( Words + 3 + 7 ) / 8 ) * 8
+	// Add two words for the any_function (the ops table pointer shares
+	// one of them), then round up to nearest 8-word (assumed cache line
+	// size).
+	sizeof( std::ptrdiff_t ) * ( ( Words + 2 + 7 ) / 8 ) * 8
 >;
 
+template< typename Signature, std::size_t Words >
+using custom_unique_function = custom_function< Signature, false, Words >;
+
+template< typename Signature, std::size_t Words >
+using custom_shared_function = custom_function< Signature, true, Words >;
+
+/**
+ * The number of bytes available for a function object to be stored inline
+ * in the function type @a Function (e.g. a q::custom_function).
+ */
+template< typename Function >
+using function_inline_size_t = typename Function::DataSize;
+
+/**
+ * Returns a snapshot of the function statistics recorded so far. Unless
+ * Q_RECORD_FUNCTION_STATS is defined, nothing is recorded, and the returned
+ * statistics are empty.
+ */
+inline function_stats get_function_stats( )
+{
+#ifdef Q_RECORD_FUNCTION_STATS
+	return detail::function_size_recorder< >::instance.get( );
+#else
+	return function_stats( );
+#endif
+}
+
+/**
+ * Clears the function statistics recorded so far, e.g. to only measure a
+ * certain part of a program.
+ */
+inline void reset_function_stats( )
+{
+#ifdef Q_RECORD_FUNCTION_STATS
+	detail::function_size_recorder< >::instance.reset( );
+#endif
+}
+
 } // namespace q
 
 #ifdef LIBQ_ON_WINDOWS
@@ -106,9 +106,21 @@ struct fn_match
 : public invalid_t
 { };
 
-template< typename R, typename... A >
-struct fn_match< R( & )( A... ) >
-: public fn_match< R( A... ) >
+// References to (and const) functions and function pointers, e.g. function
+// pointers stored as members and called as lvalues
+template< typename Fn >
+struct fn_match< Fn& >
+: public fn_match< Fn >
+{ };
+
+template< typename Fn >
+struct fn_match< Fn&& >
+: public fn_match< Fn >
+{ };
+
+template< typename Fn >
+struct fn_match< const Fn >
+: public fn_match< Fn >
 { };
 
 template< typename R, typename... A >
@@ -834,6 +846,69 @@ noexcept( noexcept( fn( void_t( ) ) ) )
 	return fn( void_t( ) );
 }
 
+namespace detail {
+
+template< typename Fn, typename... Args >
+auto is_nothrow_invocable( int )
+-> bool_type_t<
+	noexcept( std::declval< Fn >( )( std::declval< Args >( )... ) )
+>;
+
+template< typename Fn, typename... Args >
+std::false_type is_nothrow_invocable( ... );
+
+template< typename Fn, typename... Args >
+struct is_nothrow_call_with_args
+: decltype( is_nothrow_invocable< Fn, Args... >( 0 ) )
+{ };
+
+template< typename Fn >
+struct is_nothrow_call_with_args< Fn >
+: bool_type_t<
+	decltype( is_nothrow_invocable< Fn >( 0 ) )::value
+	or
+	decltype( is_nothrow_invocable< Fn, void_t >( 0 ) )::value
+>
+{ };
+
+template< typename Fn, typename Tuple >
+struct is_nothrow_call_with_args_by_tuple;
+
+template< typename Fn, typename... T >
+struct is_nothrow_call_with_args_by_tuple< Fn, std::tuple< T... > >
+: is_nothrow_call_with_args< Fn, T&&... >
+{ };
+
+template< typename Fn, typename... T >
+struct is_nothrow_call_with_args_by_tuple< Fn, const std::tuple< T... > >
+: is_nothrow_call_with_args< Fn, const T&&... >
+{ };
+
+} // namespace detail
+
+/**
+ * std::true_type if calling @a Fn with @a Args... using @c call_with_args() is
+ * statically known not to throw (i.e. the function is noexcept and so are all
+ * argument conversions), otherwise std::false_type.
+ *
+ * This allows callers to drop exception handling altogether for noexcept
+ * functions. Member function pointers are always considered throwing.
+ */
+template< typename Fn, typename... Args >
+using is_nothrow_call_with_args_t = bool_type_t<
+	detail::is_nothrow_call_with_args< Fn, Args... >::value
+>;
+
+/**
+ * Same as is_nothrow_call_with_args_t, but for @c call_with_args_by_tuple().
+ */
+template< typename Fn, typename Tuple >
+using is_nothrow_call_with_args_by_tuple_t = bool_type_t<
+	detail::is_nothrow_call_with_args_by_tuple<
+		Fn, typename std::remove_reference< Tuple >::type
+	>::value
+>;
+
 template< typename Fn, typename InnerFn, typename... Args >
 typename std::enable_if<
 	Q_IS_FUNCTION( Fn )::value
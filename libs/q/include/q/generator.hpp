@@ -0,0 +1,399 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_GENERATOR_HPP
+#define LIBQ_GENERATOR_HPP
+
+#include <q/channel.hpp>
+
+#include <deque>
+
+namespace q {
+
+namespace detail {
+
+template< typename... T >
+class shared_generator
+: public std::enable_shared_from_this< shared_generator< T... > >
+{
+public:
+	typedef q::function< promise< T... >( ) > step_type;
+	typedef detail::defer< T... > defer_type;
+
+	shared_generator( const queue_ptr& queue, step_type step )
+	: queue_( queue )
+	, step_( std::move( step ) )
+	, mutex_( Q_HERE, "generator" )
+	, running_( false )
+	, closed_( false )
+	{ }
+
+	const queue_ptr& get_queue( ) const
+	{
+		return queue_;
+	}
+
+	bool is_closed( ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return closed_;
+	}
+
+	promise< T... > next( )
+	{
+		auto deferred = ::q::make_shared< defer_type >( queue_ );
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( closed_ )
+			{
+				deferred->set_exception( get_exception( ) );
+				return deferred->get_promise( );
+			}
+
+			if ( running_ )
+			{
+				waiting_.push_back( deferred );
+				return deferred->get_promise( );
+			}
+
+			running_ = true;
+		}
+
+		run( deferred );
+
+		return deferred->get_promise( );
+	}
+
+	void close( std::exception_ptr e = std::exception_ptr( ) )
+	{
+		std::deque< std::shared_ptr< defer_type > > waiting;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( closed_ )
+				return;
+
+			closed_ = true;
+			exception_ = e;
+			step_ = step_type( );
+
+			waiting_.swap( waiting );
+		}
+
+		for ( auto& deferred : waiting )
+			deferred->set_exception( get_exception( ) );
+	}
+
+private:
+	/**
+	 * The exception to reject reads with after the generator is closed.
+	 *
+	 * NOTE: The mutex must be held, or the generator closed.
+	 */
+	std::exception_ptr get_exception( ) const
+	{
+		if ( exception_ )
+			return exception_;
+
+		return std::make_exception_ptr( channel_closed_exception( ) );
+	}
+
+	void run( std::shared_ptr< defer_type > deferred )
+	{
+		auto self = this->shared_from_this( );
+
+		step_type step;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			step = step_;
+		}
+
+		if ( !step )
+		{
+			deferred->set_exception( get_exception( ) );
+			step_done( );
+			return;
+		}
+
+		step( )
+		.then( [ self, deferred ]( T&&... t )
+		{
+			deferred->set_value( std::forward< T >( t )... );
+			self->step_done( );
+		} )
+		.fail( [ self, deferred ]( const channel_closed_exception& )
+		{
+			self->close( );
+			deferred->set_exception( self->get_exception( ) );
+			self->step_done( );
+		} )
+		.fail( [ self, deferred ]( std::exception_ptr e )
+		{
+			self->close( e );
+			deferred->set_exception( std::move( e ) );
+			self->step_done( );
+		} );
+	}
+
+	void step_done( )
+	{
+		std::shared_ptr< defer_type > deferred;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( waiting_.empty( ) )
+			{
+				running_ = false;
+				return;
+			}
+
+			deferred = std::move( waiting_.front( ) );
+			waiting_.pop_front( );
+		}
+
+		run( std::move( deferred ) );
+	}
+
+	const queue_ptr queue_;
+	step_type step_;
+	mutable mutex mutex_;
+	bool running_;
+	bool closed_;
+	std::exception_ptr exception_;
+	// Calls to next( ) waiting for the running step to complete
+	std::deque< std::shared_ptr< defer_type > > waiting_;
+};
+
+} // namespace detail
+
+/**
+ * A generator produces values lazily, one step at a time, when they are
+ * asked for. Unlike a channel filled by a producer task, nothing is buffered
+ * and nothing runs while nobody calls next( ).
+ *
+ * The step function is called (as a task on the queue) once for each call to
+ * next( ), and returns the next value (or a promise of it). Steps never run
+ * in parallel, so the step function can keep its state without locking. It
+ * ends the generator by throwing (or rejecting with) a
+ * channel_closed_exception, just like reading a closed channel:
+ *
+ *   int i = 0;
+ *   q::generator< int > numbers( queue, [ i ]( ) mutable
+ *   {
+ *       if ( i == 10 )
+ *           Q_THROW( q::channel_closed_exception( ) );
+ *       return i++;
+ *   } );
+ *
+ *   numbers.next( ).then( ... );
+ *
+ * Any other exception also ends the generator, and subsequent calls to
+ * next( ) are rejected with it.
+ *
+ * A generator is a handle, and copies refer to the same generator.
+ */
+template< typename... T >
+class generator
+{
+	typedef detail::shared_generator< T... > shared_type;
+
+public:
+	template< typename Fn >
+	generator( const queue_ptr& queue, Fn&& fn )
+	: shared_generator_( std::make_shared< shared_type >(
+		queue, make_step( queue, std::forward< Fn >( fn ) ) ) )
+	{ }
+
+	/**
+	 * Produces the next value. If a step is already running, this waits
+	 * for it, and the values are delivered in the order next( ) was
+	 * called.
+	 *
+	 * @return promise of the next value, rejected with a
+	 *         channel_closed_exception when the generator has ended
+	 */
+	Q_NODISCARD
+	promise< T... > next( )
+	{
+		return shared_generator_->next( );
+	}
+
+	/**
+	 * Ends the generator. A running step will still deliver its value,
+	 * but calls to next( ) waiting for it are rejected.
+	 */
+	void close( )
+	{
+		shared_generator_->close( );
+	}
+
+	template< typename E >
+	typename std::enable_if<
+		!is_same_type< E, std::exception_ptr >::value
+	>::type
+	close( E&& e )
+	{
+		shared_generator_->close(
+			std::make_exception_ptr( std::forward< E >( e ) ) );
+	}
+
+	void close( std::exception_ptr e )
+	{
+		shared_generator_->close( std::move( e ) );
+	}
+
+	bool is_closed( ) const
+	{
+		return shared_generator_->is_closed( );
+	}
+
+	/**
+	 * Returns a readable of the values of this generator, for consumers
+	 * which need one. The values are produced ahead of the reads, up to
+	 * @a buffer_count values, and the generator is closed when the
+	 * readable is.
+	 */
+	readable< T... > get_readable( std::size_t buffer_count = 1 )
+	{
+		channel< T... > ch( get_queue( ), buffer_count );
+
+		pump( shared_generator_, ch.get_writable( ) );
+
+		return ch.get_readable( );
+	}
+
+	Q_NODISCARD
+	const queue_ptr& get_queue( ) const
+	{
+		return shared_generator_->get_queue( );
+	}
+
+private:
+	template< typename Fn >
+	static typename shared_type::step_type
+	make_step( const queue_ptr& queue, Fn&& fn )
+	{
+		typedef typename std::decay< Fn >::type fn_type;
+
+		// Shared by all steps, since it may keep state between them
+		auto step_fn = std::make_shared< fn_type >(
+			std::forward< Fn >( fn ) );
+
+		return [ queue, step_fn ]( ) -> promise< T... >
+		{
+			return q::with( queue )
+			.then( [ step_fn ]( )
+			{
+				return ( *step_fn )( );
+			} );
+		};
+	}
+
+	static void pump(
+		std::shared_ptr< shared_type > shared,
+		writable< T... > writable
+	)
+	{
+		if ( writable.is_closed( ) )
+		{
+			shared->close( );
+			return;
+		}
+
+		if ( !writable.should_write( ) )
+		{
+			// Called either by the resume notification or below,
+			// whichever comes first
+			auto once = std::make_shared< std::atomic< bool > >(
+				false );
+
+			auto resume = [ shared, writable, once ]( ) mutable
+			{
+				if ( once->exchange( true ) )
+					return;
+
+				writable.unset_resume_notification( );
+				pump( shared, writable );
+			};
+
+			writable.set_resume_notification( resume, false );
+
+			if ( writable.should_write( ) || writable.is_closed( ) )
+				resume( );
+
+			return;
+		}
+
+		close_with_readable( shared, writable );
+
+		shared->next( )
+		.then( [ shared, writable ]( T&&... t ) mutable
+		{
+			if ( writable.write( std::forward< T >( t )... ) )
+				pump( shared, writable );
+			else
+				shared->close( );
+		} )
+		.fail( [ writable ]( const channel_closed_exception& ) mutable
+		{
+			writable.close( );
+		} )
+		.fail( [ writable ]( std::exception_ptr e ) mutable
+		{
+			writable.close( std::move( e ) );
+		} );
+	}
+
+	/**
+	 * Closes the generator as soon as the readable is closed, so that no
+	 * more steps run, rather than when the next value can't be written to
+	 * it. The notification is replaced when the readable is full.
+	 */
+	static void close_with_readable(
+		std::shared_ptr< shared_type > shared,
+		writable< T... > writable
+	)
+	{
+		// Also called when the readable resumes, which is ignored
+		auto on_close = [ shared, writable ]( )
+		{
+			if ( !writable.is_closed( ) )
+				return;
+
+			auto _writable = writable;
+			_writable.unset_resume_notification( );
+			shared->close( );
+		};
+
+		writable.set_resume_notification( on_close, false );
+
+		if ( writable.is_closed( ) )
+			on_close( );
+	}
+
+	std::shared_ptr< shared_type > shared_generator_;
+};
+
+} // namespace q
+
+#endif // LIBQ_GENERATOR_HPP
@@ -0,0 +1,661 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_PIPELINE_HPP
+#define LIBQ_PIPELINE_HPP
+
+#include <q/channel.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+
+namespace q {
+
+/**
+ * How the items of a pipeline go through a stage.
+ *
+ *   serial_in_order:     One item at a time, in the order they were read
+ *                        from the input. Items which arrive early wait
+ *                        until all items before them have been processed.
+ *   serial_out_of_order: One item at a time, in the order they arrive.
+ *   parallel:            Up to @c concurrency items at a time (or as many
+ *                        as the token budget allows, if 0), in any order.
+ */
+class stage_mode
+{
+public:
+	enum type
+	{
+		serial_in_order,
+		serial_out_of_order,
+		parallel
+	};
+
+	stage_mode( type mode, std::size_t concurrency = 0 )
+	: mode_( mode )
+	, concurrency_( mode == parallel ? concurrency : 1 )
+	{ }
+
+	type get( ) const
+	{
+		return mode_;
+	}
+
+	/**
+	 * The maximum number of items in the stage at once, or 0 for no
+	 * limit.
+	 */
+	std::size_t concurrency( ) const
+	{
+		return concurrency_;
+	}
+
+private:
+	type mode_;
+	std::size_t concurrency_;
+};
+
+namespace detail {
+
+/**
+ * The part of a running pipeline which the stages need.
+ */
+class pipeline_control
+{
+public:
+	pipeline_control( const queue_ptr& queue )
+	: queue_( queue )
+	{ }
+
+	virtual ~pipeline_control( ) { }
+
+	const queue_ptr& get_queue( ) const
+	{
+		return queue_;
+	}
+
+	/**
+	 * Stops the pipeline with an error. Items still being processed are
+	 * dropped when they are done.
+	 */
+	virtual void fail( std::exception_ptr e ) = 0;
+
+private:
+	const queue_ptr queue_;
+};
+
+/**
+ * Something items can be pushed into, i.e. a stage or the output of a
+ * pipeline. Every item is tagged with its position in the input.
+ */
+template< typename T >
+class pipeline_input
+{
+public:
+	virtual ~pipeline_input( ) { }
+
+	virtual void push( std::uint64_t seq, T&& value ) = 0;
+};
+
+template< typename Promise >
+struct pipeline_value_of;
+
+template< typename T >
+struct pipeline_value_of< promise< T > >
+{
+	typedef T type;
+};
+
+/**
+ * The type of the items which a stage function @a Fn returns (directly or
+ * as a promise) for items of type @a In.
+ */
+template< typename In, typename Fn >
+struct pipeline_stage_result
+{
+	typedef typename pipeline_value_of<
+		decltype(
+			std::declval< promise< In > >( )
+			.then( std::declval< Fn >( ) )
+		)
+	>::type type;
+};
+
+template< typename In, typename Out, typename Fn >
+class pipeline_stage
+: public pipeline_input< In >
+, public std::enable_shared_from_this< pipeline_stage< In, Out, Fn > >
+{
+public:
+	pipeline_stage(
+		stage_mode mode,
+		Fn fn,
+		std::shared_ptr< pipeline_input< Out > > next,
+		std::shared_ptr< pipeline_control > control
+	)
+	: mode_( mode.get( ) )
+	, concurrency_( mode.concurrency( ) )
+	, fn_( std::move( fn ) )
+	, next_( std::move( next ) )
+	, control_( std::move( control ) )
+	, mutex_( Q_HERE, "pipeline stage" )
+	, running_( 0 )
+	, next_seq_( 0 )
+	{ }
+
+	void push( std::uint64_t seq, In&& value ) override
+	{
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( !can_start( seq ) )
+			{
+				if ( mode_ == stage_mode::serial_in_order )
+					early_.emplace(
+						seq, std::move( value ) );
+				else
+					pending_.emplace_back(
+						seq, std::move( value ) );
+				return;
+			}
+
+			started( seq );
+		}
+
+		start( seq, std::move( value ) );
+	}
+
+private:
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	bool can_start( std::uint64_t seq ) const
+	{
+		if ( concurrency_ && running_ >= concurrency_ )
+			return false;
+
+		return mode_ != stage_mode::serial_in_order ||
+			seq == next_seq_;
+	}
+
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	void started( std::uint64_t seq )
+	{
+		++running_;
+		next_seq_ = seq + 1;
+	}
+
+	void start( std::uint64_t seq, In&& value )
+	{
+		auto self = this->shared_from_this( );
+
+		q::with( control_->get_queue( ), std::move( value ) )
+		.then( Fn( fn_ ) )
+		.then( [ self, seq ]( Out&& out )
+		{
+			self->next_->push( seq, std::move( out ) );
+			self->done( );
+		} )
+		.fail( [ self ]( std::exception_ptr e )
+		{
+			self->control_->fail( std::move( e ) );
+			self->done( );
+		} );
+	}
+
+	void done( )
+	{
+		std::unique_ptr< item_type > item;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			--running_;
+
+			if ( mode_ == stage_mode::serial_in_order )
+			{
+				auto iter = early_.find( next_seq_ );
+				if ( iter == early_.end( ) )
+					return;
+
+				item.reset( new item_type(
+					iter->first,
+					std::move( iter->second ) ) );
+				early_.erase( iter );
+			}
+			else
+			{
+				if ( pending_.empty( ) )
+					return;
+
+				item.reset( new item_type(
+					std::move( pending_.front( ) ) ) );
+				pending_.pop_front( );
+			}
+
+			started( item->first );
+		}
+
+		start( item->first, std::move( item->second ) );
+	}
+
+	typedef std::pair< std::uint64_t, In > item_type;
+
+	const stage_mode::type mode_;
+	const std::size_t concurrency_;
+	Fn fn_;
+	std::shared_ptr< pipeline_input< Out > > next_;
+	std::shared_ptr< pipeline_control > control_;
+	mutex mutex_;
+	std::size_t running_;
+	// The next item to process in a serial_in_order stage
+	std::uint64_t next_seq_;
+	// Items waiting for their turn in a serial_in_order stage
+	std::map< std::uint64_t, In > early_;
+	// Items waiting for a free slot in the other stages
+	std::deque< item_type > pending_;
+};
+
+/**
+ * Reads the input of a pipeline, as long as there are tokens left, and
+ * writes the items coming out of the last stage to the output.
+ *
+ * The tokens of items written to a full output are held back until the
+ * output resumes, so that a slow reader of the output slows down the reading
+ * of the input, rather than letting the output grow without bounds.
+ */
+template< typename In, typename Out >
+class pipeline_runner
+: public pipeline_control
+, public pipeline_input< Out >
+, public std::enable_shared_from_this< pipeline_runner< In, Out > >
+{
+public:
+	pipeline_runner(
+		const queue_ptr& queue,
+		std::size_t tokens,
+		readable< In > input,
+		writable< Out > output
+	)
+	: pipeline_control( queue )
+	, input_( std::move( input ) )
+	, output_( std::move( output ) )
+	, deferred_( ::q::make_shared< defer< > >( queue ) )
+	, mutex_( Q_HERE, "pipeline" )
+	, tokens_( std::max< std::size_t >( tokens, 1 ) )
+	, held_tokens_( 0 )
+	, read_( 0 )
+	, written_( 0 )
+	, reading_( false )
+	, awaiting_output_( false )
+	, input_closed_( false )
+	, done_( false )
+	{ }
+
+	promise< > start( std::shared_ptr< pipeline_input< In > > first )
+	{
+		first_ = std::move( first );
+
+		read_next( );
+
+		return deferred_->get_promise( );
+	}
+
+	void push( std::uint64_t, Out&& value ) override
+	{
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( done_ )
+				return;
+		}
+
+		if ( !output_.write( std::move( value ) ) )
+		{
+			fail( std::make_exception_ptr(
+				channel_closed_exception( ) ) );
+			return;
+		}
+
+		const bool output_full = !output_.should_write( );
+		bool finished;
+		bool await = false;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			++written_;
+
+			if ( output_full )
+			{
+				++held_tokens_;
+				await = !awaiting_output_;
+				awaiting_output_ = true;
+			}
+			else
+			{
+				++tokens_;
+			}
+
+			finished = is_finished( );
+		}
+
+		if ( finished )
+			finish( );
+		else if ( await )
+			await_output( );
+		else
+			read_next( );
+	}
+
+	void fail( std::exception_ptr e ) override
+	{
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( done_ )
+				return;
+
+			done_ = true;
+		}
+
+		first_.reset( );
+		output_.close( e );
+		deferred_->set_exception( std::move( e ) );
+	}
+
+private:
+	void read_next( )
+	{
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( reading_ || !tokens_ || input_closed_ || done_ )
+				return;
+
+			reading_ = true;
+			--tokens_;
+		}
+
+		auto self = this->shared_from_this( );
+
+		input_.read( )
+		.then( [ self ]( In&& value )
+		{
+			std::shared_ptr< pipeline_input< In > > first;
+			std::uint64_t seq;
+
+			{
+				Q_AUTO_UNIQUE_LOCK( self->mutex_ );
+
+				self->reading_ = false;
+				seq = self->read_++;
+				first = self->first_;
+			}
+
+			if ( first )
+				first->push( seq, std::move( value ) );
+
+			self->read_next( );
+		} )
+		.fail( [ self ]( const channel_closed_exception& )
+		{
+			bool finished;
+
+			{
+				Q_AUTO_UNIQUE_LOCK( self->mutex_ );
+
+				self->reading_ = false;
+				self->input_closed_ = true;
+				++self->tokens_;
+				finished = self->is_finished( );
+			}
+
+			if ( finished )
+				self->finish( );
+		} )
+		.fail( [ self ]( std::exception_ptr e )
+		{
+			self->fail( std::move( e ) );
+		} );
+	}
+
+	/**
+	 * Returns the held back tokens when the output can be written to
+	 * again (or is closed, which the next write will notice).
+	 */
+	void await_output( )
+	{
+		auto self = this->shared_from_this( );
+
+		// Called either by the resume notification or below,
+		// whichever comes first
+		auto once = std::make_shared< std::atomic< bool > >( false );
+
+		// The notification may be called with the channel mutex held,
+		// so the channel is only used from a task
+		auto resume = [ self, once ]( )
+		{
+			if ( once->exchange( true ) )
+				return;
+
+			self->get_queue( )->push( [ self ]( )
+			{
+				self->output_.unset_resume_notification( );
+
+				{
+					Q_AUTO_UNIQUE_LOCK( self->mutex_ );
+
+					self->tokens_ += self->held_tokens_;
+					self->held_tokens_ = 0;
+					self->awaiting_output_ = false;
+				}
+
+				self->read_next( );
+			} );
+		};
+
+		output_.set_resume_notification( resume, false );
+
+		if ( output_.should_write( ) || output_.is_closed( ) )
+			resume( );
+	}
+
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	bool is_finished( )
+	{
+		if ( done_ || !input_closed_ || written_ != read_ )
+			return false;
+
+		done_ = true;
+
+		return true;
+	}
+
+	void finish( )
+	{
+		first_.reset( );
+		output_.close( );
+		deferred_->set_value( );
+	}
+
+	readable< In > input_;
+	writable< Out > output_;
+	std::shared_ptr< defer< > > deferred_;
+	// The first stage, which (through the other stages) refers to this
+	// runner, so it is released when the pipeline is done
+	std::shared_ptr< pipeline_input< In > > first_;
+	mutex mutex_;
+	std::size_t tokens_;
+	// Tokens of items written to the output while it was full
+	std::size_t held_tokens_;
+	std::uint64_t read_;
+	std::uint64_t written_;
+	bool reading_;
+	bool awaiting_output_;
+	bool input_closed_;
+	bool done_;
+};
+
+} // namespace detail
+
+/**
+ * A pipeline of stages, which items read from a readable go through, in the
+ * order the stages were added, before they are written to a writable. Unlike
+ * chaining channels with consume( ), there is no channel between the stages,
+ * and parallel stages don't lose the order of the items: a serial_in_order
+ * stage after them gets the items in input order again.
+ *
+ * The number of items in the pipeline at once is limited by a token budget,
+ * shared by all stages. An item takes a token when it is read from the input,
+ * and returns it when it is written to the output.
+ *
+ * The stage functions are called on the queue of the pipeline (typically
+ * that of a threadpool), and may return a value or a promise of a value:
+ *
+ *   auto p = q::pipeline< std::string >( tp_queue, 16 )
+ *   .stage( q::stage_mode::serial_in_order, parse )
+ *   .stage( { q::stage_mode::parallel, 4 }, compress )
+ *   .stage( q::stage_mode::serial_in_order, frame );
+ *
+ *   p.run( lines.get_readable( ), frames.get_writable( ) );
+ *
+ * A pipeline is a description, and can be run any number of times.
+ */
+template< typename In, typename Out = In >
+class pipeline
+{
+	typedef q::function<
+		std::shared_ptr< detail::pipeline_input< In > >(
+			std::shared_ptr< detail::pipeline_input< Out > >,
+			const std::shared_ptr< detail::pipeline_control >&
+		)
+	> factory_type;
+
+public:
+	/**
+	 * Creates a pipeline without stages, running on @a queue, with at
+	 * most @a tokens items in it at once.
+	 */
+	pipeline( const queue_ptr& queue, std::size_t tokens )
+	: queue_( queue )
+	, tokens_( tokens )
+	, factory_( [ ](
+		std::shared_ptr< detail::pipeline_input< Out > > next,
+		const std::shared_ptr< detail::pipeline_control >&
+	)
+	{
+		return next;
+	} )
+	{ }
+
+	/**
+	 * Adds a stage, calling @a fn with every item.
+	 */
+	template< typename Fn >
+	pipeline<
+		In,
+		typename detail::pipeline_stage_result<
+			Out, typename std::decay< Fn >::type
+		>::type
+	>
+	stage( stage_mode mode, Fn&& fn ) const
+	{
+		typedef typename std::decay< Fn >::type fn_type;
+		typedef typename detail::pipeline_stage_result<
+			Out, fn_type
+		>::type next_type;
+		typedef detail::pipeline_stage< Out, next_type, fn_type >
+			stage_type;
+
+		auto factory = factory_;
+		fn_type stage_fn( std::forward< Fn >( fn ) );
+
+		return pipeline< In, next_type >(
+			queue_,
+			tokens_,
+			[ factory, mode, stage_fn ](
+				std::shared_ptr<
+					detail::pipeline_input< next_type >
+				> next,
+				const std::shared_ptr<
+					detail::pipeline_control
+				>& control
+			) mutable
+			{
+				std::shared_ptr< detail::pipeline_input< Out > >
+				stage = std::make_shared< stage_type >(
+					mode, stage_fn, std::move( next ),
+					control );
+
+				return factory( std::move( stage ), control );
+			} );
+	}
+
+	/**
+	 * Runs the pipeline over all items of @a input, and closes @a output
+	 * when they have been written to it.
+	 *
+	 * @return promise resolved when all items are written, or rejected
+	 *         with the first error of a stage (which closes @a output
+	 *         with it)
+	 */
+	Q_NODISCARD
+	promise< > run( readable< In > input, writable< Out > output ) const
+	{
+		typedef detail::pipeline_runner< In, Out > runner_type;
+
+		auto runner = std::make_shared< runner_type >(
+			queue_,
+			tokens_,
+			std::move( input ),
+			std::move( output ) );
+
+		std::shared_ptr< detail::pipeline_input< Out > > sink = runner;
+		std::shared_ptr< detail::pipeline_control > control = runner;
+
+		auto factory = factory_;
+
+		return runner->start( factory( std::move( sink ), control ) );
+	}
+
+private:
+	template< typename, typename >
+	friend class pipeline;
+
+	pipeline(
+		const queue_ptr& queue,
+		std::size_t tokens,
+		factory_type factory
+	)
+	: queue_( queue )
+	, tokens_( tokens )
+	, factory_( std::move( factory ) )
+	{ }
+
+	queue_ptr queue_;
+	std::size_t tokens_;
+	factory_type factory_;
+};
+
+} // namespace q
+
+#endif // LIBQ_PIPELINE_HPP
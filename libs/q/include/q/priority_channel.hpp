@@ -0,0 +1,648 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_PRIORITY_CHANNEL_HPP
+#define LIBQ_PRIORITY_CHANNEL_HPP
+
+#include <q/channel.hpp>
+
+#include <deque>
+#include <list>
+#include <stdexcept>
+#include <vector>
+
+namespace q {
+
+namespace detail {
+
+/**
+ * The state of a priority_channel: one buffer per lane, and one list of
+ * waiting readers, which get the values in the order they are written (there
+ * is nothing to prioritize while readers are waiting).
+ */
+template< typename... T >
+class shared_priority_channel
+{
+public:
+	typedef std::tuple< T... > tuple_type;
+	typedef defer< T... > defer_type;
+
+	struct lane
+	{
+		lane( std::size_t buffer_count )
+		: buffer_count( buffer_count )
+		, resume_count( default_resume_count( buffer_count ) )
+		, paused( false )
+		{ }
+
+		const std::size_t buffer_count;
+		const std::size_t resume_count;
+		std::deque< tuple_type > values;
+		bool paused;
+		shared_task resume_notification;
+	};
+
+	shared_priority_channel(
+		const queue_ptr& queue,
+		const std::vector< std::size_t >& buffer_counts
+	)
+	: queue_( queue )
+	, mutex_( Q_HERE, "priority_channel" )
+	, closed_( false )
+	{
+		if ( buffer_counts.empty( ) )
+			Q_THROW( std::invalid_argument(
+				"A priority_channel needs a lane" ) );
+
+		lanes_.reserve( buffer_counts.size( ) );
+		for ( auto buffer_count : buffer_counts )
+			lanes_.emplace_back( buffer_count );
+	}
+
+	const queue_ptr& get_queue( ) const
+	{
+		return queue_;
+	}
+
+	std::size_t lanes( ) const
+	{
+		return lanes_.size( );
+	}
+
+	bool write( std::size_t index, tuple_type&& t )
+	{
+		auto& l = get_lane( index );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		if ( closed_ )
+			return false;
+
+		if ( !waiters_.empty( ) )
+		{
+			auto defer = std::move( waiters_.front( ) );
+			waiters_.pop_front( );
+			defer->set_value( std::move( t ) );
+			return true;
+		}
+
+		l.values.push_back( std::move( t ) );
+
+		// Pause when writing to an already full lane
+		if ( l.values.size( ) > l.buffer_count )
+			l.paused = true;
+
+		return true;
+	}
+
+	/**
+	 * Pops the next value from the highest priority non-empty lane.
+	 */
+	bool try_read( ring_value< tuple_type >& value )
+	{
+		shared_task notification;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( !pop( value, notification ) )
+				return false;
+		}
+
+		if ( notification )
+			queue_->push( std::move( notification ) );
+
+		return true;
+	}
+
+	bool try_read( tuple_type& t )
+	{
+		ring_value< tuple_type > value;
+
+		if ( !try_read( value ) )
+			return false;
+
+		t = std::move( value.get( ) );
+
+		return true;
+	}
+
+	promise< T... > read( )
+	{
+		shared_task notification;
+		ring_value< tuple_type > value;
+
+		auto defer = ::q::make_shared< defer_type >( queue_ );
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( !pop( value, notification ) )
+				return wait( defer );
+		}
+
+		if ( notification )
+			queue_->push( std::move( notification ) );
+
+		defer->set_value( std::move( value.get( ) ) );
+
+		return defer->get_promise( );
+	}
+
+	/**
+	 * Calls @a fn_value with the next value, or @a fn_closed if the
+	 * channel is (nicely) closed, as shared_channel::read( fn_value,
+	 * fn_closed ) does.
+	 *
+	 * @return promise resolved with whether a value was read
+	 */
+	template< typename FnValue, typename FnClosed >
+	promise< bool > read( FnValue fn_value, FnClosed fn_closed )
+	{
+		return read( )
+		.then( [ fn_value ]( tuple_type&& t ) mutable
+		{
+			fn_value( std::move( t ) );
+			return true;
+		} )
+		.fail( [ fn_closed ]( const channel_closed_exception& ) mutable
+		{
+			fn_closed( );
+			return false;
+		} );
+	}
+
+	std::size_t size( std::size_t index ) const
+	{
+		auto& l = get_lane( index );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return l.values.size( );
+	}
+
+	void close( std::exception_ptr e )
+	{
+		std::vector< shared_task > notifications;
+
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			if ( closed_ )
+				return;
+
+			closed_ = true;
+			exception_ = e;
+
+			// There are no buffered values when readers are waiting
+			auto error = e
+				? e
+				: std::make_exception_ptr(
+					channel_closed_exception( ) );
+
+			for ( auto& defer : waiters_ )
+				defer->set_exception( error );
+			waiters_.clear( );
+
+			for ( auto& l : lanes_ )
+				if ( l.resume_notification )
+					notifications.push_back(
+						l.resume_notification );
+		}
+
+		for ( auto& notification : notifications )
+			queue_->push( std::move( notification ) );
+	}
+
+	/**
+	 * Drops the buffered values of all lanes, e.g. when the channel is
+	 * closed by a failing consumer.
+	 */
+	void clear( )
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		for ( auto& l : lanes_ )
+			l.values.clear( );
+	}
+
+	bool is_closed( ) const
+	{
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return closed_;
+	}
+
+	bool should_write( std::size_t index ) const
+	{
+		auto& l = get_lane( index );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		return !l.paused && !closed_;
+	}
+
+	void set_resume_notification( std::size_t index, shared_task fn )
+	{
+		auto& l = get_lane( index );
+
+		Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+		l.resume_notification = std::move( fn );
+	}
+
+private:
+	lane& get_lane( std::size_t index )
+	{
+		if ( index >= lanes_.size( ) )
+			Q_THROW( std::out_of_range(
+				"No such priority_channel lane" ) );
+
+		return lanes_[ index ];
+	}
+
+	const lane& get_lane( std::size_t index ) const
+	{
+		return const_cast< shared_priority_channel* >( this )
+			->get_lane( index );
+	}
+
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	promise< T... > wait( const std::shared_ptr< defer_type >& defer )
+	{
+		if ( closed_ )
+			return reject< T... >(
+				queue_,
+				exception_
+				? exception_
+				: std::make_exception_ptr(
+					channel_closed_exception( ) ) );
+
+		waiters_.push_back( defer );
+
+		return defer->get_promise( );
+	}
+
+	/**
+	 * NOTE: The mutex must be held.
+	 */
+	bool pop( ring_value< tuple_type >& value, shared_task& notification )
+	{
+		for ( auto& l : lanes_ )
+		{
+			if ( l.values.empty( ) )
+				continue;
+
+			value.set( std::move( l.values.front( ) ) );
+			l.values.pop_front( );
+
+			if ( l.paused && l.values.size( ) < l.resume_count )
+			{
+				l.paused = false;
+				notification = l.resume_notification;
+			}
+
+			return true;
+		}
+
+		return false;
+	}
+
+	const queue_ptr queue_;
+	mutable mutex mutex_;
+	// Highest priority first
+	std::vector< lane > lanes_;
+	std::list< std::shared_ptr< defer_type > > waiters_;
+	bool closed_;
+	std::exception_ptr exception_;
+};
+
+} // namespace detail
+
+/**
+ * A channel with a fixed number of priority lanes, for multiplexing e.g.
+ * control messages and bulk data without the former getting stuck behind
+ * the latter. Lane 0 has the highest priority.
+ *
+ * Reads always get the next value from the highest priority non-empty lane,
+ * and values within a lane are read in order. Every lane has its own buffer
+ * count and backpressure (should_write( lane ) and the resume notification
+ * of the lane), so a full bulk lane doesn't pause the control lane.
+ *
+ * When closed, the buffered values can still be read, after which reads are
+ * rejected with a channel_closed_exception (or the error it was closed with).
+ * Copies of a priority_channel refer to the same channel.
+ */
+template< typename... T >
+class priority_channel
+{
+	typedef detail::shared_priority_channel< T... > channel_type;
+
+public:
+	typedef std::tuple< T... > tuple_type;
+
+	/**
+	 * Creates a channel with one lane per buffer count, highest priority
+	 * first, e.g. { 10, 1000 } for a small control lane and a bulk lane.
+	 */
+	priority_channel(
+		const queue_ptr& queue,
+		const std::vector< std::size_t >& buffer_counts
+	)
+	: channel_( q::make_shared< channel_type >( queue, buffer_counts ) )
+	{ }
+
+	std::size_t lanes( ) const
+	{
+		return channel_->lanes( );
+	}
+
+	/**
+	 * Writes a value to @a lane.
+	 *
+	 * @return false if the channel is closed
+	 * @throws std::out_of_range if there is no such lane
+	 */
+	template< typename... Args >
+	Q_NODISCARD
+	bool write( std::size_t lane, Args&&... args )
+	{
+		return channel_->write(
+			lane, tuple_type( std::forward< Args >( args )... ) );
+	}
+
+	/**
+	 * Reads the next value, from the highest priority non-empty lane.
+	 */
+	Q_NODISCARD
+	promise< T... > read( )
+	{
+		return channel_->read( );
+	}
+
+	/**
+	 * Reads the next buffered value into @a t, if there is one, without
+	 * allocating a promise.
+	 */
+	Q_NODISCARD
+	bool try_read( tuple_type& t )
+	{
+		return channel_->try_read( t );
+	}
+
+	/**
+	 * Calls @a fn with every value, in priority order, until the channel
+	 * is closed, as readable::consume( ) does for channels: With the
+	 * default concurrency of 1, if @a fn returns a promise, the next value
+	 * isn't read until it is resolved. If @a fn throws (or rejects), the
+	 * channel is closed with the error.
+	 */
+	template< typename Fn >
+	Q_NODISCARD
+	promise< > consume(
+		Fn&& fn, consume_options options = consume_options( ) )
+	{
+		typedef detail::channel_consumer<
+			decayed_function_t< Fn >,
+			channel_type,
+			priority_channel< T... >
+		> consumer_type;
+
+		priority_channel< T... > self = *this;
+
+		auto _fn = decay_function( std::forward< Fn >( fn ) );
+		Q_MOVE_INTO_MOVABLE( _fn );
+		auto _concurrency =
+			options.template get< concurrency >( ).get( );
+
+		return q::make_promise(
+			get_queue( ),
+			[ self, Q_MOVABLE_MOVE( _fn ), _concurrency ]
+			( resolver< > resolve, rejecter< > reject )
+			mutable
+		{
+			auto channel = self.channel_;
+
+			auto consumer = std::make_shared< consumer_type >(
+				std::move( self ),
+				std::move( channel ),
+				Q_MOVABLE_CONSUME( _fn ),
+				_concurrency,
+				std::move( resolve ),
+				std::move( reject )
+			);
+
+			consumer->pump( );
+		} );
+	}
+
+	/**
+	 * Returns a readable of the values of this channel, in priority order,
+	 * for use where a readable is needed, e.g. with q::select or
+	 * q::merge_channels. Up to @a buffer_count values are moved ahead into
+	 * the readable, and a value written to a higher priority lane meanwhile
+	 * is read after them. The channel is closed when the readable is.
+	 */
+	readable< T... > get_readable( std::size_t buffer_count = 1 )
+	{
+		channel< T... > ch( get_queue( ), buffer_count );
+
+		pump( channel_, ch.get_writable( ) );
+
+		return ch.get_readable( );
+	}
+
+	/**
+	 * The number of values buffered in @a lane.
+	 */
+	std::size_t size( std::size_t lane ) const
+	{
+		return channel_->size( lane );
+	}
+
+	void close( )
+	{
+		channel_->close( std::exception_ptr( ) );
+	}
+
+	void close( std::exception_ptr e )
+	{
+		channel_->close( std::move( e ) );
+	}
+
+	template< typename E >
+	typename std::enable_if<
+		!std::is_same<
+			typename std::decay< E >::type,
+			std::exception_ptr
+		>::value
+	>::type
+	close( E&& e )
+	{
+		close( std::make_exception_ptr( std::forward< E >( e ) ) );
+	}
+
+	bool is_closed( ) const
+	{
+		return channel_->is_closed( );
+	}
+
+	/**
+	 * False if @a lane is full (or the channel is closed). As with
+	 * channels, writes are still accepted.
+	 */
+	bool should_write( std::size_t lane ) const
+	{
+		return channel_->should_write( lane );
+	}
+
+	/**
+	 * Sets a function to be called (on the queue of the channel) when
+	 * @a lane is no longer paused, or when the channel is closed.
+	 */
+	void set_resume_notification( std::size_t lane, shared_task fn )
+	{
+		channel_->set_resume_notification( lane, std::move( fn ) );
+	}
+
+	void unset_resume_notification( std::size_t lane )
+	{
+		channel_->set_resume_notification( lane, shared_task( ) );
+	}
+
+	const queue_ptr& get_queue( ) const
+	{
+		return channel_->get_queue( );
+	}
+
+private:
+	static void pump(
+		std::shared_ptr< channel_type > shared,
+		writable< T... > writable
+	)
+	{
+		detail::ring_value< tuple_type > value;
+
+		while ( true )
+		{
+			if ( writable.is_closed( ) )
+			{
+				shared->close( std::exception_ptr( ) );
+				return;
+			}
+
+			if ( !writable.should_write( ) )
+			{
+				pump_on_resume( shared, writable );
+				return;
+			}
+
+			if ( !shared->try_read( value ) )
+				break;
+
+			if ( !writable.write( std::move( value.get( ) ) ) )
+			{
+				shared->close( std::exception_ptr( ) );
+				return;
+			}
+
+			value.reset( );
+		}
+
+		close_with_readable( shared, writable );
+
+		shared->read( )
+		.then( [ shared, writable ]( tuple_type&& t ) mutable
+		{
+			if ( writable.write( std::move( t ) ) )
+				pump( shared, writable );
+			else
+				shared->close( std::exception_ptr( ) );
+		} )
+		.fail( [ writable ]( const channel_closed_exception& ) mutable
+		{
+			writable.close( );
+		} )
+		.fail( [ writable ]( std::exception_ptr e ) mutable
+		{
+			writable.close( std::move( e ) );
+		} );
+	}
+
+	/**
+	 * Closes the channel as soon as the readable is closed, rather than
+	 * when the next value can't be written to it. The notification is
+	 * replaced by pump_on_resume( ) when the readable is full.
+	 */
+	static void close_with_readable(
+		std::shared_ptr< channel_type > shared,
+		writable< T... > writable
+	)
+	{
+		// Also called when the readable resumes, which is ignored
+		auto on_close = [ shared, writable ]( )
+		{
+			if ( !writable.is_closed( ) )
+				return;
+
+			auto _writable = writable;
+			_writable.unset_resume_notification( );
+			shared->close( std::exception_ptr( ) );
+		};
+
+		writable.set_resume_notification( on_close, false );
+
+		if ( writable.is_closed( ) )
+			on_close( );
+	}
+
+	static void pump_on_resume(
+		std::shared_ptr< channel_type > shared,
+		writable< T... > writable
+	)
+	{
+		// Called either by the resume notification or below, whichever
+		// comes first. The notification may be called with the mutex
+		// of the readable's channel held, so it only schedules a task.
+		auto once = std::make_shared< std::atomic< bool > >( false );
+
+		auto resume = [ shared, writable, once ]( )
+		{
+			if ( once->exchange( true ) )
+				return;
+
+			shared->get_queue( )->push( [ shared, writable ]( )
+			mutable
+			{
+				writable.unset_resume_notification( );
+				pump( shared, writable );
+			} );
+		};
+
+		writable.set_resume_notification( resume, false );
+
+		if ( writable.should_write( ) || writable.is_closed( ) )
+			resume( );
+	}
+
+	std::shared_ptr< channel_type > channel_;
+};
+
+} // namespace q
+
+#endif // LIBQ_PRIORITY_CHANNEL_HPP
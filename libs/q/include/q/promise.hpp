@@ -37,6 +37,7 @@
 #include <q/promise/with.hpp>
 #include <q/promise/all.hpp>
 #include <q/promise/make.hpp>
+#include <q/promise/lazy.hpp>
 #include <q/promise/delay.hpp>
 #include <q/promise/promisify.hpp>
 #include <q/promise/impl/then.hpp>
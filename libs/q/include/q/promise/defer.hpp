@@ -179,18 +179,19 @@ public:
 	>::type
 	set_by_fun( Fn&& fn, Args&&... args )
 	{
-		try
-		{
-			::q::call_with_args(
-				std::forward< Fn >( fn ),
-				std::forward< Args >( args )...
-			);
-			set_value( std::tuple< >( ) );
-		}
-		catch ( ... )
-		{
-			set_current_exception( );
-		}
+		guard(
+			nothrow_set_by_fun_t<
+				is_nothrow_call_with_args_t< Fn, Args... >
+			>( ),
+			[ & ]( )
+			{
+				::q::call_with_args(
+					std::forward< Fn >( fn ),
+					std::forward< Args >( args )...
+				);
+				set_value( std::tuple< >( ) );
+			}
+		);
 	}
 
 	/**
@@ -208,19 +209,21 @@ public:
 	>::type
 	set_by_fun( Fn&& fn, Args&&... args )
 	{
-		try
-		{
-			set_value(
-				::q::call_with_args(
-					std::forward< Fn >( fn ),
-					std::forward< Args >( args )...
-				)
-			);
-		}
-		catch ( ... )
-		{
-			set_current_exception( );
-		}
+		guard(
+			nothrow_set_by_fun_t<
+				is_nothrow_call_with_args_t< Fn, Args... >,
+				::q::result_of_t< Fn >
+			>( ),
+			[ & ]( )
+			{
+				set_value(
+					::q::call_with_args(
+						std::forward< Fn >( fn ),
+						std::forward< Args >( args )...
+					)
+				);
+			}
+		);
 	}
 
 	/**
@@ -241,18 +244,19 @@ public:
 	>::type
 	set_by_fun( Fn&& fn, Args&& args )
 	{
-		try
-		{
-			::q::call_with_args_by_tuple(
-				std::forward< Fn >( fn ),
-				std::forward< Args >( args )
-			);
-			set_value( std::tuple< >( ) );
-		}
-		catch ( ... )
-		{
-			set_current_exception( );
-		}
+		guard(
+			nothrow_set_by_fun_t<
+				is_nothrow_call_with_args_by_tuple_t< Fn, Args >
+			>( ),
+			[ & ]( )
+			{
+				::q::call_with_args_by_tuple(
+					std::forward< Fn >( fn ),
+					std::forward< Args >( args )
+				);
+				set_value( std::tuple< >( ) );
+			}
+		);
 	}
 
 	/**
@@ -275,19 +279,23 @@ public:
 	>::type
 	set_by_fun( Fn&& fn, Args&& args )
 	{
-		try
-		{
-			set_value(
-				::q::call_with_args_by_tuple(
-					std::forward< Fn >( fn ),
-					std::forward< Args >( args )
-				)
-			);
-		}
-		catch ( ... )
-		{
-			set_current_exception( );
-		}
+		guard(
+			nothrow_set_by_fun_t<
+				is_nothrow_call_with_args_by_tuple_t<
+					Fn, Args
+				>,
+				::q::result_of_t< Fn >
+			>( ),
+			[ & ]( )
+			{
+				set_value(
+					::q::call_with_args_by_tuple(
+						std::forward< Fn >( fn ),
+						std::forward< Args >( args )
+					)
+				);
+			}
+		);
 	}
 
 	/**
@@ -483,6 +491,51 @@ public:
 		set_by_fun( std::forward< Fn >( fn ) );
 	}
 
+	/**
+	 * std::true_type if set_by_fun( ) can't throw, i.e. if the call can't
+	 * (@a NothrowCall), and neither can moving its @a Result into the
+	 * promise.
+	 */
+	template< typename NothrowCall, typename Result = void >
+	using nothrow_set_by_fun_t = bool_type_t<
+		NothrowCall::value
+		and
+		(
+			std::is_void< Result >::value
+			or
+			std::is_nothrow_constructible<
+				typename std::decay< Result >::type,
+				Result
+			>::value
+		)
+		and
+		std::is_nothrow_move_constructible< expect_type >::value
+	>;
+
+	/**
+	 * Runs @a fn and sets the current exception to this defer if it
+	 * throws. If @a fn is statically known not to throw (the first
+	 * argument is std::true_type), no exception handling is added at all.
+	 */
+	template< typename Fn >
+	void guard( std::true_type, Fn&& fn )
+	{
+		fn( );
+	}
+
+	template< typename Fn >
+	void guard( std::false_type, Fn&& fn )
+	{
+		try
+		{
+			fn( );
+		}
+		catch ( ... )
+		{
+			set_current_exception( );
+		}
+	}
+
 	void satisfy( promise_type&& promise )
 	{
 		auto _this = this->shared_from_this( );
@@ -557,7 +610,7 @@ public:
 		return get_promise( );
 	}
 
-	queue_ptr get_queue( ) const
+	const queue_ptr& get_queue( ) const
 	{
 		return queue_;
 	}
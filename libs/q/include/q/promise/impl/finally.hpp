@@ -48,17 +48,17 @@ finally( Fn&& fn, Queue&& queue )
 	{
 		auto value = state->consume( );
 
-		try
+		typedef is_nothrow_call_with_args_t<
+			typename std::decay< Fn >::type
+		> nothrow;
+
+		// TODO: Consider using a nested_exception
+		deferred->guard( nothrow( ), [ & ]( )
 		{
 			Q_MOVABLE_CONSUME( fn )( );
 
 			deferred->set_expect( std::move( value ) );
-		}
-		catch ( ... )
-		{
-			// TODO: Consider using a nested_exception
-			deferred->set_exception( std::current_exception( ) );
-		}
+		} );
 	};
 
 	state_->signal( )->push( std::move( perform ),
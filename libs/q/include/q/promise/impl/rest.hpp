@@ -50,8 +50,8 @@ typename generic_promise< Shared, Args... >::promise_this_type
 generic_promise< Shared, Args... >::
 delay( timer::duration_type duration, queue_options options )
 {
-	auto queue = options.move< queue_ptr >( queue_ );
-	auto next_queue = options.move< defaultable< queue_ptr > >(
+	auto queue = options.template move< queue_ptr >( queue_ );
+	auto next_queue = options.template move< defaultable< queue_ptr > >(
 		set_default( queue ) ).value;
 
 	auto deferred = ::q::make_shared< detail::defer< Args... > >(
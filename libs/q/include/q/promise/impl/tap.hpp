@@ -58,7 +58,12 @@ tap( Fn&& fn, Queue&& queue )
 			return;
 		}
 
-		try
+		typedef is_nothrow_call_with_args_by_tuple_t<
+			typename std::decay< Fn >::type,
+			const tuple_type&
+		> nothrow;
+
+		deferred->guard( nothrow( ), [ & ]( )
 		{
 			::q::call_with_args_by_tuple(
 				Q_MOVABLE_CONSUME( fn ),
@@ -66,11 +71,7 @@ tap( Fn&& fn, Queue&& queue )
 			);
 
 			deferred->set_value( value.consume( ) );
-		}
-		catch ( ... )
-		{
-			deferred->set_exception( std::current_exception( ) );
-		}
+		} );
 	};
 
 	state_->signal( )->push( std::move( perform ),
@@ -191,7 +192,12 @@ tap( Fn&& fn, Queue&& queue )
 			return;
 		}
 
-		try
+		typedef is_nothrow_call_with_args_t<
+			typename std::decay< Fn >::type,
+			const tuple_type&
+		> nothrow;
+
+		deferred->guard( nothrow( ), [ & ]( )
 		{
 			call_with_args(
 				Q_MOVABLE_CONSUME( fn ),
@@ -199,11 +205,7 @@ tap( Fn&& fn, Queue&& queue )
 			);
 
 			deferred->set_value( value.consume( ) );
-		}
-		catch ( ... )
-		{
-			deferred->set_exception( std::current_exception( ) );
-		}
+		} );
 	};
 
 	state_->signal( )->push( std::move( perform ),
@@ -19,6 +19,144 @@
 
 namespace q { namespace detail {
 
+/**
+ * Calls @a fn with the value of @a state and satisfies @a deferred with the
+ * result, or redirects the exception.
+ */
+template< typename T, typename Defer, typename Fn >
+void perform_then(
+	std::shared_ptr< promise_state< T, false > >& state,
+	Defer& deferred,
+	Fn&& fn )
+{
+	auto value = state->consume( );
+	if ( value.has_exception( ) )
+		// Redirect exception
+		deferred->set_exception( value.exception( ) );
+	else
+		deferred->set_by_fun( std::forward< Fn >( fn ), value.consume( ) );
+}
+
+template< typename Fn, typename... Args >
+auto is_invocable_with( int )
+-> decltype(
+	( void )std::declval< Fn >( )( std::declval< Args >( )... ),
+	std::true_type( ) );
+
+template< typename Fn, typename... Args >
+std::false_type is_invocable_with( ... );
+
+template< typename Fn, typename Tuple >
+struct is_callable_by_const_ref
+: std::false_type
+{ };
+
+template< typename Fn, typename... T >
+struct is_callable_by_const_ref< Fn, std::tuple< T... > >
+: bool_type_t<
+	( sizeof...( T ) > 0 )
+	and
+	!first_argument_is_tuple< Fn >::value
+	and
+	decltype( is_invocable_with< Fn, const T&... >( 0 ) )::value
+>
+{ };
+
+template< typename Defer, typename Fn, typename... T >
+void perform_then_by_ref(
+	Defer& deferred,
+	Fn&& fn,
+	const std::tuple< T... >& value,
+	std::true_type )
+{
+	deferred->set_by_fun(
+		std::forward< Fn >( fn ), std::tuple< const T&... >( value ) );
+}
+
+/**
+ * What a parameter of type P is given from a shared value of type T: a const
+ * reference if P can be initialized from one, otherwise a copy (e.g. for
+ * rvalue reference parameters).
+ */
+template< typename P, typename T >
+using shared_argument_t = typename std::conditional<
+	std::is_convertible< const T&, P >::value,
+	const T&,
+	T
+>::type;
+
+template< typename Args, typename Tuple, typename = void >
+struct shared_arguments
+{
+	// The whole value is copied, e.g. for functions taking it as a tuple
+	typedef Tuple type;
+};
+
+template< typename... P, typename... T >
+struct shared_arguments<
+	arguments< P... >,
+	std::tuple< T... >,
+	typename std::enable_if< sizeof...( P ) == sizeof...( T ) >::type
+>
+{
+	typedef std::tuple< shared_argument_t< P, T >... > type;
+};
+
+template< typename Defer, typename Fn, typename... T >
+void perform_then_by_ref(
+	Defer& deferred,
+	Fn&& fn,
+	const std::tuple< T... >& value,
+	std::false_type )
+{
+	typedef typename shared_arguments<
+		typename std::conditional<
+			first_argument_is_tuple< Fn >::value,
+			void,
+			arguments_of_t< Fn >
+		>::type,
+		std::tuple< T... >
+	>::type arguments_type;
+
+	deferred->set_by_fun(
+		std::forward< Fn >( fn ), arguments_type( value ) );
+}
+
+/**
+ * For shared states, the functions are given references into the single
+ * stored value for the arguments they take by const reference or by value,
+ * and copies of the others, so that nothing but what a function needs is
+ * ever copied. The last listener (when nothing else refers to the state)
+ * gets the value moved instead.
+ */
+template< typename T, typename Defer, typename Fn >
+void perform_then(
+	std::shared_ptr< promise_state< T, true > >& state,
+	Defer& deferred,
+	Fn&& fn )
+{
+	if ( state.use_count( ) == 1 and state->unique( ) )
+	{
+		auto value = state->steal( );
+		if ( value.has_exception( ) )
+			deferred->set_exception( value.exception( ) );
+		else
+			deferred->set_by_fun(
+				std::forward< Fn >( fn ), value.consume( ) );
+		return;
+	}
+
+	const auto& value = state->ref( );
+	if ( value.has_exception( ) )
+		deferred->set_exception( value.exception( ) );
+	else
+		perform_then_by_ref(
+			deferred,
+			std::forward< Fn >( fn ),
+			value.get( ),
+			is_callable_by_const_ref< Fn, T >( ) );
+}
+
 /**
  * ( ... ) -> value
  */
@@ -46,24 +184,31 @@ then( Fn&& fn, Queue&& queue )
 		is_set_default< Queue >::value
 		? ensure( set_default_get( queue ) )
 		: get_queue( ) );
+	auto promise = deferred->get_promise( );
+	auto state = continuation_state( );
+	// Keeps the signal alive while pushing, as the continuation (which
+	// owns the state) may run and finish on another thread meanwhile
+	auto signal = state->signal( );
 	Q_MAKE_MOVABLE( fn );
-	auto state = state_;
+	Q_MOVE_INTO_MOVABLE( deferred );
+	Q_MOVE_INTO_MOVABLE( state );
 
-	auto perform = [ deferred, Q_MOVABLE_FORWARD( fn ), state ]( ) mutable
+	auto perform = [
+		Q_MOVABLE_MOVE( deferred ),
+		Q_MOVABLE_FORWARD( fn ),
+		Q_MOVABLE_MOVE( state )
+	]( ) mutable
 	{
-		auto value = state->consume( );
-		if ( value.has_exception( ) )
-			// Redirect exception
-			deferred->set_exception( value.exception( ) );
-		else
-			deferred->set_by_fun(
-				Q_MOVABLE_CONSUME( fn ), value.consume( ) );
+		perform_then(
+			Q_MOVABLE_GET( state ),
+			Q_MOVABLE_GET( deferred ),
+			Q_MOVABLE_CONSUME( fn ) );
 	};
 
-	state_->signal( )->push( std::move( perform ),
-	                         ensure( set_default_forward( queue ) ) );
+	signal->push( std::move( perform ),
+	              ensure( set_default_forward( queue ) ) );
 
-	return std::move( deferred->get_promise( ) );
+	return promise;
 }
 
 /**
@@ -94,24 +239,29 @@ then( Fn&& fn, Queue&& queue )
 	      is_set_default< Queue >::value
 	      ? ensure( set_default_get( queue ) )
 	      : get_queue( ) );
+	auto promise = deferred->get_promise( );
+	auto state = continuation_state( );
+	auto signal = state->signal( );
 	Q_MAKE_MOVABLE( fn );
-	auto state = state_;
+	Q_MOVE_INTO_MOVABLE( deferred );
+	Q_MOVE_INTO_MOVABLE( state );
 
-	auto perform = [ deferred, Q_MOVABLE_FORWARD( fn ), state ]( ) mutable
+	auto perform = [
+		Q_MOVABLE_MOVE( deferred ),
+		Q_MOVABLE_FORWARD( fn ),
+		Q_MOVABLE_MOVE( state )
+	]( ) mutable
 	{
-		auto value = state->consume( );
-		if ( value.has_exception( ) )
-			// Redirect exception
-			deferred->set_exception( value.exception( ) );
-		else
-			deferred->set_by_fun(
-				Q_MOVABLE_CONSUME( fn ), value.consume( ) );
+		perform_then(
+			Q_MOVABLE_GET( state ),
+			Q_MOVABLE_GET( deferred ),
+			Q_MOVABLE_CONSUME( fn ) );
 	};
 
-	state_->signal( )->push( std::move( perform ),
-	                         ensure( set_default_forward( queue ) ) );
+	signal->push( std::move( perform ),
+	              ensure( set_default_forward( queue ) ) );
 
-	return std::move( deferred->get_promise( ) );
+	return promise;
 }
 
 /**
@@ -141,24 +291,29 @@ then( Fn&& fn, Queue&& queue )
 	      is_set_default< Queue >::value
 	      ? ensure( set_default_get( queue ) )
 	      : get_queue( ) );
+	auto promise = deferred->get_promise( );
+	auto state = continuation_state( );
+	auto signal = state->signal( );
 	Q_MAKE_MOVABLE( fn );
-	auto state = state_;
+	Q_MOVE_INTO_MOVABLE( deferred );
+	Q_MOVE_INTO_MOVABLE( state );
 
-	auto perform = [ deferred, Q_MOVABLE_FORWARD( fn ), state ]( ) mutable
+	auto perform = [
+		Q_MOVABLE_MOVE( deferred ),
+		Q_MOVABLE_FORWARD( fn ),
+		Q_MOVABLE_MOVE( state )
+	]( ) mutable
 	{
-		auto value = state->consume( );
-		if ( value.has_exception( ) )
-			// Redirect exception
-			deferred->set_exception( value.exception( ) );
-		else
-			deferred->set_by_fun(
-				Q_MOVABLE_CONSUME( fn ), value.consume( ) );
+		perform_then(
+			Q_MOVABLE_GET( state ),
+			Q_MOVABLE_GET( deferred ),
+			Q_MOVABLE_CONSUME( fn ) );
 	};
 
-	state_->signal( )->push( std::move( perform ),
-	                         ensure( set_default_forward( queue ) ) );
+	signal->push( std::move( perform ),
+	              ensure( set_default_forward( queue ) ) );
 
-	return std::move( deferred->get_promise( ) );
+	return promise;
 }
 
 /**
@@ -189,24 +344,29 @@ then( Fn&& fn, Queue&& queue )
 	      is_set_default< Queue >::value
 	      ? ensure( set_default_get( queue ) )
 	      : get_queue( ) );
+	auto promise = deferred->get_promise( );
+	auto state = continuation_state( );
+	auto signal = state->signal( );
 	Q_MAKE_MOVABLE( fn );
-	auto state = state_;
+	Q_MOVE_INTO_MOVABLE( deferred );
+	Q_MOVE_INTO_MOVABLE( state );
 
-	auto perform = [ deferred, Q_MOVABLE_FORWARD( fn ), state ]( ) mutable
+	auto perform = [
+		Q_MOVABLE_MOVE( deferred ),
+		Q_MOVABLE_FORWARD( fn ),
+		Q_MOVABLE_MOVE( state )
+	]( ) mutable
 	{
-		auto value = state->consume( );
-		if ( value.has_exception( ) )
-			// Redirect exception
-			deferred->set_exception( value.exception( ) );
-		else
-			deferred->set_by_fun(
-				Q_MOVABLE_CONSUME( fn ), value.consume( ) );
+		perform_then(
+			Q_MOVABLE_GET( state ),
+			Q_MOVABLE_GET( deferred ),
+			Q_MOVABLE_CONSUME( fn ) );
 	};
 
-	state_->signal( )->push( std::move( perform ),
-				ensure( set_default_forward( queue ) ) );
+	signal->push( std::move( perform ),
+	              ensure( set_default_forward( queue ) ) );
 
-	return std::move( deferred->get_promise( ) );
+	return promise;
 }
 
 template< bool Shared, typename... Args >
@@ -0,0 +1,316 @@
+/*
+ * Copyright 2013 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_PROMISE_LAZY_HPP
+#define LIBQ_PROMISE_LAZY_HPP
+
+#include <q/promise/make.hpp>
+
+namespace q {
+
+template< typename Stages >
+class lazy_promise;
+
+namespace detail {
+
+template< typename Fn, typename Tuple >
+result_of_t< Fn >
+lazy_invoke( Fn& fn, Tuple&& args, std::false_type /* tuple argument */ )
+{
+	return ::q::call_with_args_by_tuple( fn, std::forward< Tuple >( args ) );
+}
+
+template< typename Fn, typename Tuple >
+result_of_t< Fn >
+lazy_invoke( Fn& fn, Tuple&& args, std::true_type /* tuple argument */ )
+{
+	return fn( std::forward< Tuple >( args ) );
+}
+
+/**
+ * Calls a stage function and packs its return value into a tuple, which is
+ * what the next stage (or the final defer) consumes.
+ */
+template< typename Result >
+struct lazy_result
+{
+	template< typename Fn, typename Tuple >
+	static std::tuple< Result > call( Fn& fn, Tuple&& args )
+	{
+		return std::tuple< Result >( lazy_invoke(
+			fn,
+			std::forward< Tuple >( args ),
+			bool_type_t< first_argument_is_tuple< Fn >::value >( ) ) );
+	}
+};
+
+template< >
+struct lazy_result< void >
+{
+	template< typename Fn, typename Tuple >
+	static std::tuple< > call( Fn& fn, Tuple&& args )
+	{
+		lazy_invoke(
+			fn,
+			std::forward< Tuple >( args ),
+			bool_type_t< first_argument_is_tuple< Fn >::value >( ) );
+		return std::tuple< >( );
+	}
+};
+
+template< typename... T >
+struct lazy_result< std::tuple< T... > >
+{
+	template< typename Fn, typename Tuple >
+	static std::tuple< T... > call( Fn& fn, Tuple&& args )
+	{
+		return lazy_invoke(
+			fn,
+			std::forward< Tuple >( args ),
+			bool_type_t< first_argument_is_tuple< Fn >::value >( ) );
+	}
+};
+
+/**
+ * The first stage of a lazy pipeline, which simply yields the values it was
+ * constructed with.
+ */
+template< typename... T >
+class lazy_values
+{
+public:
+	typedef std::tuple< T... > tuple_type;
+
+	explicit lazy_values( tuple_type&& values )
+	: values_( std::move( values ) )
+	{ }
+
+	tuple_type operator( )( )
+	{
+		return std::move( values_ );
+	}
+
+private:
+	tuple_type values_;
+};
+
+/**
+ * A stage which runs @a Prev and feeds its result into @a Fn. The whole
+ * pipeline is a nest of these, i.e. a single callable of static type.
+ */
+template< typename Prev, typename Fn >
+class lazy_stage
+{
+public:
+	typedef result_of_as_tuple_t< Fn > tuple_type;
+
+	lazy_stage( Prev&& prev, Fn&& fn )
+	: prev_( std::move( prev ) )
+	, fn_( std::move( fn ) )
+	{ }
+
+	tuple_type operator( )( )
+	{
+		return lazy_result< result_of_t< Fn > >::call( fn_, prev_( ) );
+	}
+
+private:
+	Prev prev_;
+	Fn fn_;
+};
+
+} // namespace detail
+
+/**
+ * A lazy_promise is a description of an asynchronous chain of synchronous
+ * functions, which isn't scheduled until start() is called (or it's
+ * converted into a promise).
+ *
+ * Every then() composes the function into the static type of the pipeline,
+ * so nothing is allocated until the pipeline is started. When started, the
+ * whole chain is run as one single task on the queue, resolving one single
+ * promise, instead of allocating a defer, a promise state and a task per
+ * step as a chain of promise::then() would.
+ *
+ * Functions returning promises, or functions which should run on another
+ * queue, can't be fused. Such then() calls will start the pipeline and
+ * return an ordinary promise.
+ */
+template< typename Stages >
+class lazy_promise
+{
+public:
+	typedef typename Stages::tuple_type tuple_type;
+	typedef detail::suitable_promise_t< tuple_type > promise_type;
+
+	lazy_promise( const queue_ptr& queue, Stages&& stages )
+	: queue_( queue )
+	, stages_( std::move( stages ) )
+	{ }
+
+	lazy_promise( lazy_promise&& ) = default;
+	lazy_promise& operator=( lazy_promise&& ) = default;
+
+	/**
+	 * ( ... ) -> value
+	 */
+	template< typename Fn >
+	typename std::enable_if<
+		is_function_t< Fn >::value
+		and
+		!first_argument_is_tuple< Fn >::value
+		and
+		::q::is_argument_same_or_convertible_incl_void_t<
+			tuple_arguments_t< tuple_type >,
+			arguments_of_t< Fn >
+		>::value
+		and
+		!is_promise< result_of_t< Fn > >::value,
+		lazy_promise< detail::lazy_stage<
+			Stages, typename std::decay< Fn >::type
+		> >
+	>::type
+	then( Fn&& fn )
+	{
+		return fuse( std::forward< Fn >( fn ) );
+	}
+
+	/**
+	 * ( std::tuple< ... > ) -> value
+	 */
+	template< typename Fn >
+	typename std::enable_if<
+		is_function_t< Fn >::value
+		and
+		first_argument_is_tuple< Fn >::value
+		and
+		::q::is_argument_same_or_convertible_incl_void_t<
+			tuple_arguments_t< tuple_type >,
+			tuple_arguments_t< first_argument_of_t< Fn > >
+		>::value
+		and
+		!is_promise< result_of_t< Fn > >::value,
+		lazy_promise< detail::lazy_stage<
+			Stages, typename std::decay< Fn >::type
+		> >
+	>::type
+	then( Fn&& fn )
+	{
+		return fuse( std::forward< Fn >( fn ) );
+	}
+
+	/**
+	 * ( ... ) -> promise< value >
+	 *
+	 * Starts the pipeline and continues with an ordinary promise.
+	 */
+	template< typename Fn >
+	typename std::enable_if<
+		is_function_t< Fn >::value
+		and
+		is_promise< result_of_t< Fn > >::value,
+		typename result_of_t< Fn >::unique_this_type
+	>::type
+	then( Fn&& fn )
+	{
+		return start( ).then( std::forward< Fn >( fn ) );
+	}
+
+	/**
+	 * Explicit queue. Starts the pipeline and continues with an ordinary
+	 * promise, on the given queue.
+	 */
+	template< typename Fn >
+	auto then( Fn&& fn, const queue_ptr& queue )
+	-> decltype( std::declval< promise_type >( ).then(
+		std::forward< Fn >( fn ), queue ) )
+	{
+		return start( ).then( std::forward< Fn >( fn ), queue );
+	}
+
+	/**
+	 * Schedules the pipeline on its queue, and returns the promise of its
+	 * final value. The lazy_promise must not be used after this.
+	 */
+	Q_NODISCARD promise_type start( )
+	{
+		return make_promise( queue_, std::move( stages_ ) );
+	}
+
+	operator promise_type( )
+	{
+		return start( );
+	}
+
+private:
+	template< typename Fn >
+	lazy_promise< detail::lazy_stage< Stages, typename std::decay< Fn >::type > >
+	fuse( Fn&& fn )
+	{
+		typedef typename std::decay< Fn >::type fn_type;
+		typedef detail::lazy_stage< Stages, fn_type > stage_type;
+
+		return lazy_promise< stage_type >(
+			queue_,
+			stage_type(
+				std::move( stages_ ),
+				fn_type( std::forward< Fn >( fn ) ) ) );
+	}
+
+	queue_ptr queue_;
+	Stages stages_;
+};
+
+/**
+ * Starts a lazy pipeline based on a set of values, like with(), but nothing
+ * is scheduled until the resulting lazy_promise is started.
+ */
+template< typename... T >
+lazy_promise< detail::lazy_values< typename std::decay< T >::type... > >
+lazy_with( const queue_ptr& queue, T&&... t )
+{
+	typedef detail::lazy_values< typename std::decay< T >::type... >
+		stage_type;
+
+	return lazy_promise< stage_type >(
+		queue,
+		stage_type( typename stage_type::tuple_type(
+			std::forward< T >( t )... ) ) );
+}
+
+/**
+ * Starts a lazy pipeline with a function, like make_promise(), but nothing
+ * is scheduled until the resulting lazy_promise is started.
+ */
+template< typename Fn >
+typename std::enable_if<
+	is_function_t< Fn >::value
+	and
+	arity_of_t< Fn >::value == 0
+	and
+	!is_promise< result_of_t< Fn > >::value,
+	lazy_promise< detail::lazy_stage<
+		detail::lazy_values< >, typename std::decay< Fn >::type
+	> >
+>::type
+make_lazy( const queue_ptr& queue, Fn&& fn )
+{
+	return lazy_with( queue ).then( std::forward< Fn >( fn ) );
+}
+
+} // namespace q
+
+#endif // LIBQ_PROMISE_LAZY_HPP
@@ -127,7 +127,7 @@ public:
 	/**
 	 * @return queue_ptr The current queue for this promise
 	 */
-	queue_ptr get_queue( ) const noexcept
+	const queue_ptr& get_queue( ) const noexcept
 	{
 		return queue_;
 	}
@@ -698,6 +698,16 @@ private:
 		return queue_;
 	}
 
+	/**
+	 * The state for a continuation to hold on to. Unique promises are
+	 * consumed by their continuations, so the state is moved rather than
+	 * copied, which saves an atomic increment and decrement per hop.
+	 */
+	std::shared_ptr< state_type > continuation_state( ) noexcept
+	{
+		return Shared ? state_ : std::move( state_ );
+	}
+
 	std::shared_ptr< state_type > state_;
 	queue_ptr queue_;
 };
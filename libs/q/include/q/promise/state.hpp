@@ -18,6 +18,8 @@
 #define LIBQ_PROMISE_STATE_HPP
 
 #include <future>
+#include <atomic>
+#include <mutex>
 
 // TODO: Consider moving to is_nothrow_* alternatives since we won't allow
 // exceptions to be thrown when copying or moving data between asynchronous
@@ -44,23 +46,59 @@ struct promise_state_data
 	promise_signal_ptr signal;
 };
 
+/**
+ * The state of a shared promise. The value is taken out of the future once,
+ * by the first listener, and kept here rather than in a std::shared_future
+ * (which only gives const access to it), so that the last listener can move
+ * it out.
+ */
 template< typename T >
 struct promise_state_data< T, true >
 {
 	typedef expect< T > value_type;
-	typedef std::shared_future< value_type > future_type;
+	typedef std::future< value_type > future_type;
 
 	promise_state_data( ) = delete;
-	promise_state_data( promise_state_data< T, true >&& unique ) = default;
-	promise_state_data( const promise_state_data< T, true >& unique ) = default;
+	promise_state_data( promise_state_data< T, true >&& ) = delete;
+	promise_state_data( const promise_state_data< T, true >& ) = delete;
 
 	promise_state_data( promise_state_data< T, false >&& unique )
-	: future( unique.future.share( ) )
+	: future( std::move( unique.future ) )
 	, signal( unique.signal )
+	, has_value( false )
 	{ }
 
+	~promise_state_data( )
+	{
+		if ( has_value )
+			value( ).~value_type( );
+	}
+
+	value_type& get( )
+	{
+		std::call_once( once, [ this ]( )
+		{
+			::new ( &storage ) value_type( future.get( ) );
+			has_value = true;
+		} );
+
+		return value( );
+	}
+
 	future_type future;
 	promise_signal_ptr signal;
+
+private:
+	value_type& value( )
+	{
+		return *reinterpret_cast< value_type* >( &storage );
+	}
+
+	std::once_flag once;
+	typename std::aligned_storage<
+		sizeof( value_type ), alignof( value_type )
+	>::type storage;
+	bool has_value;
 };
 
 template< typename T >
@@ -75,17 +113,43 @@ public:
 
 	typename state_type::value_type consume( )
 	{
-		return data_->future.get( );
+		return data_->get( );
 	}
 
-	promise_signal_ptr signal( )
+	/**
+	 * A reference to the value, shared by all listeners. It is only valid
+	 * for as long as this state is kept alive.
+	 */
+	const typename state_type::value_type& ref( ) const
 	{
-		return data_->signal;
+		return data_->get( );
 	}
 
-	state_type acquire( )
+	/**
+	 * Moves the value out of the shared storage. This must only be used by
+	 * the last listener, i.e. when no one else can ever read the value
+	 * again.
+	 */
+	typename state_type::value_type steal( )
+	{
+		return std::move( data_->get( ) );
+	}
+
+	/**
+	 * @return bool Whether this is the only copy of the state
+	 */
+	bool unique( ) const
+	{
+		if ( data_.use_count( ) != 1 )
+			return false;
+		// Synchronize with the release of any other (now dropped) copy
+		std::atomic_thread_fence( std::memory_order_acquire );
+		return true;
+	}
+
+	const promise_signal_ptr& signal( ) const
 	{
-		return *data_;
+		return data_->signal;
 	}
 
 protected:
@@ -116,10 +180,10 @@ public:
 
 	typename state_type::value_type consume( )
 	{
-		return std::move( data_.future.get( ) );
+		return data_.future.get( );
 	}
 
-	promise_signal_ptr signal( )
+	const promise_signal_ptr& signal( ) const
 	{
 		return data_.signal;
 	}
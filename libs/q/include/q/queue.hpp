@@ -26,6 +26,8 @@
 
 namespace q {
 
+class queue;
+
 class queue_exception
 : public exception
 { };
@@ -69,6 +71,8 @@ struct timer_task
 
 	task task_;
 	timer::point_type wait_until_;
+	// The queue the task was popped from (see queue::is_current( ))
+	const queue* queue_ = nullptr;
 
 private:
 	bool is_timed_;
@@ -102,6 +106,12 @@ public:
 
 	std::size_t parallelism( ) const;
 
+	/**
+	 * Whether the calling thread is running a task of this queue. Timed
+	 * tasks don't count.
+	 */
+	bool is_current( ) const;
+
 protected:
 	queue( priority_t priority = 0 );
 
@@ -110,6 +120,36 @@ private:
 	std::unique_ptr< pimpl > pimpl_;
 };
 
+namespace detail {
+
+/**
+ * Marks the calling thread as running a task of @a queue for the lifetime of
+ * this object. This is used by the event dispatchers, around every task they
+ * run.
+ */
+class current_queue_scope
+{
+public:
+	current_queue_scope( const queue* queue );
+	~current_queue_scope( );
+
+	current_queue_scope( const current_queue_scope& ) = delete;
+	current_queue_scope& operator=( const current_queue_scope& ) = delete;
+
+private:
+	const queue* previous_queue_;
+	std::size_t previous_inline_calls_;
+};
+
+/**
+ * Counts a call made inline (rather than as a task) against a budget, which
+ * is reset for every task run. Returns false if @a budget calls have been
+ * made already during the current task.
+ */
+bool take_inline_budget( std::size_t budget );
+
+} // namespace detail
+
 } // namespace q
 
 #endif // LIBQ_QUEUE_HPP
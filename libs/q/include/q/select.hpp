@@ -0,0 +1,530 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_SELECT_HPP
+#define LIBQ_SELECT_HPP
+
+#include <q/channel.hpp>
+
+#include <stdexcept>
+#include <vector>
+
+namespace q {
+
+namespace detail {
+
+/**
+ * One round of waiting for the first value from any of a set of channels.
+ *
+ * A waiter is added to every channel, all sharing this state, and the first
+ * channel to claim it gets to deliver its value (or exception). The other
+ * channels drop their waiter, without consuming any value.
+ *
+ * If all channels are (or get) closed without an error, on_closed( ) is
+ * called.
+ */
+template< typename... T >
+class select_state
+: public std::enable_shared_from_this< select_state< T... > >
+{
+public:
+	typedef shared_channel< T... > channel_type;
+	typedef std::shared_ptr< channel_type > channel_ptr;
+	typedef typename channel_type::tuple_type tuple_type;
+
+	virtual ~select_state( ) { }
+
+	static const channel_ptr& get_channel( const readable< T... >& r )
+	{
+		return channel_access::get( r );
+	}
+
+	/**
+	 * Adds the waiters to the channels, starting at @a first, until
+	 * one of them gets a value (or error).
+	 */
+	void arm( std::size_t first = 0 )
+	{
+		const auto size = channels_.size( );
+
+		for ( std::size_t i = 0; i < size && !is_done( ); ++i )
+		{
+			const auto index = ( first + i ) % size;
+
+			channels_[ index ]->add_waiter(
+				::q::make_unique< waiter >(
+					this->shared_from_this( ), index ) );
+		}
+	}
+
+	/**
+	 * Claims this round for the calling channel. The waiters in the other
+	 * channels stop counting as waiting right away, so that they don't
+	 * block lock-free reads and writes until they are purged.
+	 */
+	bool claim( )
+	{
+		if ( claimed_.exchange( true, std::memory_order_acq_rel ) )
+			return false;
+
+		for ( std::size_t i = 0; i < channels_.size( ); ++i )
+			if ( unlist( i ) )
+				channels_[ i ]->uncount_waiter( );
+
+		return true;
+	}
+
+	bool is_done( ) const
+	{
+		return claimed_.load( std::memory_order_acquire );
+	}
+
+protected:
+	select_state( std::vector< channel_ptr > channels, queue_ptr queue )
+	: channels_( std::move( channels ) )
+	, queue_( std::move( queue ) )
+	, listed_( new std::atomic< bool >[ channels_.size( ) ]( ) )
+	, claimed_( false )
+	, closed_( 0 )
+	{ }
+
+	/**
+	 * NOTE: These are called with the mutex of the delivering channel
+	 *       held, and must not use any of the channels synchronously.
+	 */
+	virtual void on_value( std::size_t index, tuple_type&& t ) = 0;
+	virtual void on_closed( ) = 0;
+	virtual void on_exception( std::exception_ptr e ) = 0;
+
+	const std::vector< channel_ptr > channels_;
+	const queue_ptr queue_;
+
+private:
+	struct waiter
+	: channel_type::waiter_type
+	{
+		waiter(
+			std::shared_ptr< select_state > state,
+			std::size_t index
+		)
+		: state( std::move( state ) )
+		, index( index )
+		{ }
+
+		bool claim( ) override
+		{
+			return state->claim( );
+		}
+
+		bool is_done( ) const override
+		{
+			return state->is_done( );
+		}
+
+		void list( ) override
+		{
+			state->listed_[ index ].store(
+				true, std::memory_order_release );
+		}
+
+		bool unlist( ) override
+		{
+			return state->unlist( index );
+		}
+
+		void set_closed( ) override
+		{
+			state->set_closed( );
+		}
+
+		void set_exception( std::exception_ptr e ) override
+		{
+			if ( state->claim( ) )
+			{
+				state->on_exception( std::move( e ) );
+				state->purge( );
+			}
+		}
+
+		void set_value( tuple_type&& t ) override
+		{
+			state->on_value( index, std::move( t ) );
+			state->purge( );
+		}
+
+		std::shared_ptr< select_state > state;
+		const std::size_t index;
+	};
+
+	bool unlist( std::size_t index )
+	{
+		return listed_[ index ].exchange(
+			false, std::memory_order_acq_rel );
+	}
+
+	void set_closed( )
+	{
+		if ( ++closed_ == channels_.size( ) && claim( ) )
+			on_closed( );
+	}
+
+	/**
+	 * Removes the remaining waiters from the other channels, so that they
+	 * don't block lock-free reads, nor keep this state alive.
+	 */
+	void purge( )
+	{
+		auto self = this->shared_from_this( );
+
+		queue_->push( [ self ]( )
+		{
+			for ( auto& channel : self->channels_ )
+				channel->purge_waiters( );
+		} );
+	}
+
+	// Whether the waiter in each channel is counted as waiting there
+	std::unique_ptr< std::atomic< bool >[ ] > listed_;
+	std::atomic< bool > claimed_;
+	std::atomic< std::size_t > closed_;
+};
+
+template< typename... T >
+class select_defer_state
+: public select_state< T... >
+{
+	typedef select_state< T... > base;
+	typedef typename base::tuple_type tuple_type;
+
+public:
+	typedef defer< std::size_t, T... > defer_type;
+
+	select_defer_state(
+		std::vector< typename base::channel_ptr > channels,
+		queue_ptr queue
+	)
+	: base( std::move( channels ), queue )
+	, deferred_( ::q::make_shared< defer_type >( std::move( queue ) ) )
+	{ }
+
+	promise< std::size_t, T... > get_promise( )
+	{
+		return deferred_->get_promise( );
+	}
+
+protected:
+	void on_value( std::size_t index, tuple_type&& t ) override
+	{
+		deferred_->set_value( std::tuple_cat(
+			std::make_tuple( index ), std::move( t ) ) );
+	}
+
+	void on_closed( ) override
+	{
+		deferred_->set_exception( channel_closed_exception( ) );
+	}
+
+	void on_exception( std::exception_ptr e ) override
+	{
+		deferred_->set_exception( std::move( e ) );
+	}
+
+private:
+	std::shared_ptr< defer_type > deferred_;
+};
+
+/**
+ * Moves values from a set of channels into one channel. Buffered values are
+ * moved round-robin, and when all channels are empty, one select round waits
+ * for the next value.
+ */
+template< typename... T >
+class merger
+: public std::enable_shared_from_this< merger< T... > >
+{
+	typedef select_state< T... > select_type;
+	typedef typename select_type::channel_ptr channel_ptr;
+	typedef typename select_type::tuple_type tuple_type;
+
+	struct round
+	: select_type
+	{
+		round( std::shared_ptr< merger > merger )
+		: select_type( merger->channels_, merger->queue_ )
+		, merger_( std::move( merger ) )
+		{ }
+
+		void on_value( std::size_t index, tuple_type&& t ) override
+		{
+			merger_->next_ = index + 1;
+			ignore_result(
+				merger_->writable_.write( std::move( t ) ) );
+			merger_->schedule( true );
+		}
+
+		void on_closed( ) override
+		{
+			merger_->writable_.close( );
+			merger_->schedule( true );
+		}
+
+		void on_exception( std::exception_ptr e ) override
+		{
+			merger_->writable_.close( std::move( e ) );
+			merger_->schedule( true );
+		}
+
+		std::shared_ptr< merger > merger_;
+	};
+
+public:
+	merger(
+		std::vector< readable< T... > > readables,
+		writable< T... > writable
+	)
+	: readables_( std::move( readables ) )
+	, writable_( std::move( writable ) )
+	, queue_( writable_.get_queue( ) )
+	, next_( 0 )
+	, armed_( false )
+	, pump_requests_( 0 )
+	{
+		for ( auto& readable : readables_ )
+			channels_.push_back(
+				select_type::get_channel( readable ) );
+	}
+
+	void start( )
+	{
+		auto self = this->shared_from_this( );
+
+		// The notification is triggered with the merged channel's
+		// mutex held, so pumping (which reads from the other channels)
+		// must be scheduled. It is also triggered when the merged
+		// readable is closed.
+		writable_.set_resume_notification( [ self ]( )
+		{
+			self->schedule( false );
+		} );
+
+		pump( );
+	}
+
+private:
+	void schedule( bool disarm )
+	{
+		auto self = this->shared_from_this( );
+
+		queue_->push( [ self, disarm ]( )
+		{
+			if ( disarm )
+				self->armed_ = false;
+			self->pump( );
+		} );
+	}
+
+	void pump( )
+	{
+		if ( pump_requests_.fetch_add( 1 ) != 0 )
+			return;
+
+		std::size_t handled = 1;
+		while ( true )
+		{
+			drain( );
+
+			const auto requests =
+				pump_requests_.fetch_sub( handled );
+			if ( requests == handled )
+				break;
+			handled = requests - handled;
+		}
+	}
+
+	void drain( )
+	{
+		ring_value< tuple_type > value;
+
+		while ( true )
+		{
+			// Also when a round is armed, which otherwise would keep
+			// waiting for a value nobody will read
+			if ( writable_.is_closed( ) )
+			{
+				finish( );
+				return;
+			}
+
+			if ( armed_ )
+				return;
+
+			if ( !writable_.should_write( ) )
+				// Paused, the resume notification will pump
+				return;
+
+			if ( !read_buffered( value ) )
+			{
+				armed_ = true;
+
+				auto round_state = std::make_shared< round >(
+					this->shared_from_this( ) );
+				round_state->arm( next_ );
+				return;
+			}
+
+			ignore_result(
+				writable_.write( std::move( value.get( ) ) ) );
+			value.reset( );
+		}
+	}
+
+	bool read_buffered( ring_value< tuple_type >& value )
+	{
+		const auto size = channels_.size( );
+
+		for ( std::size_t i = 0; i < size; ++i )
+		{
+			const auto index = ( next_ + i ) % size;
+
+			if ( channels_[ index ]->try_read( value ) )
+			{
+				next_ = index + 1;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * The merged channel is closed, either by its reader, or because all
+	 * channels are closed (or one failed). Closes the remaining ones.
+	 */
+	void finish( )
+	{
+		writable_.unset_resume_notification( );
+
+		auto err = writable_.get_exception( );
+
+		for ( auto& readable : readables_ )
+		{
+			if ( err )
+				readable.close( err );
+			else
+				readable.close( );
+		}
+	}
+
+	std::vector< readable< T... > > readables_;
+	std::vector< channel_ptr > channels_;
+	writable< T... > writable_;
+	const queue_ptr queue_;
+	std::size_t next_;
+	std::atomic< bool > armed_;
+	std::atomic< std::size_t > pump_requests_;
+};
+
+} // namespace detail
+
+/**
+ * Waits for the first value from any of @a readables, with a single waiter
+ * shared between all channels. Only the channel which delivers a value will
+ * be read from.
+ *
+ * If buffered values exist in multiple channels, the first of those channels
+ * is selected.
+ *
+ * @return a promise of the index (in @a readables) of the channel and its
+ *         value. If all channels are closed, the promise is rejected with a
+ *         channel_closed_exception, and if any channel is closed with an
+ *         error, with this error.
+ */
+template< typename... T >
+Q_NODISCARD
+typename std::enable_if<
+	!detail::channel_traits< T... >::is_promise::value,
+	promise< std::size_t, T... >
+>::type
+select( const std::vector< readable< T... > >& readables )
+{
+	typedef detail::select_defer_state< T... > state_type;
+
+	if ( readables.empty( ) )
+		Q_THROW( std::invalid_argument( "Nothing to select from" ) );
+
+	std::vector< typename state_type::channel_ptr > channels;
+	channels.reserve( readables.size( ) );
+	for ( auto& readable : readables )
+		channels.push_back( state_type::get_channel( readable ) );
+
+	auto state = std::make_shared< state_type >(
+		std::move( channels ), readables.front( ).get_queue( ) );
+
+	state->arm( );
+
+	return state->get_promise( );
+}
+
+/**
+ * Merges @a readables into one readable, which will be closed when all of
+ * them are closed, or with the first error any of them gets. Values are moved
+ * directly into the merged channel when it has room, and channels with
+ * buffered values are read from round-robin.
+ *
+ * Closing the merged readable closes @a readables.
+ */
+template< typename... T >
+typename std::enable_if<
+	!detail::channel_traits< T... >::is_promise::value,
+	readable< T... >
+>::type
+merge_channels(
+	std::vector< readable< T... > > readables,
+	std::size_t buffer_count
+)
+{
+	if ( readables.empty( ) )
+		Q_THROW( std::invalid_argument( "Nothing to merge" ) );
+
+	channel< T... > merged(
+		readables.front( ).get_queue( ), buffer_count );
+
+	auto merger = std::make_shared< detail::merger< T... > >(
+		std::move( readables ), merged.get_writable( ) );
+
+	merger->start( );
+
+	return merged.get_readable( );
+}
+
+template< typename... T >
+typename std::enable_if<
+	!detail::channel_traits< T... >::is_promise::value,
+	readable< T... >
+>::type
+merge_channels( std::vector< readable< T... > > readables )
+{
+	std::size_t buffer_count = 1;
+	for ( auto& readable : readables )
+		buffer_count = std::max(
+			buffer_count, readable.buffer_count( ) );
+
+	return merge_channels( std::move( readables ), buffer_count );
+}
+
+} // namespace q
+
+#endif // LIBQ_SELECT_HPP
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_SPILL_HPP
+#define LIBQ_SPILL_HPP
+
+#include <q/block.hpp>
+#include <q/exception.hpp>
+#include <q/detail/ring_buffer.hpp>
+#include <q/detail/spill_file.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace q {
+
+/**
+ * How values of a type are written to, and read back from, the spill file of
+ * a channel (see channel_spill). Specialize this for custom types, with:
+ *
+ *   static void write( std::vector< std::uint8_t >& out, const T& t );
+ *   static T read( byte_block& in ); // Consumes its bytes from in
+ *
+ * The data never leaves the process, so it doesn't need to be portable.
+ */
+template< typename T, typename = void >
+struct channel_serializer
+{
+	static constexpr bool is_serializable = false;
+};
+
+namespace detail {
+
+inline void write_spill_size( std::vector< std::uint8_t >& out, std::size_t n )
+{
+	const std::uint64_t size = n;
+	const auto ptr = reinterpret_cast< const std::uint8_t* >( &size );
+	out.insert( out.end( ), ptr, ptr + sizeof( size ) );
+}
+
+inline std::size_t read_spill_size( byte_block& in )
+{
+	std::uint64_t size;
+	if ( in.size( ) < sizeof( size ) )
+		Q_THROW( std::out_of_range( "Corrupt spilled value" ) );
+	std::memcpy( &size, in.data( ), sizeof( size ) );
+	in.advance( sizeof( size ) );
+	return static_cast< std::size_t >( size );
+}
+
+} // namespace detail
+
+template< typename T >
+struct channel_serializer<
+	T,
+	typename std::enable_if< std::is_arithmetic< T >::value >::type
+>
+{
+	static constexpr bool is_serializable = true;
+
+	static void write( std::vector< std::uint8_t >& out, const T& t )
+	{
+		const auto ptr = reinterpret_cast< const std::uint8_t* >( &t );
+		out.insert( out.end( ), ptr, ptr + sizeof( T ) );
+	}
+
+	static T read( byte_block& in )
+	{
+		T t;
+		std::memcpy( &t, in.data( ), sizeof( T ) );
+		in.advance( sizeof( T ) );
+		return t;
+	}
+};
+
+template< >
+struct channel_serializer< std::string >
+{
+	static constexpr bool is_serializable = true;
+
+	static void
+	write( std::vector< std::uint8_t >& out, const std::string& s )
+	{
+		detail::write_spill_size( out, s.size( ) );
+		out.insert( out.end( ), s.begin( ), s.end( ) );
+	}
+
+	static std::string read( byte_block& in )
+	{
+		const auto size = detail::read_spill_size( in );
+		std::string s(
+			reinterpret_cast< const char* >( in.data( ) ), size );
+		in.advance( size );
+		return s;
+	}
+};
+
+/**
+ * byte_blocks are read back as slices of the memory-mapped spill file,
+ * without being copied.
+ */
+template< >
+struct channel_serializer< byte_block >
+{
+	static constexpr bool is_serializable = true;
+
+	static void
+	write( std::vector< std::uint8_t >& out, const byte_block& b )
+	{
+		detail::write_spill_size( out, b.size( ) );
+		out.insert( out.end( ), b.data( ), b.data( ) + b.size( ) );
+	}
+
+	static byte_block read( byte_block& in )
+	{
+		const auto size = detail::read_spill_size( in );
+		auto b = in.slice( 0, size );
+		in.advance( size );
+		return b;
+	}
+};
+
+namespace detail {
+
+template<
+	typename Tuple,
+	std::size_t Index = 0,
+	bool Done = Index == std::tuple_size< Tuple >::value
+>
+struct tuple_serializer_writer
+{
+	typedef typename std::tuple_element< Index, Tuple >::type element_type;
+
+	static constexpr bool is_serializable =
+		channel_serializer< element_type >::is_serializable &&
+		tuple_serializer_writer< Tuple, Index + 1 >::is_serializable;
+
+	static void write( std::vector< std::uint8_t >& out, const Tuple& t )
+	{
+		channel_serializer< element_type >::write(
+			out, std::get< Index >( t ) );
+		tuple_serializer_writer< Tuple, Index + 1 >::write( out, t );
+	}
+};
+
+template< typename Tuple, std::size_t Index >
+struct tuple_serializer_writer< Tuple, Index, true >
+{
+	static constexpr bool is_serializable = true;
+
+	static void write( std::vector< std::uint8_t >&, const Tuple& )
+	{ }
+};
+
+template< typename Tuple >
+struct tuple_serializer;
+
+template< typename... T >
+struct tuple_serializer< std::tuple< T... > >
+: tuple_serializer_writer< std::tuple< T... > >
+{
+	static std::tuple< T... > read( byte_block& in )
+	{
+		// Braced initialization reads the elements in order
+		return std::tuple< T... >{
+			channel_serializer< T >::read( in )...
+		};
+	}
+};
+
+/**
+ * The values of a channel which didn't fit in memory.
+ */
+template< typename Tuple >
+class spill_buffer_base
+{
+public:
+	virtual ~spill_buffer_base( ) { }
+
+	virtual void push( const Tuple& t ) = 0;
+
+	virtual void pop( ring_value< Tuple >& value ) = 0;
+
+	virtual void clear( ) = 0;
+
+	virtual std::size_t size( ) const = 0;
+};
+
+template< typename Tuple >
+class spill_buffer
+: public spill_buffer_base< Tuple >
+{
+public:
+	spill_buffer( std::string directory, std::size_t segment_size )
+	: file_( std::move( directory ), segment_size )
+	{ }
+
+	void push( const Tuple& t ) override
+	{
+		scratch_.clear( );
+		tuple_serializer< Tuple >::write( scratch_, t );
+		file_.push( scratch_.data( ), scratch_.size( ) );
+	}
+
+	void pop( ring_value< Tuple >& value ) override
+	{
+		auto record = file_.pop( );
+		value.set( tuple_serializer< Tuple >::read( record ) );
+	}
+
+	void clear( ) override
+	{
+		file_.clear( );
+	}
+
+	std::size_t size( ) const override
+	{
+		return file_.size( );
+	}
+
+private:
+	spill_file file_;
+	// Reused for serializing every value
+	std::vector< std::uint8_t > scratch_;
+};
+
+template< typename Tuple >
+std::unique_ptr< spill_buffer_base< Tuple > >
+make_spill_buffer(
+	std::string directory, std::size_t segment_size, std::true_type
+)
+{
+	return std::unique_ptr< spill_buffer_base< Tuple > >(
+		new spill_buffer< Tuple >(
+			std::move( directory ), segment_size ) );
+}
+
+template< typename Tuple >
+std::unique_ptr< spill_buffer_base< Tuple > >
+make_spill_buffer( std::string, std::size_t, std::false_type )
+{
+	Q_THROW( std::invalid_argument(
+		"The values of this channel can't be spilled, "
+		"see q::channel_serializer" ) );
+}
+
+/**
+ * Creates a spill buffer for a tuple type, or throws std::invalid_argument if
+ * any of its types has no channel_serializer.
+ */
+template< typename Tuple >
+std::unique_ptr< spill_buffer_base< Tuple > >
+make_spill_buffer( std::string directory, std::size_t segment_size )
+{
+	typedef std::integral_constant<
+		bool, tuple_serializer< Tuple >::is_serializable
+	> is_serializable;
+
+	return make_spill_buffer< Tuple >(
+		std::move( directory ), segment_size, is_serializable( ) );
+}
+
+} // namespace detail
+
+} // namespace q
+
+#endif // LIBQ_SPILL_HPP
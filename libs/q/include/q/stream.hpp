@@ -0,0 +1,996 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBQ_STREAM_HPP
+#define LIBQ_STREAM_HPP
+
+#include <q/channel.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace q {
+
+template< typename Source, typename Chain, typename... T >
+class stream;
+
+namespace detail {
+
+/**
+ * The element type of batches: the value itself for single-type channels,
+ * otherwise a tuple of the values.
+ */
+template< typename... T >
+struct stream_element
+{
+	typedef std::tuple< T... > type;
+
+	static type get( std::tuple< T... >&& t )
+	{
+		return std::move( t );
+	}
+};
+
+template< typename T >
+struct stream_element< T >
+{
+	typedef T type;
+
+	static type get( std::tuple< T >&& t )
+	{
+		return std::move( std::get< 0 >( t ) );
+	}
+};
+
+/*
+ * Stages are called with a tuple of values and the next stage, and return
+ * false when no more values are wanted (e.g. after take( )). Every stage
+ * forwards at most one value per value it gets. When the source is closed,
+ * flush( ) lets stages forward what they hold (e.g. a partial batch).
+ *
+ * Stages are always called serially, never concurrently.
+ */
+
+struct identity_stage
+{
+	template< typename Tuple, typename Next >
+	bool operator( )( Tuple&& t, Next& next )
+	{
+		return next( std::forward< Tuple >( t ) );
+	}
+
+	template< typename Next >
+	void flush( Next& )
+	{ }
+};
+
+template< typename Stage, typename Next >
+struct stage_forwarder
+{
+	Stage& stage;
+	Next& next;
+
+	template< typename Tuple >
+	bool operator( )( Tuple&& t )
+	{
+		return stage( std::forward< Tuple >( t ), next );
+	}
+};
+
+/**
+ * Two stages composed into one, at compile time.
+ */
+template< typename Inner, typename Stage >
+struct fused_stage
+{
+	Inner inner;
+	Stage stage;
+
+	template< typename Tuple, typename Next >
+	bool operator( )( Tuple&& t, Next& next )
+	{
+		stage_forwarder< Stage, Next > forward{ stage, next };
+		return inner( std::forward< Tuple >( t ), forward );
+	}
+
+	template< typename Next >
+	void flush( Next& next )
+	{
+		stage_forwarder< Stage, Next > forward{ stage, next };
+		inner.flush( forward );
+		stage.flush( next );
+	}
+};
+
+template< typename Fn, bool Void = std::is_void< result_of_t< Fn > >::value >
+struct map_stage
+{
+	Fn fn;
+
+	template< typename Tuple, typename Next >
+	bool operator( )( Tuple&& t, Next& next )
+	{
+		return next( std::make_tuple( ::q::call_with_args_by_tuple(
+			fn, std::forward< Tuple >( t ) ) ) );
+	}
+
+	template< typename Next >
+	void flush( Next& )
+	{ }
+};
+
+template< typename Fn >
+struct map_stage< Fn, true >
+{
+	Fn fn;
+
+	template< typename Tuple, typename Next >
+	bool operator( )( Tuple&& t, Next& next )
+	{
+		::q::call_with_args_by_tuple( fn, std::forward< Tuple >( t ) );
+		return next( std::tuple< >( ) );
+	}
+
+	template< typename Next >
+	void flush( Next& )
+	{ }
+};
+
+template< typename Fn >
+struct filter_stage
+{
+	Fn fn;
+
+	template< typename Tuple, typename Next >
+	bool operator( )( Tuple&& t, Next& next )
+	{
+		if ( ::q::call_with_args_by_tuple( fn, t ) )
+			return next( std::forward< Tuple >( t ) );
+		return true;
+	}
+
+	template< typename Next >
+	void flush( Next& )
+	{ }
+};
+
+struct take_stage
+{
+	std::size_t remaining;
+
+	template< typename Tuple, typename Next >
+	bool operator( )( Tuple&& t, Next& next )
+	{
+		if ( remaining == 0 )
+			return false;
+
+		return next( std::forward< Tuple >( t ) ) && --remaining > 0;
+	}
+
+	template< typename Next >
+	void flush( Next& )
+	{ }
+};
+
+template< typename... T >
+struct batch_stage
+{
+	typedef stream_element< T... > element;
+
+	std::size_t count;
+	std::vector< typename element::type > values;
+
+	template< typename Next >
+	bool operator( )( std::tuple< T... >&& t, Next& next )
+	{
+		if ( values.empty( ) )
+			values.reserve( count );
+
+		values.push_back( element::get( std::move( t ) ) );
+
+		if ( values.size( ) < count )
+			return true;
+
+		return next( std::make_tuple( std::move( values ) ) );
+	}
+
+	template< typename Next >
+	void flush( Next& next )
+	{
+		if ( !values.empty( ) )
+			next( std::make_tuple( std::move( values ) ) );
+	}
+};
+
+/**
+ * Forwards a value, and then drops the values which come within @c duration
+ * after it.
+ */
+struct throttle_stage
+{
+	timer::duration_type duration;
+	timer::point_type next_at;
+
+	template< typename Tuple, typename Next >
+	bool operator( )( Tuple&& t, Next& next )
+	{
+		const auto now = timer::point_type::clock::now( );
+
+		if ( now < next_at )
+			return true;
+
+		next_at = now + duration;
+		return next( std::forward< Tuple >( t ) );
+	}
+
+	template< typename Next >
+	void flush( Next& )
+	{ }
+};
+
+template< typename Source, typename Chain, typename Fn, typename Result >
+struct stream_map_type
+{
+	typedef stream<
+		Source,
+		fused_stage< Chain, map_stage< Fn > >,
+		typename std::decay< Result >::type
+	> type;
+};
+
+template< typename Source, typename Chain, typename Fn >
+struct stream_map_type< Source, Chain, Fn, void >
+{
+	typedef stream< Source, fused_stage< Chain, map_stage< Fn > > > type;
+};
+
+/**
+ * Writes the values from a stream into a channel.
+ */
+template< typename... T >
+class writable_sink
+{
+public:
+	writable_sink( writable< T... > writable )
+	: writable_( std::move( writable ) )
+	{ }
+
+	template< typename Tuple >
+	bool operator( )( Tuple&& t )
+	{
+		return writable_.write( std::forward< Tuple >( t ) );
+	}
+
+	writable< T... >& get_writable( )
+	{
+		return writable_;
+	}
+
+	void flush( )
+	{ }
+
+private:
+	writable< T... > writable_;
+};
+
+/**
+ * Collects the values arriving within a time window (starting with the first
+ * value) into one vector.
+ */
+template< typename... T >
+class window_sink
+{
+	typedef stream_element< T... > element;
+	typedef std::vector< typename element::type > batch_type;
+
+	struct state
+	{
+		state( writable< batch_type > writable, timer::duration_type d )
+		: writable_( std::move( writable ) )
+		, duration_( d )
+		, mutex_( Q_HERE, "window" )
+		{ }
+
+		void flush( )
+		{
+			batch_type values;
+			{
+				Q_AUTO_UNIQUE_LOCK( mutex_ );
+				values.swap( values_ );
+			}
+
+			if ( !values.empty( ) )
+				ignore_result( writable_.write(
+					std::move( values ) ) );
+		}
+
+		writable< batch_type > writable_;
+		const timer::duration_type duration_;
+		mutex mutex_;
+		batch_type values_;
+	};
+
+public:
+	window_sink( writable< batch_type > writable, timer::duration_type d )
+	: state_( std::make_shared< state >( std::move( writable ), d ) )
+	{ }
+
+	bool operator( )( std::tuple< T... >&& t )
+	{
+		bool first;
+		{
+			Q_AUTO_UNIQUE_LOCK( state_->mutex_ );
+
+			first = state_->values_.empty( );
+			state_->values_.push_back(
+				element::get( std::move( t ) ) );
+		}
+
+		if ( first )
+		{
+			auto _state = state_;
+			state_->writable_.get_queue( )->push(
+				[ _state ]( )
+				{
+					_state->flush( );
+				},
+				timer::point_type::clock::now( ) +
+					state_->duration_
+			);
+		}
+
+		return !state_->writable_.is_closed( );
+	}
+
+	writable< batch_type >& get_writable( )
+	{
+		return state_->writable_;
+	}
+
+	void flush( )
+	{
+		state_->flush( );
+	}
+
+private:
+	std::shared_ptr< state > state_;
+};
+
+/**
+ * Forwards a value when no newer value has arrived within a duration. The
+ * last value is forwarded when the stream ends.
+ */
+template< typename... T >
+class debounce_sink
+{
+	struct state
+	{
+		state( writable< T... > writable, timer::duration_type d )
+		: writable_( std::move( writable ) )
+		, duration_( d )
+		, mutex_( Q_HERE, "debounce" )
+		, timer_pending_( false )
+		{ }
+
+		void schedule( std::shared_ptr< state > self )
+		{
+			writable_.get_queue( )->push(
+				[ self ]( )
+				{
+					self->on_timer( self );
+				},
+				last_at_ + duration_
+			);
+		}
+
+		void on_timer( const std::shared_ptr< state >& self )
+		{
+			ring_value< std::tuple< T... > > value;
+			{
+				Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+				const auto now =
+					timer::point_type::clock::now( );
+
+				if ( now < last_at_ + duration_ )
+				{
+					// Newer values arrived, wait for them
+					schedule( self );
+					return;
+				}
+
+				timer_pending_ = false;
+				if ( !latest_ )
+					return;
+				value.set( std::move( latest_.get( ) ) );
+				latest_.reset( );
+			}
+
+			ignore_result(
+				writable_.write( std::move( value.get( ) ) ) );
+		}
+
+		void flush( )
+		{
+			ring_value< std::tuple< T... > > value;
+			{
+				Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+				if ( !latest_ )
+					return;
+				value.set( std::move( latest_.get( ) ) );
+				latest_.reset( );
+			}
+
+			ignore_result(
+				writable_.write( std::move( value.get( ) ) ) );
+		}
+
+		writable< T... > writable_;
+		const timer::duration_type duration_;
+		mutex mutex_;
+		ring_value< std::tuple< T... > > latest_;
+		timer::point_type last_at_;
+		bool timer_pending_;
+	};
+
+public:
+	debounce_sink( writable< T... > writable, timer::duration_type d )
+	: state_( std::make_shared< state >( std::move( writable ), d ) )
+	{ }
+
+	bool operator( )( std::tuple< T... >&& t )
+	{
+		Q_AUTO_UNIQUE_LOCK( state_->mutex_ );
+
+		state_->latest_.set( std::move( t ) );
+		state_->last_at_ = timer::point_type::clock::now( );
+
+		if ( !state_->timer_pending_ )
+		{
+			state_->timer_pending_ = true;
+			state_->schedule( state_ );
+		}
+
+		return !state_->writable_.is_closed( );
+	}
+
+	writable< T... >& get_writable( )
+	{
+		return state_->writable_;
+	}
+
+	void flush( )
+	{
+		state_->flush( );
+	}
+
+private:
+	std::shared_ptr< state > state_;
+};
+
+/**
+ * Pulls values from a channel, through a chain of stages, into a sink which
+ * writes to another channel. Buffered values are pulled without promises,
+ * and the pump pauses while the output channel is full.
+ */
+template< typename Chain, typename Sink, typename... T >
+class stream_pump
+: public std::enable_shared_from_this< stream_pump< Chain, Sink, T... > >
+{
+	typedef std::tuple< T... > tuple_type;
+
+public:
+	stream_pump( readable< T... > source, Chain chain, Sink sink )
+	: source_( std::move( source ) )
+	, channel_( channel_access::get( source_ ) )
+	, chain_( std::move( chain ) )
+	, sink_( std::move( sink ) )
+	, pump_requests_( 0 )
+	, waiting_( false )
+	, done_( false )
+	{ }
+
+	void start( )
+	{
+		auto self = this->shared_from_this( );
+
+		// The notification is triggered with the output channel's mutex
+		// held, so pumping must be scheduled.
+		sink_.get_writable( ).set_resume_notification( [ self ]( )
+		{
+			self->channel_->get_queue( )->push( [ self ]( )
+			{
+				self->pump( );
+			} );
+		} );
+
+		pump( );
+	}
+
+private:
+	void pump( )
+	{
+		if ( pump_requests_.fetch_add( 1 ) != 0 )
+			return;
+
+		std::size_t handled = 1;
+		while ( true )
+		{
+			drain( );
+
+			const auto requests =
+				pump_requests_.fetch_sub( handled );
+			if ( requests == handled )
+				break;
+			handled = requests - handled;
+		}
+	}
+
+	void drain( )
+	{
+		ring_value< tuple_type > value;
+
+		while ( !waiting_ && !done_ )
+		{
+			auto& writable = sink_.get_writable( );
+
+			if ( writable.is_closed( ) )
+			{
+				// The output was closed by its reader
+				done_ = true;
+				writable.unset_resume_notification( );
+				source_.close( );
+				return;
+			}
+
+			if ( !writable.should_write( ) )
+				return;
+
+			if ( !channel_->try_read( value ) )
+			{
+				waiting_ = true;
+				wait( );
+				return;
+			}
+
+			push( std::move( value.get( ) ) );
+			value.reset( );
+		}
+	}
+
+	void push( tuple_type&& t )
+	{
+		if ( !chain_( std::move( t ), sink_ ) )
+		{
+			// No more values wanted
+			source_.close( );
+			source_.clear( );
+			complete( std::exception_ptr( ) );
+		}
+	}
+
+	void wait( )
+	{
+		auto self = this->shared_from_this( );
+
+		ignore_result(
+			source_.read(
+				[ self ]( tuple_type&& t )
+				{
+					if ( !self->done_ )
+						self->push( std::move( t ) );
+				},
+				[ self ]( ) { }
+			)
+			.then( [ self ]( bool got_value )
+			{
+				if ( !got_value )
+					self->complete( std::exception_ptr( ) );
+				self->waiting_ = false;
+				self->pump( );
+			} )
+			.fail( [ self ]( std::exception_ptr err )
+			{
+				self->complete( std::move( err ) );
+			} )
+		);
+	}
+
+	void complete( std::exception_ptr err )
+	{
+		if ( done_.exchange( true ) )
+			return;
+
+		auto& writable = sink_.get_writable( );
+
+		writable.unset_resume_notification( );
+
+		if ( err )
+		{
+			writable.close( std::move( err ) );
+			return;
+		}
+
+		chain_.flush( sink_ );
+		sink_.flush( );
+		writable.close( );
+	}
+
+	readable< T... > source_;
+	std::shared_ptr< shared_channel< T... > > channel_;
+	Chain chain_;
+	Sink sink_;
+	std::atomic< std::size_t > pump_requests_;
+	std::atomic< bool > waiting_;
+	std::atomic< bool > done_;
+};
+
+/**
+ * The state of stream::consume( ): the chain of stages, and the user
+ * function which gets the values coming out of it.
+ */
+template< typename Chain, typename Fn, typename In, typename... T >
+class stream_consumer;
+
+template< typename Chain, typename Fn, typename... In, typename... T >
+class stream_consumer< Chain, Fn, std::tuple< In... >, T... >
+: public std::enable_shared_from_this<
+	stream_consumer< Chain, Fn, std::tuple< In... >, T... >
+>
+{
+	typedef std::tuple< T... > tuple_type;
+	typedef result_of_t< Fn > result_type;
+
+	struct collector
+	{
+		ring_value< tuple_type >& value;
+
+		bool operator( )( tuple_type&& t )
+		{
+			value.set( std::move( t ) );
+			return true;
+		}
+	};
+
+	struct flush_collector
+	{
+		std::vector< tuple_type >& values;
+
+		bool operator( )( tuple_type&& t )
+		{
+			values.push_back( std::move( t ) );
+			return true;
+		}
+	};
+
+public:
+	stream_consumer( readable< In... > source, Chain chain, Fn fn )
+	: source_( std::move( source ) )
+	, chain_( std::move( chain ) )
+	, fn_( std::move( fn ) )
+	, mutex_( Q_HERE, "stream consumer" )
+	{ }
+
+	/**
+	 * Runs the chain (serially, as consume( ) may be concurrent) and calls
+	 * the function with its value, if it forwarded one.
+	 */
+	result_type push( std::tuple< In... >&& t )
+	{
+		ring_value< tuple_type > value;
+		bool more;
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			collector collect{ value };
+			more = chain_( std::move( t ), collect );
+		}
+
+		if ( !more )
+		{
+			source_.close( );
+			source_.clear( );
+		}
+
+		return call( value, ::q::is_promise< result_type >( ) );
+	}
+
+	/**
+	 * Calls the function with what the stages held when the source was
+	 * closed.
+	 */
+	promise< > flush( )
+	{
+		std::vector< tuple_type > values;
+		{
+			Q_AUTO_UNIQUE_LOCK( mutex_ );
+
+			flush_collector collect{ values };
+			chain_.flush( collect );
+		}
+
+		auto self = this->shared_from_this( );
+
+		auto queue = source_.get_queue( );
+		promise< > result = q::with( queue );
+
+		for ( auto& t : values )
+		{
+			Q_MOVE_INTO_MOVABLE( t );
+			result = result.then(
+				[ self, Q_MOVABLE_MOVE( t ) ]( ) mutable
+				{
+					return ::q::call_with_args_by_tuple(
+						self->fn_,
+						Q_MOVABLE_CONSUME( t ) );
+				} );
+		}
+
+		return result;
+	}
+
+private:
+	void call( ring_value< tuple_type >& value, std::false_type )
+	{
+		if ( value )
+			::q::call_with_args_by_tuple(
+				fn_, std::move( value.get( ) ) );
+	}
+
+	result_type call( ring_value< tuple_type >& value, std::true_type )
+	{
+		if ( !value )
+			return q::with( source_.get_queue( ) );
+
+		return ::q::call_with_args_by_tuple(
+			fn_, std::move( value.get( ) ) );
+	}
+
+	readable< In... > source_;
+	Chain chain_;
+	Fn fn_;
+	mutex mutex_;
+};
+
+template< typename... T >
+struct stream_factory
+{
+	static stream< readable< T... >, identity_stage, T... >
+	make( const readable< T... >& r )
+	{
+		return stream< readable< T... >, identity_stage, T... >(
+			r, identity_stage( ) );
+	}
+};
+
+} // namespace detail
+
+/**
+ * A chain of operators on a channel, created by the operator functions on
+ * readable (map, filter, take, batch, throttle). The operators are fused at
+ * compile time into one callback, so a chain costs one dispatch (and no
+ * extra buffering) per value. Nothing is read from the channel until the
+ * stream is consumed, or turned into a new channel.
+ *
+ * window and debounce are timed, and always produce a new channel.
+ */
+template< typename... In, typename Chain, typename... T >
+class stream< readable< In... >, Chain, T... >
+{
+	typedef readable< In... > source_type;
+	typedef typename detail::stream_element< T... >::type element_type;
+
+	template< typename Stage >
+	using next_type = stream<
+		source_type, detail::fused_stage< Chain, Stage >, T...
+	>;
+
+public:
+	stream( source_type source, Chain chain )
+	: source_( std::move( source ) )
+	, chain_( std::move( chain ) )
+	{ }
+
+	/**
+	 * Maps the values with @a fn. A function returning void gives a
+	 * stream of no values (only the events).
+	 */
+	template< typename Fn >
+	typename detail::stream_map_type<
+		source_type,
+		Chain,
+		decayed_function_t< Fn >,
+		result_of_t< decayed_function_t< Fn > >
+	>::type
+	map( Fn&& fn ) const
+	{
+		typedef decayed_function_t< Fn > fn_type;
+
+		static_assert(
+			!is_promise< result_of_t< fn_type > >::value,
+			"stream stages must be synchronous" );
+
+		return { source_, fuse( detail::map_stage< fn_type >{
+			decay_function( std::forward< Fn >( fn ) ) } ) };
+	}
+
+	/**
+	 * Only lets through the values for which @a fn returns true.
+	 */
+	template< typename Fn >
+	next_type< detail::filter_stage< decayed_function_t< Fn > > >
+	filter( Fn&& fn ) const
+	{
+		return { source_, fuse(
+			detail::filter_stage< decayed_function_t< Fn > >{
+				decay_function( std::forward< Fn >( fn ) )
+			} ) };
+	}
+
+	/**
+	 * Lets through @a count values, and then closes the source channel.
+	 */
+	next_type< detail::take_stage > take( std::size_t count ) const
+	{
+		return { source_, fuse( detail::take_stage{ count } ) };
+	}
+
+	/**
+	 * Groups the values in vectors of @a count values. The last batch may
+	 * be smaller.
+	 */
+	stream<
+		source_type,
+		detail::fused_stage< Chain, detail::batch_stage< T... > >,
+		std::vector< element_type >
+	>
+	batch( std::size_t count ) const
+	{
+		return { source_, fuse( detail::batch_stage< T... >{
+			std::max< std::size_t >( count, 1 ),
+			std::vector< element_type >( )
+		} ) };
+	}
+
+	/**
+	 * Lets through a value, and drops the values within @a duration after
+	 * it.
+	 */
+	next_type< detail::throttle_stage >
+	throttle( timer::duration_type duration ) const
+	{
+		return { source_, fuse( detail::throttle_stage{
+			duration, timer::point_type( ) } ) };
+	}
+
+	/**
+	 * Calls @a fn with the values coming out of the stream. As for
+	 * readable::consume( ), @a fn may return a promise, and a concurrency
+	 * can be given (the stream operators are still called serially).
+	 */
+	template< typename Fn >
+	Q_NODISCARD
+	promise< >
+	consume( Fn&& fn, consume_options options = consume_options( ) )
+	const
+	{
+		typedef decayed_function_t< Fn > fn_type;
+		typedef detail::stream_consumer<
+			Chain, fn_type, std::tuple< In... >, T...
+		> consumer_type;
+
+		auto consumer = std::make_shared< consumer_type >(
+			source_,
+			chain_,
+			decay_function( std::forward< Fn >( fn ) ) );
+
+		auto source = source_;
+
+		return source.consume(
+			[ consumer ]( In&&... values )
+			{
+				return consumer->push( std::forward_as_tuple(
+					std::move( values )... ) );
+			},
+			std::move( options )
+		)
+		.then( [ consumer ]( )
+		{
+			return consumer->flush( );
+		} );
+	}
+
+	/**
+	 * Writes the values coming out of the stream into a new channel.
+	 */
+	Q_NODISCARD
+	readable< T... > to_readable( std::size_t buffer_count ) const
+	{
+		channel< T... > ch( source_.get_queue( ), buffer_count );
+
+		start_pump(
+			detail::writable_sink< T... >( ch.get_writable( ) ) );
+
+		return ch.get_readable( );
+	}
+
+	Q_NODISCARD
+	readable< T... > to_readable( ) const
+	{
+		return to_readable( source_.buffer_count( ) );
+	}
+
+	/**
+	 * Collects the values arriving within @a duration from the first one
+	 * into vectors, in a new channel.
+	 */
+	Q_NODISCARD
+	readable< std::vector< element_type > >
+	window( timer::duration_type duration ) const
+	{
+		channel< std::vector< element_type > > ch(
+			source_.get_queue( ), source_.buffer_count( ) );
+
+		start_pump( detail::window_sink< T... >(
+			ch.get_writable( ), duration ) );
+
+		return ch.get_readable( );
+	}
+
+	/**
+	 * Writes a value into a new channel when no newer value arrives
+	 * within @a duration.
+	 */
+	Q_NODISCARD
+	readable< T... > debounce( timer::duration_type duration ) const
+	{
+		channel< T... > ch(
+			source_.get_queue( ), source_.buffer_count( ) );
+
+		start_pump( detail::debounce_sink< T... >(
+			ch.get_writable( ), duration ) );
+
+		return ch.get_readable( );
+	}
+
+private:
+	template< typename Stage >
+	detail::fused_stage< Chain, Stage > fuse( Stage&& stage ) const
+	{
+		return { chain_, std::forward< Stage >( stage ) };
+	}
+
+	template< typename Sink >
+	void start_pump( Sink&& sink ) const
+	{
+		typedef detail::stream_pump<
+			Chain, typename std::decay< Sink >::type, In...
+		> pump_type;
+
+		auto pump = std::make_shared< pump_type >(
+			source_, chain_, std::forward< Sink >( sink ) );
+
+		pump->start( );
+	}
+
+	source_type source_;
+	Chain chain_;
+};
+
+} // namespace q
+
+#endif // LIBQ_STREAM_HPP
@@ -138,8 +138,20 @@ class scheduler;
 
 typedef int priority_t;
 
+#ifdef Q_USE_TASK_INLINE_WORDS
+// Tasks with an inline size tuned to the continuations of the application,
+// see q::get_function_stats( ). This must be the same when building libq as
+// when using it.
+typedef q::custom_unique_function<
+	void( void ) noexcept, Q_USE_TASK_INLINE_WORDS
+> task;
+typedef q::custom_shared_function<
+	void( void ) noexcept, Q_USE_TASK_INLINE_WORDS
+> shared_task;
+#else
 typedef q::unique_function< void( void ) noexcept > task;
 typedef q::function< void( void ) noexcept > shared_task;
+#endif
 
 // Execution context
 
@@ -19,6 +19,16 @@
 
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#ifdef LIBQ_ON_POSIX
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
 
 namespace q {
 
@@ -40,17 +50,375 @@ std::shared_ptr< const std::uint8_t > wrap_shared( std::uint8_t const* ptr )
 	} );
 }
 
+std::shared_ptr< const std::uint8_t > alloc_unpooled( std::size_t size )
+{
+	// The deleter is called if the control block can't be allocated
+	return wrap_shared( new std::uint8_t[ size ] );
+}
+
+// Buffers of up to 64 KiB are pooled, in power-of-two size classes from 64
+// bytes. Every pooled allocation holds the shared_ptr control block too,
+// which is assumed to fit in the slack (otherwise it isn't pooled).
+constexpr std::size_t min_buffer_size = 64;
+constexpr std::size_t num_size_classes = 11;
+constexpr std::size_t control_block_slack = 64;
+
+// The number of bytes of free buffers a thread keeps per size class, before
+// releasing them to the system.
+constexpr std::size_t max_cached_bytes = 512 * 1024;
+
+constexpr std::size_t buffer_size_of( std::size_t size_class )
+{
+	return min_buffer_size << size_class;
+}
+
+constexpr std::size_t allocation_size_of( std::size_t size_class )
+{
+	return buffer_size_of( size_class ) + control_block_slack;
+}
+
+constexpr std::size_t max_cached_blocks_of( std::size_t size_class )
+{
+	return max_cached_bytes / allocation_size_of( size_class );
+}
+
+std::size_t size_class_of( std::size_t size )
+{
+	std::size_t size_class = 0;
+	while ( buffer_size_of( size_class ) < size )
+		++size_class;
+	return size_class;
+}
+
+std::size_t size_class_of_allocation( std::size_t size )
+{
+	std::size_t size_class = 0;
+	while (
+		size_class < num_size_classes &&
+		allocation_size_of( size_class ) < size
+	)
+		++size_class;
+	return size_class;
+}
+
+struct free_block
+{
+	free_block* next;
+};
+
+/**
+ * Counters which are only ever written by one thread, so they can be
+ * incremented without atomic read-modify-write, but read by any thread.
+ */
+struct pool_counters
+{
+	std::atomic< std::size_t > hits{ 0 };
+	std::atomic< std::size_t > misses{ 0 };
+	std::atomic< std::size_t > oversized{ 0 };
+	std::atomic< std::size_t > recycled{ 0 };
+	std::atomic< std::size_t > freed{ 0 };
+
+	static void increment( std::atomic< std::size_t >& counter )
+	{
+		counter.store(
+			counter.load( std::memory_order_relaxed ) + 1,
+			std::memory_order_relaxed );
+	}
+
+	void add_to( byte_block_pool_stats& stats ) const
+	{
+		stats.hits += hits.load( std::memory_order_relaxed );
+		stats.misses += misses.load( std::memory_order_relaxed );
+		stats.oversized += oversized.load( std::memory_order_relaxed );
+		stats.recycled += recycled.load( std::memory_order_relaxed );
+		stats.freed += freed.load( std::memory_order_relaxed );
+	}
+};
+
+class thread_pool_cache;
+
+/**
+ * Keeps track of the thread caches, to sum up their counters.
+ */
+class pool_registry
+{
+public:
+	static pool_registry& get( )
+	{
+		// Intentionally leaked, as byte_blocks may be released during
+		// static destruction.
+		static pool_registry* registry = new pool_registry( );
+		return *registry;
+	}
+
+	void add_thread( thread_pool_cache* cache )
+	{
+		std::unique_lock< std::mutex > lock( mut_ );
+		threads_.push_back( cache );
+	}
+
+	void remove_thread(
+		thread_pool_cache* cache, const pool_counters& counters )
+	{
+		std::unique_lock< std::mutex > lock( mut_ );
+		threads_.erase( std::find(
+			threads_.begin( ), threads_.end( ), cache ) );
+		counters.add_to( retired_stats_ );
+	}
+
+	byte_block_pool_stats stats( );
+
+private:
+	std::mutex mut_;
+	std::vector< thread_pool_cache* > threads_;
+	byte_block_pool_stats retired_stats_;
+};
+
+/**
+ * A free list per size class. Buffers are allocated one by one with
+ * operator new, so a buffer released on another thread than the one which
+ * allocated it simply joins that thread's free list, and buffers which
+ * don't fit in the free list are deleted.
+ */
+class thread_pool_cache
+{
+public:
+	thread_pool_cache( )
+	{
+		for ( auto& head : free_ )
+			head = nullptr;
+		for ( auto& size : sizes_ )
+			size = 0;
+
+		pool_registry::get( ).add_thread( this );
+	}
+
+	~thread_pool_cache( )
+	{
+		for ( auto head : free_ )
+			while ( head )
+			{
+				auto next = head->next;
+				::operator delete( head );
+				head = next;
+			}
+
+		pool_registry::get( ).remove_thread( this, counters );
+	}
+
+	void* allocate( std::size_t size_class )
+	{
+		auto& head = free_[ size_class ];
+
+		if ( head )
+		{
+			pool_counters::increment( counters.hits );
+			auto block = head;
+			head = block->next;
+			--sizes_[ size_class ];
+			return block;
+		}
+
+		pool_counters::increment( counters.misses );
+		return ::operator new( allocation_size_of( size_class ) );
+	}
+
+	void deallocate( void* ptr, std::size_t size_class )
+	{
+		const auto max_blocks = max_cached_blocks_of( size_class );
+
+		if ( sizes_[ size_class ] >= max_blocks )
+		{
+			pool_counters::increment( counters.freed );
+			::operator delete( ptr );
+			return;
+		}
+
+		pool_counters::increment( counters.recycled );
+		auto block = static_cast< free_block* >( ptr );
+		block->next = free_[ size_class ];
+		free_[ size_class ] = block;
+		++sizes_[ size_class ];
+	}
+
+	pool_counters counters;
+
+private:
+	free_block* free_[ num_size_classes ];
+	std::size_t sizes_[ num_size_classes ];
+};
+
+byte_block_pool_stats pool_registry::stats( )
+{
+	std::unique_lock< std::mutex > lock( mut_ );
+
+	byte_block_pool_stats stats = retired_stats_;
+
+	for ( auto cache : threads_ )
+		cache->counters.add_to( stats );
+
+	return stats;
+}
+
+enum class cache_state
+{
+	uninitialized,
+	alive,
+	destructed
+};
+
+// A trivially destructible flag, which can be read even after the cache of
+// this thread has been destructed (e.g. when byte_blocks are released by
+// other thread-local destructors).
+thread_local cache_state this_thread_cache_state = cache_state::uninitialized;
+
+thread_pool_cache* get_thread_pool_cache( )
+{
+	if ( this_thread_cache_state == cache_state::destructed )
+		return nullptr;
+
+	struct cache_holder
+	{
+		cache_holder( )
+		{
+			this_thread_cache_state = cache_state::alive;
+		}
+
+		~cache_holder( )
+		{
+			this_thread_cache_state = cache_state::destructed;
+		}
+
+		thread_pool_cache cache;
+	};
+
+	static thread_local cache_holder holder;
+	return &holder.cache;
+}
+
+void* pool_allocate( std::size_t size )
+{
+	const auto size_class = size_class_of_allocation( size );
+
+	if ( size_class == num_size_classes )
+		return ::operator new( size );
+
+	auto cache = get_thread_pool_cache( );
+	if ( !cache )
+		return ::operator new( allocation_size_of( size_class ) );
+
+	return cache->allocate( size_class );
+}
+
+void pool_deallocate( void* ptr, std::size_t size ) noexcept
+{
+	const auto size_class = size_class_of_allocation( size );
+
+	auto cache = get_thread_pool_cache( );
+
+	if ( size_class == num_size_classes || !cache )
+		::operator delete( ptr );
+	else
+		cache->deallocate( ptr, size_class );
+}
+
+/**
+ * Allocates the shared_ptr control block and the buffer it owns as one
+ * pooled allocation.
+ */
+template< typename T >
+struct pool_allocator
+{
+	typedef T value_type;
+
+	pool_allocator( ) noexcept { }
+
+	template< typename U >
+	pool_allocator( const pool_allocator< U >& ) noexcept { }
+
+	T* allocate( std::size_t n )
+	{
+		return static_cast< T* >( pool_allocate( n * sizeof( T ) ) );
+	}
+
+	void deallocate( T* ptr, std::size_t n ) noexcept
+	{
+		pool_deallocate( ptr, n * sizeof( T ) );
+	}
+
+	template< typename U >
+	bool operator==( const pool_allocator< U >& ) const noexcept
+	{
+		return true;
+	}
+
+	template< typename U >
+	bool operator!=( const pool_allocator< U >& ) const noexcept
+	{
+		return false;
+	}
+};
+
+template< std::size_t Size >
+struct pooled_buffer
+{
+	// Leaves the data uninitialized
+	pooled_buffer( ) { }
+
+	std::uint8_t data[ Size ];
+};
+
+template< std::size_t SizeClass >
+struct pooled_alloc
+{
+	static std::shared_ptr< const std::uint8_t >
+	alloc( std::size_t size_class )
+	{
+		typedef pooled_buffer< buffer_size_of( SizeClass ) >
+			buffer_type;
+		typedef pooled_alloc< SizeClass + 1 > next_type;
+
+		if ( size_class != SizeClass )
+			return next_type::alloc( size_class );
+
+		auto buffer = std::allocate_shared< buffer_type >(
+			pool_allocator< buffer_type >( ) );
+
+		return std::shared_ptr< const std::uint8_t >(
+			buffer, buffer->data );
+	}
+};
+
+template< >
+struct pooled_alloc< num_size_classes >
+{
+	static std::shared_ptr< const std::uint8_t > alloc( std::size_t )
+	{
+		return nullptr;
+	}
+};
+
 std::shared_ptr< const std::uint8_t > alloc_shared( std::size_t size )
 {
-	auto xdata = q::make_unique< std::uint8_t[ ] >( size );
-	auto data = std::unique_ptr< std::uint8_t const[ ] >( std::move( xdata ) );
-	auto shared_data = wrap_shared( data.get( ), data.get_deleter( ) );
-	data.release( );
-	return shared_data;
+	if ( size > buffer_size_of( num_size_classes - 1 ) )
+	{
+		auto cache = get_thread_pool_cache( );
+		if ( cache )
+			pool_counters::increment( cache->counters.oversized );
+
+		return alloc_unpooled( size );
+	}
+
+	return pooled_alloc< 0 >::alloc( size_class_of( size ) );
 }
 
 } // anonymous namespace
 
+byte_block_pool_stats get_byte_block_pool_stats( )
+{
+	return pool_registry::get( ).stats( );
+}
+
 byte_block::byte_block( )
 : size_( 0 )
 , ptr_( nullptr )
@@ -159,4 +527,356 @@ std::string byte_block::to_string( ) const
 	return std::string( reinterpret_cast< const char* >( ptr_ ), size( ) );
 }
 
+#ifdef LIBQ_ON_POSIX
+
+namespace {
+
+int to_madvise( map_access access )
+{
+	switch ( access )
+	{
+		case map_access::sequential:
+			return MADV_SEQUENTIAL;
+		case map_access::random:
+			return MADV_RANDOM;
+		case map_access::normal:
+		default:
+			return MADV_NORMAL;
+	}
+}
+
+/**
+ * A file opened for reading, which is closed when this goes out of scope
+ * (the mapping stays valid after that).
+ */
+struct read_only_file
+{
+	read_only_file( const std::string& path )
+	: fd( ::open( path.c_str( ), O_RDONLY | O_CLOEXEC ) )
+	{
+		if ( fd == -1 )
+			throw_by_errno( errno );
+
+		struct stat st;
+		if ( ::fstat( fd, &st ) == -1 )
+		{
+			auto err = errno;
+			::close( fd );
+			throw_by_errno( err );
+		}
+
+		size = static_cast< std::size_t >( st.st_size );
+	}
+
+	~read_only_file( )
+	{
+		::close( fd );
+	}
+
+	int fd;
+	std::size_t size;
+};
+
+byte_block map_fd(
+	int fd,
+	std::size_t offset,
+	std::size_t length,
+	map_access access,
+	bool prefault
+)
+{
+	if ( length == 0 )
+		return byte_block( );
+
+	// The mapping must start at a page boundary
+	static const std::size_t page_size = ::sysconf( _SC_PAGESIZE );
+	const std::size_t delta = offset % page_size;
+	const std::size_t map_size = length + delta;
+
+	int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if ( prefault )
+		flags |= MAP_POPULATE;
+#endif
+
+	void* data = ::mmap(
+		nullptr,
+		map_size,
+		PROT_READ,
+		flags,
+		fd,
+		static_cast< off_t >( offset - delta ) );
+	if ( data == MAP_FAILED )
+		throw_by_errno( errno );
+
+	auto base = static_cast< std::uint8_t* >( data );
+
+	// The owner unmaps the whole mapping, whichever slice is released last
+	auto owner = std::shared_ptr< const std::uint8_t >(
+		base + delta,
+		[ base, map_size ]( std::uint8_t const* )
+		{
+			::munmap( base, map_size );
+		} );
+
+	// These are only hints, so failures are ignored
+	::madvise( base, map_size, to_madvise( access ) );
+#ifndef MAP_POPULATE
+	if ( prefault )
+		::madvise( base, map_size, MADV_WILLNEED );
+#endif
+
+	return byte_block( length, std::move( owner ) );
+}
+
+} // anonymous namespace
+
+byte_block map_file(
+	const std::string& path,
+	map_access access,
+	bool prefault
+)
+{
+	read_only_file file( path );
+
+	return map_fd( file.fd, 0, file.size, access, prefault );
+}
+
+byte_block map_file(
+	const std::string& path,
+	std::size_t offset,
+	std::size_t length,
+	map_access access,
+	bool prefault
+)
+{
+	read_only_file file( path );
+
+	if ( offset > file.size || length > file.size - offset )
+		Q_THROW( std::out_of_range(
+			"map_file cannot map outside of the file" ) );
+
+	return map_fd( file.fd, offset, length, access, prefault );
+}
+
+#endif // LIBQ_ON_POSIX
+
+byte_chain::byte_chain( )
+: size_( 0 )
+{ }
+
+byte_chain::byte_chain( byte_block block )
+: size_( 0 )
+{
+	append( std::move( block ) );
+}
+
+void byte_chain::append( byte_block block )
+{
+	if ( !block.size( ) )
+		return;
+
+	size_ += block.size( );
+	blocks_.push_back( std::move( block ) );
+}
+
+void byte_chain::append( const byte_chain& chain )
+{
+	if ( &chain == this )
+	{
+		// Inserting a range of a deque into itself is undefined
+		byte_chain copy( chain );
+		append( copy );
+		return;
+	}
+
+	blocks_.insert( blocks_.end( ), chain.begin( ), chain.end( ) );
+	size_ += chain.size( );
+}
+
+void byte_chain::prepend( byte_block block )
+{
+	if ( !block.size( ) )
+		return;
+
+	size_ += block.size( );
+	blocks_.push_front( std::move( block ) );
+}
+
+void byte_chain::prepend( const byte_chain& chain )
+{
+	if ( &chain == this )
+	{
+		// Inserting a range of a deque into itself is undefined
+		byte_chain copy( chain );
+		prepend( copy );
+		return;
+	}
+
+	blocks_.insert( blocks_.begin( ), chain.begin( ), chain.end( ) );
+	size_ += chain.size( );
+}
+
+void byte_chain::advance( std::size_t amount )
+{
+	if ( amount > size_ )
+		Q_THROW( std::out_of_range(
+			"byte_chain::advance cannot advance out of buffer" ) );
+
+	size_ -= amount;
+
+	while ( amount )
+	{
+		auto& front = blocks_.front( );
+
+		if ( amount < front.size( ) )
+		{
+			front.advance( amount );
+			break;
+		}
+
+		amount -= front.size( );
+		blocks_.pop_front( );
+	}
+}
+
+void byte_chain::clear( )
+{
+	blocks_.clear( );
+	size_ = 0;
+}
+
+std::size_t byte_chain::size( ) const
+{
+	return size_;
+}
+
+bool byte_chain::empty( ) const
+{
+	return size_ == 0;
+}
+
+std::size_t byte_chain::blocks( ) const
+{
+	return blocks_.size( );
+}
+
+byte_chain::const_iterator byte_chain::begin( ) const
+{
+	return blocks_.begin( );
+}
+
+byte_chain::const_iterator byte_chain::end( ) const
+{
+	return blocks_.end( );
+}
+
+byte_chain byte_chain::slice( std::size_t offset, std::size_t length ) const
+{
+	if ( offset + length > size( ) )
+		Q_THROW( std::out_of_range(
+			"byte_chain::slice cannot slice out of buffer" ) );
+
+	byte_chain chain;
+
+	for ( auto& block : blocks_ )
+	{
+		if ( !length )
+			break;
+
+		if ( offset >= block.size( ) )
+		{
+			offset -= block.size( );
+			continue;
+		}
+
+		auto part = std::min( length, block.size( ) - offset );
+		chain.append( block.slice( offset, part ) );
+
+		offset = 0;
+		length -= part;
+	}
+
+	return chain;
+}
+
+byte_chain byte_chain::slice( std::size_t offset ) const
+{
+	return slice( offset, size( ) - offset );
+}
+
+void byte_chain::copy_to(
+	std::uint8_t* dest, std::size_t offset, std::size_t length ) const
+{
+	for ( auto& block : slice( offset, length ) )
+	{
+		std::memcpy( dest, block.data( ), block.size( ) );
+		dest += block.size( );
+	}
+}
+
+byte_block byte_chain::flatten( ) const
+{
+	if ( blocks_.empty( ) )
+		return byte_block( );
+
+	if ( blocks_.size( ) == 1 )
+		return blocks_.front( );
+
+	auto data = alloc_shared( size_ );
+
+	copy_to( const_cast< std::uint8_t* >( data.get( ) ), 0, size_ );
+
+	return byte_block( size_, std::move( data ) );
+}
+
+std::string byte_chain::to_string( ) const
+{
+	std::string s;
+	s.reserve( size_ );
+
+	for ( auto& block : blocks_ )
+		s.append(
+			reinterpret_cast< const char* >( block.data( ) ),
+			block.size( ) );
+
+	return s;
+}
+
+#ifdef LIBQ_ON_POSIX
+
+std::size_t byte_chain::to_iovec(
+	struct iovec* vec,
+	std::size_t count,
+	std::size_t first_block
+) const
+{
+	if ( first_block >= blocks_.size( ) )
+		return 0;
+
+	count = std::min( count, blocks_.size( ) - first_block );
+
+	auto iter = blocks_.begin( ) + first_block;
+
+	for ( std::size_t i = 0; i < count; ++i, ++iter )
+	{
+		vec[ i ].iov_base =
+			const_cast< std::uint8_t* >( iter->data( ) );
+		vec[ i ].iov_len = iter->size( );
+	}
+
+	return count;
+}
+
+std::vector< struct iovec > byte_chain::to_iovec( ) const
+{
+	std::vector< struct iovec > vec( blocks_.size( ) );
+
+	to_iovec( vec.data( ), vec.size( ) );
+
+	return vec;
+}
+
+#endif
+
 } // namespace q
@@ -111,6 +111,8 @@ void blocking_dispatcher::start( )
 		{
 			Q_AUTO_UNIQUE_UNLOCK( lock );
 
+			detail::current_queue_scope scope( _task.queue_ );
+
 			_task.task_( );
 
 			continue;
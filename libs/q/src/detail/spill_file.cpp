@@ -0,0 +1,200 @@
+/*
+ * Copyright 2016 Gustaf Räntilä
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <q/detail/spill_file.hpp>
+#include <q/exception.hpp>
+#include <q/pp.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#ifdef LIBQ_ON_POSIX
+#	include <errno.h>
+#	include <stdlib.h>
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
+
+namespace q { namespace detail {
+
+namespace {
+
+// Every record is prefixed by its size
+typedef std::uint64_t record_header_type;
+
+} // anonymous namespace
+
+struct spill_file::segment
+{
+	segment( ) = default;
+	segment( const segment& ) = delete;
+	segment& operator=( const segment& ) = delete;
+
+	~segment( )
+	{
+#ifdef LIBQ_ON_POSIX
+		if ( data )
+			::munmap( data, capacity );
+		if ( fd != -1 )
+			::close( fd );
+#endif
+	}
+
+	std::uint8_t* data = nullptr;
+	std::size_t capacity = 0;
+	std::size_t write_offset = 0;
+	std::size_t read_offset = 0;
+	int fd = -1;
+};
+
+spill_file::spill_file( std::string directory, std::size_t segment_size )
+: directory_( std::move( directory ) )
+, segment_size_( segment_size )
+, size_( 0 )
+{
+#ifndef LIBQ_ON_POSIX
+	Q_THROW( std::logic_error(
+		"spill files are not supported on this platform" ) );
+#endif
+}
+
+spill_file::~spill_file( )
+{ }
+
+std::shared_ptr< spill_file::segment >
+spill_file::make_segment( std::size_t size )
+{
+	auto seg = std::make_shared< segment >( );
+
+#ifdef LIBQ_ON_POSIX
+	std::string path_template = directory_ + "/q-spill-XXXXXX";
+	std::vector< char > path(
+		path_template.begin( ), path_template.end( ) );
+	path.push_back( '\0' );
+
+	seg->fd = ::mkstemp( path.data( ) );
+	if ( seg->fd == -1 )
+		throw_by_errno( errno );
+
+	// Only the mapping refers to the file from now on
+	::unlink( path.data( ) );
+
+	if ( ::ftruncate( seg->fd, static_cast< off_t >( size ) ) == -1 )
+		throw_by_errno( errno );
+
+	void* data = ::mmap(
+		nullptr,
+		size,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED,
+		seg->fd,
+		0 );
+	if ( data == MAP_FAILED )
+		throw_by_errno( errno );
+
+	seg->data = static_cast< std::uint8_t* >( data );
+	seg->capacity = size;
+#else
+	static_cast< void >( size );
+#endif
+
+	return seg;
+}
+
+void spill_file::push( const std::uint8_t* data, std::size_t size )
+{
+	const auto record_size = sizeof( record_header_type ) + size;
+
+	// Drop the segments which have been read, and reuse the last one if
+	// no popped record refers to it anymore
+	while (
+		!segments_.empty( ) &&
+		segments_.front( )->read_offset ==
+			segments_.front( )->write_offset
+	)
+	{
+		if ( segments_.size( ) > 1 )
+			segments_.pop_front( );
+		else if ( segments_.front( ).use_count( ) == 1 )
+		{
+			segments_.front( )->read_offset = 0;
+			segments_.front( )->write_offset = 0;
+			break;
+		}
+		else
+			break;
+	}
+
+	if (
+		segments_.empty( ) ||
+		segments_.back( )->capacity -
+			segments_.back( )->write_offset < record_size
+	)
+		segments_.push_back( make_segment(
+			std::max( segment_size_, record_size ) ) );
+
+	auto& seg = *segments_.back( );
+
+	const record_header_type header = size;
+	std::memcpy(
+		seg.data + seg.write_offset, &header, sizeof( header ) );
+	if ( size )
+		std::memcpy(
+			seg.data + seg.write_offset + sizeof( header ),
+			data,
+			size );
+
+	seg.write_offset += record_size;
+	++size_;
+}
+
+byte_block spill_file::pop( )
+{
+	if ( size_ == 0 )
+		Q_THROW( std::out_of_range( "spill_file is empty" ) );
+
+	// Drop the segments which have been read
+	while ( segments_.front( )->read_offset ==
+		segments_.front( )->write_offset )
+		segments_.pop_front( );
+
+	auto& seg_ptr = segments_.front( );
+	auto& seg = *seg_ptr;
+
+	record_header_type header;
+	std::memcpy( &header, seg.data + seg.read_offset, sizeof( header ) );
+
+	const auto size = static_cast< std::size_t >( header );
+	const std::uint8_t* data =
+		seg.data + seg.read_offset + sizeof( header );
+
+	seg.read_offset += sizeof( header ) + size;
+	--size_;
+
+	// The byte_block keeps the segment mapped
+	return byte_block(
+		size, std::shared_ptr< const std::uint8_t >( seg_ptr, data ) );
+}
+
+void spill_file::clear( )
+{
+	segments_.clear( );
+	size_ = 0;
+}
+
+} } // namespace detail, namespace q
@@ -17,11 +17,379 @@
 #include <q/function.hpp>
 #include <q/exception.hpp>
 
-namespace q { namespace detail {
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace q {
+
+namespace detail {
 
 [[noreturn]] void _throw_bad_function_call_exception( )
 {
 	Q_THROW( q::bad_function_call( ) );
 }
 
-} } // namespace detail, namespace q
+namespace {
+
+// Size classes are powers of two from 32 to 1024 bytes. Chunks are aligned
+// to the (assumed) cache line size, so blocks of 64 bytes or more are cache
+// line aligned, and smaller blocks are aligned to their size.
+constexpr std::size_t min_block_size = 32;
+constexpr std::size_t num_size_classes = 6;
+constexpr std::size_t max_block_size =
+	min_block_size << ( num_size_classes - 1 );
+constexpr std::size_t chunk_size = 64 * 1024;
+constexpr std::size_t chunk_align = LIBQ_ASSUMED_CACHE_LINE_SIZE;
+
+// The number of blocks moved between a thread cache and the central pool at
+// a time, and the number of free blocks a thread cache keeps at most (per
+// size class) before spilling to the central pool.
+constexpr std::size_t batch_size = 32;
+constexpr std::size_t max_cached_blocks = 4 * batch_size;
+
+std::size_t size_class_of( std::size_t size )
+{
+	std::size_t size_class = 0;
+	std::size_t block_size = min_block_size;
+	while ( block_size < size )
+	{
+		block_size <<= 1;
+		++size_class;
+	}
+	return size_class;
+}
+
+constexpr std::size_t block_size_of( std::size_t size_class )
+{
+	return min_block_size << size_class;
+}
+
+struct free_block
+{
+	free_block* next;
+};
+
+struct free_list
+{
+	free_block* head = nullptr;
+	std::size_t size = 0;
+
+	void push( free_block* block )
+	{
+		block->next = head;
+		head = block;
+		++size;
+	}
+
+	free_block* pop( )
+	{
+		free_block* block = head;
+		head = block->next;
+		--size;
+		return block;
+	}
+};
+
+/**
+ * Counters which are only ever written by one thread (allocations after the
+ * thread cache is destructed aren't counted), so they can be
+ * incremented without atomic read-modify-write, but read by any thread.
+ */
+struct pool_counters
+{
+	std::atomic< std::size_t > cache_hits{ 0 };
+	std::atomic< std::size_t > central_hits{ 0 };
+	std::atomic< std::size_t > chunk_allocations{ 0 };
+	std::atomic< std::size_t > oversized{ 0 };
+	std::atomic< std::size_t > deallocations{ 0 };
+
+	static void increment( std::atomic< std::size_t >& counter )
+	{
+		counter.store(
+			counter.load( std::memory_order_relaxed ) + 1,
+			std::memory_order_relaxed );
+	}
+
+	void add_to( function_pool_stats& stats ) const
+	{
+		stats.cache_hits +=
+			cache_hits.load( std::memory_order_relaxed );
+		stats.central_hits +=
+			central_hits.load( std::memory_order_relaxed );
+		stats.chunk_allocations +=
+			chunk_allocations.load( std::memory_order_relaxed );
+		stats.oversized +=
+			oversized.load( std::memory_order_relaxed );
+		stats.deallocations +=
+			deallocations.load( std::memory_order_relaxed );
+	}
+};
+
+class thread_cache;
+
+/**
+ * The central pool holds the free blocks which don't fit in the thread
+ * caches, and carves new blocks from chunks which are never released.
+ */
+class central_pool
+{
+public:
+	static central_pool& get( )
+	{
+		// Intentionally leaked, as function objects may be destructed
+		// during static destruction.
+		static central_pool* pool = new central_pool( );
+		return *pool;
+	}
+
+	/**
+	 * Moves up to @a count free blocks into @a list.
+	 *
+	 * @return true if a new chunk had to be allocated
+	 */
+	bool take( std::size_t size_class, free_list& list, std::size_t count )
+	{
+		auto& central = classes_[ size_class ];
+		std::unique_lock< std::mutex > lock( central.mut );
+
+		bool allocated = false;
+
+		if ( central.blocks.size == 0 )
+		{
+			allocate_chunk( size_class, central.blocks );
+			allocated = true;
+		}
+
+		while ( count-- > 0 && central.blocks.size > 0 )
+			list.push( central.blocks.pop( ) );
+
+		return allocated;
+	}
+
+	/**
+	 * Moves @a count blocks from @a list (or all if @a count is 0).
+	 */
+	void give( std::size_t size_class, free_list& list, std::size_t count )
+	{
+		auto& central = classes_[ size_class ];
+		std::unique_lock< std::mutex > lock( central.mut );
+
+		if ( count == 0 )
+			count = list.size;
+
+		while ( count-- > 0 && list.size > 0 )
+			central.blocks.push( list.pop( ) );
+	}
+
+	void add_thread( thread_cache* cache )
+	{
+		std::unique_lock< std::mutex > lock( threads_mut_ );
+		threads_.push_back( cache );
+	}
+
+	void remove_thread( thread_cache* cache, const pool_counters& counters )
+	{
+		std::unique_lock< std::mutex > lock( threads_mut_ );
+		threads_.erase( std::find(
+			threads_.begin( ), threads_.end( ), cache ) );
+		counters.add_to( retired_stats_ );
+	}
+
+	function_pool_stats stats( );
+
+private:
+	struct size_class_pool
+	{
+		std::mutex mut;
+		free_list blocks;
+	};
+
+	void allocate_chunk( std::size_t size_class, free_list& list )
+	{
+		const std::size_t block_size = block_size_of( size_class );
+
+		char* chunk = static_cast< char* >(
+			::operator new( chunk_size + chunk_align ) );
+		const auto misalignment =
+			reinterpret_cast< std::uintptr_t >( chunk )
+			% chunk_align;
+		if ( misalignment )
+			chunk += chunk_align - misalignment;
+
+		for ( std::size_t offset = 0;
+			offset + block_size <= chunk_size;
+			offset += block_size )
+		{
+			list.push( reinterpret_cast< free_block* >(
+				chunk + offset ) );
+		}
+	}
+
+	size_class_pool classes_[ num_size_classes ];
+
+	std::mutex threads_mut_;
+	std::vector< thread_cache* > threads_;
+	function_pool_stats retired_stats_;
+};
+
+class thread_cache
+{
+public:
+	thread_cache( )
+	{
+		central_pool::get( ).add_thread( this );
+	}
+
+	~thread_cache( )
+	{
+		auto& central = central_pool::get( );
+
+		for ( std::size_t i = 0; i < num_size_classes; ++i )
+			central.give( i, free_[ i ], 0 );
+
+		central.remove_thread( this, counters );
+	}
+
+	void* allocate( std::size_t size_class )
+	{
+		auto& list = free_[ size_class ];
+
+		if ( list.size > 0 )
+		{
+			pool_counters::increment( counters.cache_hits );
+			return list.pop( );
+		}
+
+		if ( central_pool::get( ).take( size_class, list, batch_size ) )
+			pool_counters::increment( counters.chunk_allocations );
+		else
+			pool_counters::increment( counters.central_hits );
+
+		return list.pop( );
+	}
+
+	void deallocate( void* ptr, std::size_t size_class )
+	{
+		auto& list = free_[ size_class ];
+
+		pool_counters::increment( counters.deallocations );
+		list.push( static_cast< free_block* >( ptr ) );
+
+		if ( list.size > max_cached_blocks )
+			central_pool::get( ).give(
+				size_class, list, batch_size );
+	}
+
+	pool_counters counters;
+
+private:
+	free_list free_[ num_size_classes ];
+};
+
+function_pool_stats central_pool::stats( )
+{
+	std::unique_lock< std::mutex > lock( threads_mut_ );
+
+	function_pool_stats stats = retired_stats_;
+
+	for ( auto cache : threads_ )
+		cache->counters.add_to( stats );
+
+	return stats;
+}
+
+enum class cache_state
+{
+	uninitialized,
+	alive,
+	destructed
+};
+
+// A trivially destructible flag, which can be read even after the
+// thread_cache of this thread has been destructed (e.g. when function
+// objects are destructed by other thread-local destructors).
+thread_local cache_state this_thread_cache_state = cache_state::uninitialized;
+
+thread_cache* get_thread_cache( )
+{
+	if ( this_thread_cache_state == cache_state::destructed )
+		return nullptr;
+
+	struct cache_holder
+	{
+		cache_holder( )
+		{
+			this_thread_cache_state = cache_state::alive;
+		}
+
+		~cache_holder( )
+		{
+			this_thread_cache_state = cache_state::destructed;
+		}
+
+		thread_cache cache;
+	};
+
+	static thread_local cache_holder holder;
+	return &holder.cache;
+}
+
+} // anonymous namespace
+
+void* function_pool_allocate( std::size_t size )
+{
+	auto cache = get_thread_cache( );
+
+	if ( size > max_block_size )
+	{
+		if ( cache )
+			pool_counters::increment( cache->counters.oversized );
+		return ::operator new( size );
+	}
+
+	const auto size_class = size_class_of( size );
+
+	if ( cache )
+		return cache->allocate( size_class );
+
+	// This thread's cache is gone, go straight to the central pool
+	free_list list;
+	central_pool::get( ).take( size_class, list, 1 );
+	return list.pop( );
+}
+
+void function_pool_deallocate( void* ptr, std::size_t size ) noexcept
+{
+	if ( !ptr )
+		return;
+
+	if ( size > max_block_size )
+	{
+		::operator delete( ptr );
+		return;
+	}
+
+	const auto size_class = size_class_of( size );
+
+	auto cache = get_thread_cache( );
+	if ( cache )
+	{
+		cache->deallocate( ptr, size_class );
+		return;
+	}
+
+	free_list list;
+	list.push( static_cast< free_block* >( ptr ) );
+	central_pool::get( ).give( size_class, list, 1 );
+}
+
+} // namespace detail
+
+function_pool_stats get_function_pool_stats( )
+{
+	return detail::central_pool::get( ).stats( );
+}
+
+} // namespace q
@@ -23,6 +23,18 @@
 
 namespace q {
 
+namespace {
+
+struct current_queue_state
+{
+	const queue* queue_;
+	std::size_t inline_calls_;
+};
+
+thread_local current_queue_state this_thread_queue = { nullptr, 0 };
+
+} // anonymous namespace
+
 // TODO: Consider using a semaphore instead, and then preferably a non-locking
 // queue altogether. The only thing necessary is that two push-calls from the
 // same thread must follow order.
@@ -126,6 +138,7 @@ timer_task queue::pop( )
 		return timer_task( );
 
 	timer_task task = std::move( pimpl_->queue_.front( ) );
+	task.queue_ = this;
 
 	pimpl_->queue_.pop( );
 
@@ -137,4 +150,37 @@ std::size_t queue::parallelism( ) const
 	return pimpl_->parallelism_;
 }
 
+bool queue::is_current( ) const
+{
+	return this_thread_queue.queue_ == this;
+}
+
+namespace detail {
+
+current_queue_scope::current_queue_scope( const queue* queue )
+: previous_queue_( this_thread_queue.queue_ )
+, previous_inline_calls_( this_thread_queue.inline_calls_ )
+{
+	this_thread_queue.queue_ = queue;
+	this_thread_queue.inline_calls_ = 0;
+}
+
+current_queue_scope::~current_queue_scope( )
+{
+	this_thread_queue.queue_ = previous_queue_;
+	this_thread_queue.inline_calls_ = previous_inline_calls_;
+}
+
+bool take_inline_budget( std::size_t budget )
+{
+	if ( this_thread_queue.inline_calls_ >= budget )
+		return false;
+
+	++this_thread_queue.inline_calls_;
+
+	return true;
+}
+
+} // namespace detail
+
 } // namespace q
@@ -72,7 +72,7 @@ public:
 		return ret;
 	}
 
-	T find_first( bool( cond )( const queue_ptr& queue ) )
+	T find_first( q::function_ref< bool( const queue_ptr& ) > cond )
 	{
 		Q_AUTO_UNIQUE_LOCK( *mutex_ );
 
@@ -204,6 +204,9 @@ promise< > threadpool::start( )
 				{
 					Q_AUTO_UNIQUE_UNLOCK( lock );
 
+					detail::current_queue_scope scope(
+						_task.queue_ );
+
 					invoker( std::move( _task.task_ ) );
 				}
 
@@ -0,0 +1,3 @@
+#define QTEST_ON_GTEST
+#include <q-test/q-test.hpp>
+#include <q-test/expect.hpp>
@@ -0,0 +1,95 @@
+
+#include <q/function.hpp>
+
+#include "core.hpp"
+
+namespace {
+
+int call_count;
+
+template< std::size_t Size, bool Copyable = true >
+struct sized_function
+{
+	sized_function( )
+	: data_( )
+	{ }
+
+	sized_function( sized_function&& ) = default;
+	sized_function( const sized_function& ) = default;
+
+	void operator( )( ) const { ++call_count; }
+
+	char data_[ Size ];
+};
+
+template< std::size_t Size >
+struct sized_function< Size, false >
+: sized_function< Size >
+{
+	sized_function( ) = default;
+	sized_function( sized_function&& ) = default;
+	sized_function( const sized_function& ) = delete;
+};
+
+void plain( ) { ++call_count; }
+
+} // anonymous namespace
+
+TEST( function_stats, histograms_by_storage )
+{
+	q::reset_function_stats( );
+
+	{
+		q::function< void( ) > f1( sized_function< 24 >{ } );
+		q::function< void( ) > f2( sized_function< 24 >{ } );
+		q::function< void( ) > f3( sized_function< 40 >{ } );
+		q::unique_function< void( ) > uf( sized_function< 512 >{ } );
+		q::function< void( ) > fp( &plain );
+		q::function< void( ) > nc( sized_function< 32, false >{ } );
+
+		// Copies aren't new function objects
+		q::function< void( ) > f1_copy( f1 );
+	}
+
+	auto stats = q::get_function_stats( );
+
+	EXPECT_EQ( 2U, stats.inlined.size( ) );
+	EXPECT_EQ( 2U, stats.inlined[ 24 ] );
+	EXPECT_EQ( 1U, stats.inlined[ 40 ] );
+
+	EXPECT_EQ( 1U, stats.unique_ptr.size( ) );
+	EXPECT_EQ( 1U, stats.unique_ptr[ 512 ] );
+
+	// Non-copyable function objects aren't inlined in shared functions
+	EXPECT_EQ( 1U, stats.shared_ptr.size( ) );
+	EXPECT_EQ( 1U, stats.shared_ptr[ 32 ] );
+
+	EXPECT_EQ( 1U, q::function_stats::count( stats.plain ) );
+	EXPECT_EQ( 1U, stats.plain[ sizeof( &plain ) ] );
+
+	EXPECT_EQ( 5U, stats.shared_functions );
+	EXPECT_EQ( 1U, stats.unique_functions );
+}
+
+TEST( function_stats, reset )
+{
+	q::reset_function_stats( );
+
+	{
+		q::function< void( ) > f( sized_function< 24 >{ } );
+	}
+
+	auto inlined = q::get_function_stats( ).inlined;
+	EXPECT_EQ( 1U, q::function_stats::count( inlined ) );
+
+	q::reset_function_stats( );
+
+	auto stats = q::get_function_stats( );
+
+	EXPECT_TRUE( stats.plain.empty( ) );
+	EXPECT_TRUE( stats.inlined.empty( ) );
+	EXPECT_TRUE( stats.unique_ptr.empty( ) );
+	EXPECT_TRUE( stats.shared_ptr.empty( ) );
+	EXPECT_EQ( 0U, stats.shared_functions );
+	EXPECT_EQ( 0U, stats.unique_functions );
+}
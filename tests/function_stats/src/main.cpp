@@ -0,0 +1,2 @@
+#include "core.hpp"
+#include <q-test/main.hpp>
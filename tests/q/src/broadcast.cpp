@@ -0,0 +1,201 @@
+
+#include <q/broadcast.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( broadcast );
+
+TEST_F( broadcast, shared_values )
+{
+	q::broadcast< std::string > bc( queue, 10 );
+
+	auto sub_a = bc.subscribe( );
+	auto sub_b = bc.subscribe( );
+
+	EXPECT_TRUE( bc.write( "hello" ) );
+	EXPECT_TRUE( bc.write( "world" ) );
+
+	q::broadcast< std::string >::handle_type a;
+	q::broadcast< std::string >::handle_type b;
+
+	EXPECT_TRUE( sub_a.try_read( a ) );
+	EXPECT_TRUE( sub_b.try_read( b ) );
+
+	// The same value, not copies
+	EXPECT_EQ( a.get( ), b.get( ) );
+	EXPECT_EQ( "hello", *a );
+
+	EXPECT_TRUE( sub_a.try_read( a ) );
+	EXPECT_EQ( "world", *a );
+	EXPECT_FALSE( sub_a.try_read( a ) );
+	EXPECT_EQ( 0U, sub_a.lag( ) );
+	EXPECT_EQ( 1U, sub_b.lag( ) );
+}
+
+TEST_F( broadcast, only_values_after_subscribing )
+{
+	q::broadcast< int > bc( queue, 10 );
+
+	EXPECT_TRUE( bc.write( 1 ) );
+
+	auto sub = bc.subscribe( );
+
+	EXPECT_TRUE( bc.write( 2 ) );
+
+	q::broadcast< int >::handle_type value;
+	EXPECT_TRUE( sub.try_read( value ) );
+	EXPECT_EQ( 2, *value );
+	EXPECT_FALSE( sub.try_read( value ) );
+}
+
+TEST_F( broadcast, read_waiting )
+{
+	q::broadcast< int, std::string > bc( queue, 10 );
+
+	auto sub = bc.subscribe( );
+
+	auto promise = sub.read( )
+	.then( EXPECT_CALL_WRAPPER(
+		[ ]( std::shared_ptr< const std::tuple< int, std::string > > v )
+		{
+			EXPECT_EQ( 17, std::get< 0 >( *v ) );
+			EXPECT_EQ( "hello", std::get< 1 >( *v ) );
+		}
+	) );
+
+	EXPECT_TRUE( bc.write( 17, "hello" ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( broadcast, consume_until_closed )
+{
+	q::broadcast< int > bc( queue, 10 );
+
+	auto sub_a = bc.subscribe( );
+	auto sub_b = bc.subscribe( );
+
+	std::vector< int > values_a;
+	std::vector< int > values_b;
+
+	auto consumed_a = sub_a.consume( [ & ]( const int& i )
+	{
+		values_a.push_back( i );
+	} );
+	auto consumed_b = sub_b.consume( [ & ]( const int& i )
+	{
+		values_b.push_back( i );
+		return q::with( queue );
+	} );
+
+	run(
+		q::with( queue )
+		.then( [ bc ]( ) mutable
+		{
+			for ( int i = 1; i <= 3; ++i )
+				EXPECT_TRUE( bc.write( i ) );
+			bc.close( );
+		} )
+		.then( [ & ]( )
+		{
+			return q::all(
+				std::move( consumed_a ),
+				std::move( consumed_b ) );
+		} )
+		.then( [ & ]( )
+		{
+			std::vector< int > expected{ 1, 2, 3 };
+			EXPECT_EQ( expected, values_a );
+			EXPECT_EQ( expected, values_b );
+		} )
+	);
+}
+
+TEST_F( broadcast, block_policy_pauses_writer )
+{
+	q::broadcast< int > bc( queue, 2 );
+
+	auto fast = bc.subscribe( 100, q::broadcast_policy::block );
+	auto slow = bc.subscribe( );
+
+	EXPECT_TRUE( bc.write( 1 ) );
+	EXPECT_TRUE( bc.should_write( ) );
+	EXPECT_TRUE( bc.write( 2 ) );
+	EXPECT_FALSE( bc.should_write( ) );
+
+	q::broadcast< int >::handle_type value;
+	EXPECT_TRUE( slow.try_read( value ) );
+	EXPECT_TRUE( slow.try_read( value ) );
+	EXPECT_TRUE( bc.should_write( ) );
+}
+
+TEST_F( broadcast, drop_oldest_policy )
+{
+	q::broadcast< int > bc( queue, 2, q::broadcast_policy::drop_oldest );
+
+	auto sub = bc.subscribe( );
+
+	for ( int i = 1; i <= 5; ++i )
+		EXPECT_TRUE( bc.write( i ) );
+
+	EXPECT_TRUE( bc.should_write( ) );
+	EXPECT_EQ( 3U, sub.dropped( ) );
+
+	q::broadcast< int >::handle_type value;
+	EXPECT_TRUE( sub.try_read( value ) );
+	EXPECT_EQ( 4, *value );
+	EXPECT_TRUE( sub.try_read( value ) );
+	EXPECT_EQ( 5, *value );
+	EXPECT_FALSE( sub.try_read( value ) );
+}
+
+TEST_F( broadcast, disconnect_policy )
+{
+	q::broadcast< int > bc( queue, 2, q::broadcast_policy::disconnect );
+
+	auto slow = bc.subscribe( );
+	auto fast = bc.subscribe( 10, q::broadcast_policy::disconnect );
+
+	for ( int i = 1; i <= 3; ++i )
+		EXPECT_TRUE( bc.write( i ) );
+
+	run(
+		slow.read( )
+		.then( EXPECT_NO_CALL_WRAPPER(
+			[ ]( q::broadcast< int >::handle_type ) { }
+		) )
+		.fail( EXPECT_CALL_WRAPPER(
+			[ ]( const q::broadcast_lagged_exception& ) { }
+		) )
+		.then( [ fast ]( ) mutable
+		{
+			return fast.read( );
+		} )
+		.then( EXPECT_CALL_WRAPPER(
+			[ ]( q::broadcast< int >::handle_type value )
+			{
+				EXPECT_EQ( 1, *value );
+			}
+		) )
+	);
+}
+
+TEST_F( broadcast, close_with_error )
+{
+	q::broadcast< int > bc( queue, 2 );
+
+	auto sub = bc.subscribe( );
+
+	EXPECT_TRUE( bc.write( 1 ) );
+	bc.close( Error( ) );
+	EXPECT_FALSE( bc.write( 2 ) );
+
+	run(
+		sub.consume( EXPECT_CALL_WRAPPER( [ ]( const int& i )
+		{
+			EXPECT_EQ( 1, i );
+		} ) )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+}
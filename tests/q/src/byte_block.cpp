@@ -5,6 +5,11 @@
 
 #include <q/block.hpp>
 
+#ifdef LIBQ_ON_POSIX
+#	include <stdlib.h>
+#	include <unistd.h>
+#endif
+
 
 
 
@@ -98,3 +103,97 @@ TEST( byte_block, slice_ascii )
 
 	EXPECT_EQ( b2_slice.to_string( ), "foo\r\nbar" );
 }
+
+TEST( byte_block, pooled_allocation )
+{
+	// Warm up this thread's free list
+	{
+		q::byte_block b( std::string( 100, 'x' ) );
+	}
+
+	auto before = q::get_byte_block_pool_stats( );
+
+	{
+		q::byte_block b( std::string( 100, 'y' ) );
+		auto b_slice = b.slice( 10, 5 );
+
+		EXPECT_EQ( b_slice.to_string( ), "yyyyy" );
+	}
+
+	auto after = q::get_byte_block_pool_stats( );
+
+	EXPECT_EQ( before.hits + 1, after.hits );
+	EXPECT_EQ( before.misses, after.misses );
+	EXPECT_EQ( before.recycled + 1, after.recycled );
+	EXPECT_LT( 0.0, after.hit_rate( ) );
+}
+
+TEST( byte_block, oversized_allocation )
+{
+	auto before = q::get_byte_block_pool_stats( );
+
+	q::byte_block b( std::string( 1024 * 1024, 'z' ) );
+
+	auto after = q::get_byte_block_pool_stats( );
+
+	EXPECT_EQ( b.size( ), std::size_t( 1024 * 1024 ) );
+	EXPECT_EQ( b.data( )[ 1024 ], 'z' );
+	EXPECT_EQ( before.oversized + 1, after.oversized );
+}
+
+#ifdef LIBQ_ON_POSIX
+
+namespace {
+
+std::string write_temp_file( const std::string& content )
+{
+	char path[ ] = "/tmp/q-byte-block-XXXXXX";
+	int fd = ::mkstemp( path );
+	EXPECT_NE( -1, fd );
+
+	EXPECT_EQ(
+		static_cast< ssize_t >( content.size( ) ),
+		::write( fd, content.data( ), content.size( ) ) );
+	::close( fd );
+
+	return path;
+}
+
+} // anonymous namespace
+
+TEST( byte_block, map_file )
+{
+	std::string content;
+	for ( int i = 0; i < 10000; ++i )
+		content += static_cast< char >( 'a' + i % 26 );
+
+	auto path = write_temp_file( content );
+
+	q::byte_block slice;
+
+	{
+		auto b = q::map_file( path, q::map_access::sequential, true );
+
+		EXPECT_EQ( b.size( ), content.size( ) );
+		EXPECT_EQ( b.to_string( ), content );
+
+		slice = b.slice( 5000, 10 );
+	}
+
+	// The mapping is kept alive by the slice
+	EXPECT_EQ( slice.to_string( ), content.substr( 5000, 10 ) );
+
+	// Not at a page boundary
+	auto range = q::map_file( path, 4099, 100, q::map_access::random );
+
+	EXPECT_EQ( range.to_string( ), content.substr( 4099, 100 ) );
+
+	EXPECT_EQ( q::map_file( path, 10000, 0 ).size( ), std::size_t( 0 ) );
+	EXPECT_THROW( q::map_file( path, 9990, 11 ), std::out_of_range );
+
+	::unlink( path.c_str( ) );
+
+	EXPECT_THROW( q::map_file( path ), q::errno_exception );
+}
+
+#endif
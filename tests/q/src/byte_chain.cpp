@@ -0,0 +1,146 @@
+
+#include "core.hpp"
+
+#include <q/block.hpp>
+
+#include <cstring>
+
+TEST( byte_chain, empty )
+{
+	q::byte_chain c;
+
+	EXPECT_TRUE( c.empty( ) );
+	EXPECT_EQ( std::size_t( 0 ), c.size( ) );
+	EXPECT_EQ( std::size_t( 0 ), c.blocks( ) );
+	EXPECT_EQ( std::size_t( 0 ), c.flatten( ).size( ) );
+	EXPECT_EQ( "", c.to_string( ) );
+}
+
+TEST( byte_chain, append_prepend )
+{
+	q::byte_chain c( q::byte_block( "world" ) );
+
+	c.append( q::byte_block( "!" ) );
+	c.append( q::byte_block( ) );
+	c.prepend( q::byte_block( "hello " ) );
+
+	EXPECT_EQ( std::size_t( 12 ), c.size( ) );
+	EXPECT_EQ( std::size_t( 3 ), c.blocks( ) );
+	EXPECT_EQ( "hello world!", c.to_string( ) );
+
+	q::byte_chain header( q::byte_block( "[" ) );
+	header.append( q::byte_block( "2]" ) );
+
+	c.prepend( header );
+	c.append( header );
+
+	EXPECT_EQ( "[2]hello world![2]", c.to_string( ) );
+	EXPECT_EQ( std::size_t( 7 ), c.blocks( ) );
+}
+
+TEST( byte_chain, append_prepend_self )
+{
+	q::byte_chain c( q::byte_block( "ab" ) );
+	c.append( q::byte_block( "c" ) );
+
+	c.append( c );
+
+	EXPECT_EQ( "abcabc", c.to_string( ) );
+	EXPECT_EQ( std::size_t( 6 ), c.size( ) );
+	EXPECT_EQ( std::size_t( 4 ), c.blocks( ) );
+
+	c.prepend( c );
+
+	EXPECT_EQ( "abcabcabcabc", c.to_string( ) );
+	EXPECT_EQ( std::size_t( 12 ), c.size( ) );
+	EXPECT_EQ( std::size_t( 8 ), c.blocks( ) );
+}
+
+TEST( byte_chain, slice_across_blocks )
+{
+	q::byte_chain c;
+	c.append( q::byte_block( "abc" ) );
+	c.append( q::byte_block( "def" ) );
+	c.append( q::byte_block( "ghi" ) );
+
+	auto s = c.slice( 2, 5 );
+
+	EXPECT_EQ( std::size_t( 5 ), s.size( ) );
+	EXPECT_EQ( std::size_t( 3 ), s.blocks( ) );
+	EXPECT_EQ( "cdefg", s.to_string( ) );
+
+	// Slices share the data of the original blocks
+	EXPECT_EQ( c.begin( )->data( ) + 2, s.begin( )->data( ) );
+
+	EXPECT_EQ( "def", c.slice( 3, 3 ).to_string( ) );
+	EXPECT_EQ( std::size_t( 1 ), c.slice( 3, 3 ).blocks( ) );
+	EXPECT_EQ( "hi", c.slice( 7 ).to_string( ) );
+	EXPECT_EQ( std::size_t( 0 ), c.slice( 9 ).size( ) );
+
+	EXPECT_THROW( c.slice( 5, 5 ), std::out_of_range );
+}
+
+TEST( byte_chain, advance )
+{
+	q::byte_chain c;
+	c.append( q::byte_block( "abc" ) );
+	c.append( q::byte_block( "def" ) );
+
+	c.advance( 4 );
+
+	EXPECT_EQ( "ef", c.to_string( ) );
+	EXPECT_EQ( std::size_t( 1 ), c.blocks( ) );
+
+	c.advance( 2 );
+
+	EXPECT_TRUE( c.empty( ) );
+	EXPECT_THROW( c.advance( 1 ), std::out_of_range );
+}
+
+TEST( byte_chain, flatten )
+{
+	q::byte_block single( "single" );
+	q::byte_chain c( single );
+
+	// A single block is returned as is, without copying
+	EXPECT_EQ( single.data( ), c.flatten( ).data( ) );
+
+	c.append( q::byte_block( " and more" ) );
+
+	auto flat = c.flatten( );
+
+	EXPECT_EQ( std::size_t( 15 ), flat.size( ) );
+	EXPECT_EQ( "single and more", flat.to_string( ) );
+
+	std::uint8_t buf[ 6 ];
+	c.copy_to( buf, 4, 6 );
+
+	EXPECT_EQ( 0, std::memcmp( buf, "le and", 6 ) );
+}
+
+#ifdef LIBQ_ON_POSIX
+
+TEST( byte_chain, to_iovec )
+{
+	q::byte_chain c;
+	c.append( q::byte_block( "abc" ) );
+	c.append( q::byte_block( "de" ) );
+	c.append( q::byte_block( "f" ) );
+
+	auto vec = c.to_iovec( );
+
+	ASSERT_EQ( std::size_t( 3 ), vec.size( ) );
+	EXPECT_EQ( std::size_t( 3 ), vec[ 0 ].iov_len );
+	EXPECT_EQ( std::size_t( 2 ), vec[ 1 ].iov_len );
+	EXPECT_EQ( std::size_t( 1 ), vec[ 2 ].iov_len );
+	EXPECT_EQ( c.begin( )->data( ), vec[ 0 ].iov_base );
+
+	struct iovec partial[ 4 ];
+
+	EXPECT_EQ( std::size_t( 2 ), c.to_iovec( partial, 4, 1 ) );
+	EXPECT_EQ( std::size_t( 2 ), partial[ 0 ].iov_len );
+	EXPECT_EQ( std::size_t( 1 ), c.to_iovec( partial, 1 ) );
+	EXPECT_EQ( std::size_t( 0 ), c.to_iovec( partial, 4, 3 ) );
+}
+
+#endif
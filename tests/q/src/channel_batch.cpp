@@ -0,0 +1,80 @@
+
+#include <q/channel.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( channel_batch );
+
+TEST_F( channel_batch, write_many_read_up_to )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	std::vector< int > values{ 1, 2, 3 };
+	EXPECT_TRUE( writable.write_many( values ) );
+	EXPECT_TRUE( writable.should_write( ) );
+	EXPECT_TRUE( writable.write_many( std::vector< std::tuple< int > >{
+		std::make_tuple( 4 ), std::make_tuple( 5 ), std::make_tuple( 6 )
+	} ) );
+	EXPECT_FALSE( writable.should_write( ) );
+
+	auto promise = readable.read_up_to( 4 )
+	.then( EXPECT_CALL_WRAPPER(
+		[ &readable ]( std::vector< std::tuple< int > >&& batch )
+		{
+			EXPECT_EQ( 4U, batch.size( ) );
+			for ( int i = 0; i < 4; ++i )
+				EXPECT_EQ( i + 1, std::get< 0 >( batch[ i ] ) );
+
+			return readable.read_up_to( 4 );
+		}
+	) )
+	.then( EXPECT_CALL_WRAPPER(
+		[ &readable ]( std::vector< std::tuple< int > >&& batch )
+		{
+			EXPECT_EQ( 2U, batch.size( ) );
+			EXPECT_EQ( 5, std::get< 0 >( batch[ 0 ] ) );
+			EXPECT_EQ( 6, std::get< 0 >( batch[ 1 ] ) );
+
+			return readable.read_up_to( 4 );
+		}
+	) )
+	.then( EXPECT_NO_CALL_WRAPPER(
+		[ ]( std::vector< std::tuple< int > >&& ) { }
+	) )
+	.fail( EXPECT_CALL_WRAPPER(
+		[ ]( q::channel_closed_exception& ) { }
+	) );
+
+	writable.close( );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( channel_batch, read_up_to_waiting )
+{
+	q::channel< int, std::string > ch(
+		queue, 5, q::channel_storage( q::channel_storage::mpmc_ring ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	auto promise = readable.read_up_to( 10 )
+	.then( EXPECT_CALL_WRAPPER(
+		[ ]( std::vector< std::tuple< int, std::string > >&& batch )
+		{
+			ASSERT_EQ( 1U, batch.size( ) );
+			EXPECT_EQ( 17, std::get< 0 >( batch[ 0 ] ) );
+			EXPECT_EQ( "hello", std::get< 1 >( batch[ 0 ] ) );
+		}
+	) );
+
+	std::vector< std::tuple< int, std::string > > values{
+		std::make_tuple( 17, std::string( "hello" ) )
+	};
+	EXPECT_TRUE( writable.write_many( std::move( values ) ) );
+
+	run( std::move( promise ) );
+}
@@ -0,0 +1,148 @@
+
+#include <q/channel.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( channel_consume );
+
+TEST_F( channel_consume, values_written_later )
+{
+	q::channel< int > ch( queue, 3 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	std::vector< int > values;
+
+	auto consumed = readable.consume( [ & ]( int i )
+	{
+		values.push_back( i );
+	} );
+
+	run(
+		q::with( queue )
+		.then( [ writable, &consumed ]( ) mutable
+		{
+			for ( int i = 0; i < 10; ++i )
+				EXPECT_TRUE( writable.write( i ) );
+			writable.close( );
+
+			return std::move( consumed );
+		} )
+		.then( [ & ]( )
+		{
+			EXPECT_EQ( std::size_t( 10 ), values.size( ) );
+			for ( int i = 0; i < 10; ++i )
+				EXPECT_EQ( i, values[ i ] );
+		} )
+	);
+}
+
+TEST_F( channel_consume, concurrent_window )
+{
+	q::channel< int > ch(
+		queue, 20, q::channel_storage( q::channel_storage::mpmc_ring ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	auto queue = this->queue;
+	std::size_t active = 0;
+	std::size_t max_active = 0;
+	std::size_t sum = 0;
+
+	for ( int i = 1; i <= 20; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	auto on_value = [ & ]( int i ) -> q::promise< >
+	{
+		sum += i;
+		max_active = std::max( max_active, ++active );
+
+		return q::with( queue )
+		.delay( std::chrono::milliseconds( 1 ) )
+		.then( [ & ]( )
+		{
+			--active;
+		} );
+	};
+
+	run(
+		readable.consume( on_value, { q::concurrency( 3 ) } )
+		.then( [ & ]( )
+		{
+			EXPECT_EQ( std::size_t( 210 ), sum );
+			EXPECT_EQ( std::size_t( 0 ), active );
+			EXPECT_LE( max_active, std::size_t( 3 ) );
+			EXPECT_GT( max_active, std::size_t( 1 ) );
+		} )
+	);
+}
+
+TEST_F( channel_consume, captureless_function )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	EXPECT_TRUE( writable.write( 1 ) );
+	EXPECT_TRUE( writable.write( 2 ) );
+	writable.close( );
+
+	run( readable.consume( [ ]( int i )
+	{
+		EXPECT_GT( i, 0 );
+	} ) );
+}
+
+TEST_F( channel_consume, function_error_closes_channel )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	EXPECT_TRUE( writable.write( 1 ) );
+	EXPECT_TRUE( writable.write( 2 ) );
+	EXPECT_TRUE( writable.write( 3 ) );
+
+	auto on_value = [ ]( int i )
+	{
+		if ( i == 2 )
+			Q_THROW( Error( ) );
+	};
+
+	run(
+		readable.consume( EXPECT_N_CALLS_WRAPPER( 2, on_value ) )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ){ } ) )
+		.then( [ writable ]( ) mutable
+		{
+			EXPECT_TRUE( writable.is_closed( ) );
+		} )
+	);
+}
+
+TEST_F( channel_consume, channel_error )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	EXPECT_TRUE( writable.write( 1 ) );
+	writable.close( Error( ) );
+
+	auto on_value = [ ]( int ) { };
+
+	run(
+		readable.consume(
+			EXPECT_N_CALLS_WRAPPER( 1, on_value ),
+			{ q::concurrency( 2 ) }
+		)
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ){ } ) )
+	);
+}
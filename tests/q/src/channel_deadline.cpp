@@ -0,0 +1,142 @@
+
+#include <q/channel.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( channel_deadline );
+
+namespace {
+
+q::timer::point_type in_ms( int ms )
+{
+	return q::timer::point_type::clock::now( ) +
+		std::chrono::milliseconds( ms );
+}
+
+} // anonymous namespace
+
+TEST_F( channel_deadline, buffered_value )
+{
+	q::channel< int, std::string > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	EXPECT_TRUE( writable.write( 17, "hello" ) );
+
+	run(
+		readable.read( in_ms( 1000 ) )
+		.then( EXPECT_CALL_WRAPPER(
+			[ ]( bool read, int i, std::string s )
+			{
+				EXPECT_TRUE( read );
+				EXPECT_EQ( 17, i );
+				EXPECT_EQ( "hello", s );
+			}
+		) )
+	);
+}
+
+TEST_F( channel_deadline, value_before_deadline )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	auto promise = readable.read( in_ms( 1000 ) )
+	.then( EXPECT_CALL_WRAPPER( [ ]( bool read, int i )
+	{
+		EXPECT_TRUE( read );
+		EXPECT_EQ( 17, i );
+	} ) );
+
+	EXPECT_TRUE( writable.write( 17 ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( channel_deadline, timeout_leaves_later_values )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	run(
+		readable.read( in_ms( 1 ) )
+		.then( EXPECT_CALL_WRAPPER( [ ]( bool read, int i )
+		{
+			EXPECT_FALSE( read );
+			EXPECT_EQ( 0, i );
+		} ) )
+		.then( [ writable ]( ) mutable
+		{
+			// The timed out waiter is gone, so this is buffered
+			EXPECT_TRUE( writable.write( 4711 ) );
+		} )
+		.then( [ readable ]( ) mutable
+		{
+			std::tuple< int > value;
+			EXPECT_TRUE( readable.try_read( value ) );
+			EXPECT_EQ( 4711, std::get< 0 >( value ) );
+		} )
+	);
+}
+
+TEST_F( channel_deadline, closed_before_deadline )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	auto promise = readable.read( in_ms( 1000 ) )
+	.then( EXPECT_NO_CALL_WRAPPER( [ ]( bool, int ) { } ) )
+	.fail( EXPECT_CALL_WRAPPER(
+		[ ]( const q::channel_closed_exception& ) { }
+	) );
+
+	writable.close( );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( channel_deadline, fast_read_timeout )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	run(
+		readable.read(
+			EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ),
+			EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ),
+			EXPECT_CALL_WRAPPER( [ ]( ) { } ),
+			in_ms( 1 )
+		)
+		.then( EXPECT_CALL_WRAPPER( [ ]( bool read )
+		{
+			EXPECT_FALSE( read );
+		} ) )
+		.then( [ this, readable, writable ]( ) mutable
+		{
+			EXPECT_TRUE( writable.write( 5 ) );
+
+			return readable.read(
+				EXPECT_CALL_WRAPPER( [ ]( int i )
+				{
+					EXPECT_EQ( 5, i );
+				} ),
+				EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ),
+				EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ),
+				in_ms( 1000 )
+			);
+		} )
+		.then( EXPECT_CALL_WRAPPER( [ ]( bool read )
+		{
+			EXPECT_TRUE( read );
+		} ) )
+	);
+}
@@ -0,0 +1,140 @@
+
+#include <q/channel.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( channel_inline );
+
+TEST_F( channel_inline, current_queue )
+{
+	EXPECT_FALSE( queue->is_current( ) );
+
+	run(
+		q::with( queue )
+		.then( [ this ]( )
+		{
+			EXPECT_TRUE( queue->is_current( ) );
+			EXPECT_FALSE( tp_queue->is_current( ) );
+		} )
+		.then( [ this ]( )
+		{
+			return q::with( tp_queue )
+			.then( [ this ]( )
+			{
+				EXPECT_TRUE( tp_queue->is_current( ) );
+				EXPECT_FALSE( queue->is_current( ) );
+			} );
+		} )
+	);
+}
+
+TEST_F( channel_inline, write_calls_reader_inline )
+{
+	q::channel< int > ch( queue, 5, q::channel_inline_consume( 10 ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	std::vector< int > values;
+
+	auto consumed = readable.consume( [ &values ]( int i )
+	{
+		values.push_back( i );
+	} );
+
+	run(
+		q::with( queue )
+		.then( [ &values, writable ]( ) mutable
+		{
+			EXPECT_TRUE( writable.write( 1 ) );
+
+			// Called by the write, not from a new task
+			EXPECT_EQ( std::vector< int >{ 1 }, values );
+
+			writable.close( );
+		} )
+		.then( [ &consumed ]( )
+		{
+			return std::move( consumed );
+		} )
+	);
+
+	EXPECT_EQ( std::vector< int >{ 1 }, values );
+}
+
+TEST_F( channel_inline, budget_per_task )
+{
+	q::channel< int > ch( queue, 5, q::channel_inline_consume( 2 ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	std::vector< int > values;
+
+	auto on_value = [ &values ]( int i )
+	{
+		values.push_back( i );
+	};
+
+	auto a = readable.read(
+		on_value, EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) );
+	auto b = readable.read(
+		on_value, EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) );
+	auto c = readable.read(
+		on_value, EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) );
+
+	run(
+		q::with( queue )
+		.then( [ &values, writable ]( ) mutable
+		{
+			EXPECT_TRUE( writable.write( 1 ) );
+			EXPECT_TRUE( writable.write( 2 ) );
+			EXPECT_TRUE( writable.write( 3 ) );
+
+			// The third value is pushed to the queue
+			EXPECT_EQ( ( std::vector< int >{ 1, 2 } ), values );
+		} )
+		.then( [ &a ]( )
+		{
+			return std::move( a );
+		} )
+		.then( [ &b ]( bool )
+		{
+			return std::move( b );
+		} )
+		.then( [ &c ]( bool )
+		{
+			return std::move( c );
+		} )
+		.then( [ &values ]( bool )
+		{
+			std::vector< int > expected{ 1, 2, 3 };
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}
+
+TEST_F( channel_inline, not_inline_outside_the_queue )
+{
+	q::channel< int > ch( queue, 5, q::channel_inline_consume( 10 ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	std::vector< int > values;
+
+	auto promise = readable.read(
+		[ &values ]( int i )
+		{
+			values.push_back( i );
+		},
+		EXPECT_NO_CALL_WRAPPER( [ ]( ) { } )
+	);
+
+	EXPECT_TRUE( writable.write( 1 ) );
+	EXPECT_TRUE( values.empty( ) );
+
+	run( std::move( promise ) );
+
+	EXPECT_EQ( std::vector< int >{ 1 }, values );
+}
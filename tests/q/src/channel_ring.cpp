@@ -0,0 +1,133 @@
+
+#include <q/channel.hpp>
+#include <q/detail/ring_buffer.hpp>
+
+#include <atomic>
+#include <thread>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( channel_ring );
+
+TEST_F( channel_ring, try_read )
+{
+	q::channel< int > ch( queue, 5 );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	std::tuple< int > value;
+	EXPECT_FALSE( readable.try_read( value ) );
+
+	EXPECT_TRUE( writable.write( 17 ) );
+	EXPECT_TRUE( readable.try_read( value ) );
+	EXPECT_EQ( 17, std::get< 0 >( value ) );
+	EXPECT_FALSE( readable.try_read( value ) );
+}
+
+TEST_F( channel_ring, overflow_in_order )
+{
+	for ( auto storage : {
+		q::channel_storage::spsc_ring,
+		q::channel_storage::mpmc_ring
+	} )
+	{
+		q::channel< int > ch( queue, 2, q::channel_storage( storage ) );
+
+		auto readable = ch.get_readable( );
+		auto writable = ch.get_writable( );
+
+		for ( int i = 0; i < 10; ++i )
+		{
+			EXPECT_TRUE( writable.write( i ) );
+			EXPECT_EQ( i >= 2, !writable.should_write( ) );
+		}
+
+		std::tuple< int > value;
+		for ( int i = 0; i < 10; ++i )
+		{
+			EXPECT_TRUE( readable.try_read( value ) );
+			EXPECT_EQ( i, std::get< 0 >( value ) );
+		}
+		EXPECT_FALSE( readable.try_read( value ) );
+	}
+}
+
+TEST_F( channel_ring, waiting_reader )
+{
+	q::channel< int > ch(
+		queue, 5, q::channel_storage( q::channel_storage::spsc_ring ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	auto promise = readable.read( )
+	.then( EXPECT_CALL_WRAPPER(
+		[ &readable ]( int value )
+		{
+			EXPECT_EQ( 17, value );
+
+			std::tuple< int > next;
+			EXPECT_TRUE( readable.try_read( next ) );
+			EXPECT_EQ( 4711, std::get< 0 >( next ) );
+
+			return readable.read( );
+		}
+	) )
+	.then( EXPECT_NO_CALL_WRAPPER(
+		[ ]( int ) { }
+	) )
+	.fail( EXPECT_CALL_WRAPPER(
+		[ ]( q::channel_closed_exception& ) { }
+	) );
+
+	EXPECT_TRUE( writable.write( 17 ) );
+	EXPECT_TRUE( writable.write( 4711 ) );
+	writable.close( );
+
+	run( std::move( promise ) );
+}
+
+TEST( ring_buffer, mpmc_concurrent )
+{
+	typedef q::detail::ring_buffer< std::size_t > ring_type;
+
+	const std::size_t per_thread = 20000;
+	ring_type ring( 64 );
+	std::atomic< std::size_t > sum( 0 );
+	std::atomic< std::size_t > popped( 0 );
+
+	auto producer = [ & ]( )
+	{
+		for ( std::size_t i = 1; i <= per_thread; ++i )
+		{
+			std::size_t value = i;
+			while ( !ring.try_push( std::move( value ) ) )
+				std::this_thread::yield( );
+		}
+	};
+
+	auto consumer = [ & ]( )
+	{
+		q::detail::ring_value< std::size_t > value;
+
+		while ( popped < 2 * per_thread )
+		{
+			if ( ring.try_pop( value ) )
+			{
+				sum += value.get( );
+				value.reset( );
+				++popped;
+			}
+			else
+				std::this_thread::yield( );
+		}
+	};
+
+	std::thread p1( producer ), p2( producer );
+	std::thread c1( consumer ), c2( consumer );
+	p1.join( ); p2.join( ); c1.join( ); c2.join( );
+
+	EXPECT_EQ( per_thread * ( per_thread + 1 ), sum.load( ) );
+	EXPECT_EQ( 0U, ring.size( ) );
+}
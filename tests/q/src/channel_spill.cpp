@@ -0,0 +1,134 @@
+
+#include <q/block.hpp>
+#include <q/channel.hpp>
+
+#include "core.hpp"
+
+#include <cstdlib>
+
+Q_TEST_MAKE_SCOPE( channel_spill );
+
+namespace {
+
+std::string spill_directory( )
+{
+	const char* dir = std::getenv( "TMPDIR" );
+	return dir && *dir ? dir : "/tmp";
+}
+
+std::string value_string( int i )
+{
+	return "value " + std::to_string( i );
+}
+
+} // anonymous namespace
+
+TEST_F( channel_spill, values_in_order )
+{
+	for ( auto storage : {
+		q::channel_storage::queue,
+		q::channel_storage::spsc_ring,
+		q::channel_storage::mpmc_ring
+	} )
+	{
+		// Keep 3 values in memory, and use tiny segments to get many
+		q::channel< q::byte_block > ch(
+			queue,
+			100,
+			q::channel_options(
+				q::channel_storage( storage ),
+				q::channel_spill( spill_directory( ), 3, 64 )
+			) );
+
+		auto readable = ch.get_readable( );
+		auto writable = ch.get_writable( );
+
+		for ( int i = 0; i < 20; ++i )
+			EXPECT_TRUE( writable.write(
+				q::byte_block( value_string( i ) ) ) );
+
+		std::tuple< q::byte_block > value;
+		for ( int i = 0; i < 10; ++i )
+		{
+			EXPECT_TRUE( readable.try_read( value ) );
+			EXPECT_EQ(
+				value_string( i ),
+				std::get< 0 >( value ).to_string( ) );
+		}
+
+		// Values are still appended after the spilled ones
+		for ( int i = 20; i < 25; ++i )
+			EXPECT_TRUE( writable.write(
+				q::byte_block( value_string( i ) ) ) );
+
+		for ( int i = 10; i < 25; ++i )
+		{
+			EXPECT_TRUE( readable.try_read( value ) );
+			EXPECT_EQ(
+				value_string( i ),
+				std::get< 0 >( value ).to_string( ) );
+		}
+		EXPECT_FALSE( readable.try_read( value ) );
+
+		// Caught up, so this is buffered in memory again
+		EXPECT_TRUE( writable.write( q::byte_block( "last" ) ) );
+		EXPECT_TRUE( readable.try_read( value ) );
+		EXPECT_EQ( "last", std::get< 0 >( value ).to_string( ) );
+	}
+}
+
+TEST_F( channel_spill, buffer_count_includes_spilled_values )
+{
+	q::channel< std::string > ch(
+		queue, 4, q::channel_spill( spill_directory( ), 1 ) );
+
+	auto writable = ch.get_writable( );
+
+	for ( int i = 0; i < 4; ++i )
+	{
+		EXPECT_TRUE( writable.should_write( ) );
+		EXPECT_TRUE( writable.write( std::to_string( i ) ) );
+	}
+	EXPECT_TRUE( writable.should_write( ) );
+	EXPECT_TRUE( writable.write( "4" ) );
+	EXPECT_FALSE( writable.should_write( ) );
+}
+
+TEST_F( channel_spill, read_tuples )
+{
+	q::channel< int, std::string > ch(
+		queue, 10, q::channel_spill( spill_directory( ), 1 ) );
+
+	auto readable = ch.get_readable( );
+	auto writable = ch.get_writable( );
+
+	for ( int i = 0; i < 5; ++i )
+		EXPECT_TRUE( writable.write( i, std::to_string( i * 2 ) ) );
+	writable.close( );
+
+	std::vector< std::string > values;
+
+	run(
+		readable.consume( [ &values ]( int i, std::string s )
+		{
+			values.push_back( std::to_string( i ) + ":" + s );
+		} )
+		.then( [ &values ]( )
+		{
+			std::vector< std::string > expected{
+				"0:0", "1:2", "2:4", "3:6", "4:8"
+			};
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}
+
+TEST_F( channel_spill, unserializable_values )
+{
+	typedef q::channel< std::vector< int > > channel_type;
+
+	EXPECT_THROW(
+		channel_type(
+			queue, 10, q::channel_spill( spill_directory( ), 1 ) ),
+		std::invalid_argument );
+}
@@ -0,0 +1,62 @@
+
+#include <q/block.hpp>
+#include <q/channel.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( channel_weight );
+
+TEST_F( channel_weight, weighted_buffer )
+{
+	for ( auto storage : {
+		q::channel_storage::queue,
+		q::channel_storage::spsc_ring,
+		q::channel_storage::mpmc_ring
+	} )
+	{
+		// A budget of 10 bytes, resuming below 7
+		q::channel< q::byte_block > ch(
+			queue,
+			10,
+			q::channel_options(
+				q::channel_storage( storage ),
+				q::channel_weight( q::channel_weight::weight )
+			) );
+
+		auto readable = ch.get_readable( );
+		auto writable = ch.get_writable( );
+
+		EXPECT_TRUE( writable.write( q::byte_block( "abcd" ) ) );
+		EXPECT_TRUE( writable.should_write( ) );
+		EXPECT_TRUE( writable.write( q::byte_block( "efgh" ) ) );
+		EXPECT_TRUE( writable.should_write( ) );
+		EXPECT_TRUE( writable.write( q::byte_block( "ijkl" ) ) );
+		EXPECT_FALSE( writable.should_write( ) );
+
+		std::tuple< q::byte_block > value;
+		EXPECT_TRUE( readable.try_read( value ) );
+		EXPECT_EQ( "abcd", std::get< 0 >( value ).to_string( ) );
+		EXPECT_TRUE( readable.try_read( value ) );
+		EXPECT_EQ( "efgh", std::get< 0 >( value ).to_string( ) );
+
+		run( q::with( queue ).then( [ writable ]( )
+		{
+			EXPECT_TRUE( writable.should_write( ) );
+		} ) );
+	}
+}
+
+TEST_F( channel_weight, weighted_empty_values )
+{
+	q::channel< std::string > ch(
+		queue, 2, q::channel_weight( q::channel_weight::weight ) );
+
+	auto writable = ch.get_writable( );
+
+	// Empty values weigh as much as one byte
+	EXPECT_TRUE( writable.write( std::string( ) ) );
+	EXPECT_TRUE( writable.write( std::string( ) ) );
+	EXPECT_TRUE( writable.should_write( ) );
+	EXPECT_TRUE( writable.write( std::string( ) ) );
+	EXPECT_FALSE( writable.should_write( ) );
+}
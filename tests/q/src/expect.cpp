@@ -151,3 +151,86 @@ TEST( expect, exception_expect_with_null_exception )
 		q::refuse< std::exception_ptr >( make_null_exception( ) ),
 		q::invalid_exception_exception );
 }
+
+struct NonDefaultConstructible
+{
+	NonDefaultConstructible( int i )
+	: i( i )
+	{ }
+
+	int i;
+};
+
+TEST( expect, non_default_constructible_expect_with_value )
+{
+	auto expect = q::fulfill< NonDefaultConstructible >(
+		NonDefaultConstructible( 5 ) );
+	EXPECT_FALSE( expect.has_exception( ) );
+	EXPECT_EQ( 5, expect.get( ).i );
+	EXPECT_EQ( 5, expect.consume( ).i );
+}
+
+TEST( expect, assign_between_value_and_exception )
+{
+	auto expect = q::fulfill< std::string >( std::string( "value" ) );
+
+	expect = q::refuse< std::string >( make_exception( ) );
+	EXPECT_TRUE( expect.has_exception( ) );
+	EXPECT_THROW( expect.get( ), test_exception );
+
+	expect = q::fulfill< std::string >( std::string( "again" ) );
+	EXPECT_FALSE( expect.has_exception( ) );
+	EXPECT_EQ( expect.exception( ), std::exception_ptr( ) );
+	EXPECT_EQ( "again", expect.consume( ) );
+}
+
+// Copyable only (no move constructor), and the copy throws when asked to
+struct ThrowingCopy
+{
+	static bool should_throw;
+
+	ThrowingCopy( std::string s )
+	: s( std::move( s ) )
+	{ }
+
+	ThrowingCopy( const ThrowingCopy& other )
+	: s( other.s )
+	{
+		if ( should_throw )
+			Q_THROW( test_exception( ) );
+	}
+
+	ThrowingCopy& operator=( const ThrowingCopy& ) = default;
+
+	std::string s;
+};
+
+bool ThrowingCopy::should_throw = false;
+
+TEST( expect, assign_with_throwing_copy )
+{
+	auto value = q::fulfill< ThrowingCopy >( ThrowingCopy( "value" ) );
+	auto other = q::fulfill< ThrowingCopy >( ThrowingCopy( "other" ) );
+
+	ThrowingCopy::should_throw = true;
+	EXPECT_THROW( value = other, test_exception );
+	ThrowingCopy::should_throw = false;
+
+	// The failed copy leaves the exception, rather than a destroyed value
+	EXPECT_TRUE( value.has_exception( ) );
+	EXPECT_THROW( value.get( ), test_exception );
+
+	value = other;
+	EXPECT_FALSE( value.has_exception( ) );
+	EXPECT_EQ( "other", value.get( ).s );
+}
+
+TEST( expect, copy_assign_with_nothrow_move )
+{
+	auto value = q::fulfill< std::string >( std::string( "value" ) );
+	auto other = q::fulfill< std::string >( std::string( "other" ) );
+
+	value = other;
+	EXPECT_EQ( "other", value.get( ) );
+	EXPECT_EQ( "other", other.get( ) );
+}
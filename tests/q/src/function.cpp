@@ -913,3 +913,197 @@ TEST( function, large_mutable_non_copyable_lambda_unique_shared_conversion )
 	_uf( );
 	EXPECT_EQ( 3, call_count );
 }
+
+struct instance_counter
+{
+	static int instances;
+
+	instance_counter( ) { ++instances; }
+	instance_counter( instance_counter&& ) { ++instances; }
+	instance_counter( const instance_counter& ) { ++instances; }
+	~instance_counter( ) { --instances; }
+
+	void operator( )( ) const { ++call_count; }
+};
+
+int instance_counter::instances = 0;
+
+TEST( function, trivially_copyable_inlined_lambda_relocation )
+{
+	int value = 0;
+	int* target = &value;
+	int increment = 3;
+
+	q::unique_function< int( ) > uf( [ target, increment ]( )
+	{
+		return *target += increment;
+	} );
+
+	q::unique_function< int( ) > uf2( std::move( uf ) );
+	EXPECT_FALSE( uf );
+	EXPECT_EQ( 3, uf2( ) );
+
+	q::function< int( ) > f = uf2.share( );
+	q::unique_function< int( ) > uf3( std::move( f ) );
+	EXPECT_FALSE( f );
+	EXPECT_EQ( 6, uf3( ) );
+	EXPECT_EQ( 9, uf2( ) );
+}
+
+TEST( function, inlined_function_object_lifetime )
+{
+	call_count = 0;
+	instance_counter::instances = 0;
+
+	{
+		q::unique_function< void( ) > uf{ instance_counter( ) };
+		EXPECT_EQ( 1, instance_counter::instances );
+
+		q::unique_function< void( ) > uf2( std::move( uf ) );
+		EXPECT_EQ( 1, instance_counter::instances );
+
+		q::function< void( ) > f = uf2.share( );
+		EXPECT_EQ( 2, instance_counter::instances );
+
+		q::function< void( ) > f2 = f;
+		EXPECT_EQ( 3, instance_counter::instances );
+
+		q::unique_function< void( ) > uf3( std::move( f2 ) );
+		EXPECT_EQ( 3, instance_counter::instances );
+
+		uf3 = q::unique_function< void( ) >( );
+		EXPECT_EQ( 2, instance_counter::instances );
+
+		uf2( );
+		f( );
+		EXPECT_EQ( 2, call_count );
+	}
+
+	EXPECT_EQ( 0, instance_counter::instances );
+}
+
+TEST( function, heap_allocated_function_object_lifetime )
+{
+	instance_counter::instances = 0;
+
+	{
+		q::function< void( ) > f( make_lambda_11< false >(
+			std::make_tuple( instance_counter( ), payload< 256, true >{ } )
+		) );
+		EXPECT_EQ( 1, instance_counter::instances );
+
+		q::unique_function< void( ) > uf( std::move( f ) );
+		EXPECT_EQ( 1, instance_counter::instances );
+
+		q::function< void( ) > f2 = uf.share( );
+		EXPECT_EQ( 1, instance_counter::instances );
+	}
+
+	EXPECT_EQ( 0, instance_counter::instances );
+}
+
+TEST( function, custom_function_inline_size )
+{
+	typedef q::custom_unique_function< void( ), 6 > small_function;
+	typedef q::custom_shared_function< void( ), 22 > large_function;
+
+	EXPECT_LE(
+		6 * sizeof( void* ),
+		q::function_inline_size_t< small_function >::value );
+	EXPECT_LE(
+		22 * sizeof( void* ),
+		q::function_inline_size_t< large_function >::value );
+	EXPECT_LT( sizeof( small_function ), sizeof( large_function ) );
+
+	call_count = 0;
+
+	small_function sf( make_lambda_11< false >( payload< 40, true >{ } ) );
+	large_function lf( make_lambda_11< false >( payload< 168, true >{ } ) );
+
+	sf( );
+	lf( );
+	EXPECT_EQ( 2, call_count );
+}
+
+#ifndef Q_RECORD_FUNCTION_STATS
+TEST( function, function_stats_not_recorded )
+{
+	q::function< void( ) > f( make_lambda_11< false >( ) );
+
+	auto stats = q::get_function_stats( );
+
+	EXPECT_TRUE( stats.inlined.empty( ) );
+	EXPECT_EQ( 0, q::function_stats::count( stats.inlined ) );
+	EXPECT_EQ( 0, stats.shared_functions );
+}
+#endif
+
+#ifndef Q_NO_FUNCTION_POOL
+TEST( function, pooled_heap_allocation )
+{
+	call_count = 0;
+
+	// Warm up the thread cache
+	{
+		q::unique_function< void( ) > uf( make_lambda_11_size< 256 >( ) );
+	}
+
+	auto before = q::get_function_pool_stats( );
+
+	{
+		q::unique_function< void( ) > uf( make_lambda_11_size< 256 >( ) );
+		q::function< void( ) > f = uf.share( );
+		q::function< void( ) > f2(
+			make_lambda_11_size< 256, false, false >( ) );
+
+		uf( );
+		f( );
+		f2( );
+		EXPECT_EQ( 3, call_count );
+	}
+
+	auto after = q::get_function_pool_stats( );
+
+	EXPECT_LT( before.allocations( ), after.allocations( ) );
+	EXPECT_LT( before.cache_hits, after.cache_hits );
+	EXPECT_EQ(
+		after.allocations( ) - before.allocations( ),
+		after.deallocations - before.deallocations );
+	EXPECT_LT( 0.0, after.hit_rate( ) );
+}
+#endif
+
+static int add_one( int i )
+{
+	return i + 1;
+}
+
+static int call_ref( q::function_ref< int( int ) > fn, int i )
+{
+	return fn( i );
+}
+
+TEST( function, function_ref )
+{
+	static_assert(
+		sizeof( q::function_ref< int( int ) > ) == 2 * sizeof( void* ),
+		"function_ref should be two pointers large" );
+
+	int offset = 10;
+	auto add_offset = [ &offset ]( int i ) { return i + offset; };
+
+	EXPECT_EQ( 15, call_ref( add_offset, 5 ) );
+	EXPECT_EQ( 6, call_ref( add_one, 5 ) );
+	EXPECT_EQ( 6, call_ref( &add_one, 5 ) );
+
+	int calls = 0;
+	auto counter = [ &calls ]( int i ) mutable { return calls += i; };
+	EXPECT_EQ( 2, call_ref( counter, 2 ) );
+	EXPECT_EQ( 5, call_ref( counter, 3 ) );
+
+	q::function< int( int ) > f( add_offset );
+	q::function_ref< int( int ) > ref( f );
+	q::function_ref< int( int ) > ref2( ref );
+	offset = 20;
+	EXPECT_EQ( 21, ref2( 1 ) );
+}
@@ -261,6 +261,53 @@ TEST( functional, call_with_args_void )
 	EXPECT_EQ( 5, ret4 );
 }
 
+TEST( functional, call_with_args_function_pointer_lvalue )
+{
+	int ( *fn )( q::void_t ) = fn_void_t;
+	int ( * const cfn )( q::void_t ) = fn_void_t;
+
+	auto ret1 = q::call_with_args( fn, q::void_t( ) );
+	auto ret2 = q::call_with_args( cfn, q::void_t( ) );
+	auto ret3 = q::call_with_args_by_tuple(
+		fn, std::make_tuple( q::void_t( ) ) );
+
+	EXPECT_EQ( 5, ret1 );
+	EXPECT_EQ( 5, ret2 );
+	EXPECT_EQ( 5, ret3 );
+}
+
+TEST( functional, is_nothrow_call_with_args )
+{
+	auto nothrow_fn = [ ]( int i ) noexcept { return i; };
+	auto throwing_fn = [ ]( int i ) { return i; };
+	auto nothrow_copy_fn = [ ]( std::string ) noexcept { };
+
+	typedef decltype( nothrow_fn ) nothrow_type;
+	typedef decltype( throwing_fn ) throwing_type;
+	typedef decltype( nothrow_copy_fn ) nothrow_copy_type;
+
+	EXPECT_TRUE( ( q::is_nothrow_call_with_args_t<
+		nothrow_type, int
+	>::value ) );
+	EXPECT_FALSE( ( q::is_nothrow_call_with_args_t<
+		throwing_type, int
+	>::value ) );
+	EXPECT_TRUE( ( q::is_nothrow_call_with_args_by_tuple_t<
+		nothrow_type, std::tuple< int >
+	>::value ) );
+	EXPECT_FALSE( ( q::is_nothrow_call_with_args_by_tuple_t<
+		throwing_type, std::tuple< int >
+	>::value ) );
+
+	// Moving a string is noexcept, copying it is not
+	EXPECT_TRUE( ( q::is_nothrow_call_with_args_by_tuple_t<
+		nothrow_copy_type, std::tuple< std::string >&&
+	>::value ) );
+	EXPECT_FALSE( ( q::is_nothrow_call_with_args_by_tuple_t<
+		nothrow_copy_type, const std::tuple< std::string >&
+	>::value ) );
+}
+
 TEST( functional, result_of )
 {
 	auto fn = [ ]( int, long ) { return true; };
@@ -0,0 +1,193 @@
+
+#include <q/generator.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( generator );
+
+namespace {
+
+q::generator< int > count_to( const q::queue_ptr& queue, int n, int& steps )
+{
+	int i = 0;
+
+	return q::generator< int >( queue, [ i, n, &steps ]( ) mutable
+	{
+		++steps;
+
+		if ( i == n )
+			Q_THROW( q::channel_closed_exception( ) );
+
+		return i++;
+	} );
+}
+
+} // anonymous namespace
+
+TEST_F( generator, lazy_steps )
+{
+	int steps = 0;
+
+	auto gen = count_to( queue, 2, steps );
+
+	run( q::with( queue ) );
+	EXPECT_EQ( 0, steps );
+
+	run(
+		gen.next( )
+		.then( [ &steps, gen ]( int i ) mutable
+		{
+			EXPECT_EQ( 0, i );
+			EXPECT_EQ( 1, steps );
+
+			return gen.next( );
+		} )
+		.then( [ gen ]( int i ) mutable
+		{
+			EXPECT_EQ( 1, i );
+
+			return gen.next( );
+		} )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER(
+			[ ]( const q::channel_closed_exception& ) { }
+		) )
+	);
+
+	EXPECT_EQ( 3, steps );
+	EXPECT_TRUE( gen.is_closed( ) );
+}
+
+TEST_F( generator, next_in_order )
+{
+	int steps = 0;
+
+	auto gen = count_to( queue, 3, steps );
+
+	std::vector< int > values;
+
+	auto on_value = [ &values ]( int i )
+	{
+		values.push_back( i );
+	};
+
+	auto a = gen.next( ).then( on_value );
+	auto b = gen.next( ).then( on_value );
+	auto c = gen.next( ).then( on_value );
+	auto d = gen.next( )
+	.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+	.fail( EXPECT_CALL_WRAPPER(
+		[ ]( const q::channel_closed_exception& ) { }
+	) );
+
+	run(
+		q::all( std::move( a ), std::move( b ), std::move( c ) )
+		.then( [ &d ]( )
+		{
+			return std::move( d );
+		} )
+	);
+
+	std::vector< int > expected{ 0, 1, 2 };
+	EXPECT_EQ( expected, values );
+}
+
+TEST_F( generator, async_step )
+{
+	auto tp = tp_queue;
+	int i = 0;
+
+	q::generator< int, std::string > gen(
+		queue,
+		[ tp, i ]( ) mutable
+		{
+			int value = i++;
+
+			return q::with( tp, value )
+			.then( [ ]( int value )
+			{
+				return std::make_tuple(
+					value, std::to_string( value ) );
+			} );
+		}
+	);
+
+	run(
+		gen.next( )
+		.then( [ gen ]( int i, std::string s ) mutable
+		{
+			EXPECT_EQ( 0, i );
+			EXPECT_EQ( "0", s );
+
+			return gen.next( );
+		} )
+		.then( EXPECT_CALL_WRAPPER( [ ]( int i, std::string s )
+		{
+			EXPECT_EQ( 1, i );
+			EXPECT_EQ( "1", s );
+		} ) )
+	);
+}
+
+TEST_F( generator, error_ends_generator )
+{
+	q::generator< int > gen( queue, [ ]( ) -> int
+	{
+		Q_THROW( Error( ) );
+	} );
+
+	run(
+		gen.next( )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+		.then( [ this, gen ]( ) mutable
+		{
+			EXPECT_TRUE( gen.is_closed( ) );
+
+			return gen.next( )
+			.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+			.fail( EXPECT_CALL_WRAPPER(
+				[ ]( const Error& ) { }
+			) );
+		} )
+	);
+}
+
+TEST_F( generator, readable )
+{
+	int steps = 0;
+
+	auto gen = count_to( queue, 5, steps );
+
+	std::vector< int > values;
+
+	run(
+		gen.get_readable( 2 )
+		.consume( [ &values ]( int i )
+		{
+			values.push_back( i );
+		} )
+	);
+
+	std::vector< int > expected{ 0, 1, 2, 3, 4 };
+	EXPECT_EQ( expected, values );
+	EXPECT_EQ( 6, steps );
+}
+
+TEST_F( generator, readable_closed_during_step )
+{
+	int steps = 0;
+
+	auto gen = count_to( queue, 5, steps );
+
+	// The first step is started, but runs on the queue
+	auto readable = gen.get_readable( 2 );
+
+	readable.close( );
+
+	EXPECT_TRUE( gen.is_closed( ) );
+
+	run( q::with( queue ) );
+
+	EXPECT_EQ( 1, steps );
+}
@@ -0,0 +1,252 @@
+
+#include <q/pipeline.hpp>
+
+#include "core.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+Q_TEST_MAKE_SCOPE( pipeline );
+
+namespace {
+
+std::vector< int > read_all( q::readable< int > readable )
+{
+	std::vector< int > values;
+	std::tuple< int > value;
+
+	while ( readable.try_read( value ) )
+		values.push_back( std::get< 0 >( value ) );
+
+	return values;
+}
+
+} // anonymous namespace
+
+TEST_F( pipeline, no_stages )
+{
+	q::channel< int > in( queue, 10 );
+	q::channel< int > out( queue, 10 );
+
+	auto writable = in.get_writable( );
+	for ( int i = 0; i < 5; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	run( q::pipeline< int >( queue, 2 )
+		.run( in.get_readable( ), out.get_writable( ) ) );
+
+	std::vector< int > expected{ 0, 1, 2, 3, 4 };
+	EXPECT_EQ( expected, read_all( out.get_readable( ) ) );
+	EXPECT_TRUE( out.get_readable( ).is_closed( ) );
+}
+
+TEST_F( pipeline, parallel_stage_in_order_output )
+{
+	q::channel< int > in( queue, 100 );
+	q::channel< std::string > out( queue, 100 );
+
+	auto writable = in.get_writable( );
+	for ( int i = 0; i < 20; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	std::vector< std::string > values;
+
+	auto p = q::pipeline< int >( tp_queue, 8 )
+	.stage( { q::stage_mode::parallel, 4 }, [ ]( int i )
+	{
+		// Make later items finish before earlier ones
+		std::this_thread::sleep_for(
+			std::chrono::milliseconds( ( 20 - i ) % 4 ) );
+		return i * 2;
+	} )
+	.stage( q::stage_mode::serial_in_order, [ &values ]( int i )
+	{
+		auto s = std::to_string( i );
+		values.push_back( s );
+		return s;
+	} );
+
+	run( p.run( in.get_readable( ), out.get_writable( ) ) );
+
+	std::vector< std::string > expected;
+	for ( int i = 0; i < 20; ++i )
+		expected.push_back( std::to_string( i * 2 ) );
+
+	EXPECT_EQ( expected, values );
+
+	auto readable = out.get_readable( );
+	std::tuple< std::string > value;
+	for ( auto& s : expected )
+	{
+		EXPECT_TRUE( readable.try_read( value ) );
+		EXPECT_EQ( s, std::get< 0 >( value ) );
+	}
+	EXPECT_FALSE( readable.try_read( value ) );
+}
+
+TEST_F( pipeline, tokens_limit_items_in_flight )
+{
+	q::channel< int > in( queue, 100 );
+	q::channel< int > out( queue, 100 );
+
+	auto writable = in.get_writable( );
+	for ( int i = 0; i < 30; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	std::atomic< int > in_flight( 0 );
+	std::atomic< int > max_in_flight( 0 );
+
+	auto p = q::pipeline< int >( tp_queue, 3 )
+	.stage( q::stage_mode::parallel, [ &in_flight, &max_in_flight ]( int i )
+	{
+		int now = ++in_flight;
+		int max = max_in_flight;
+		while ( now > max && !max_in_flight.compare_exchange_weak(
+			max, now
+		) )
+			;
+
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		return i;
+	} )
+	.stage( q::stage_mode::serial_out_of_order, [ &in_flight ]( int i )
+	{
+		--in_flight;
+		return i;
+	} );
+
+	run( p.run( in.get_readable( ), out.get_writable( ) ) );
+
+	EXPECT_LE( max_in_flight.load( ), 3 );
+
+	auto values = read_all( out.get_readable( ) );
+	std::sort( values.begin( ), values.end( ) );
+
+	EXPECT_EQ( 30U, values.size( ) );
+	for ( int i = 0; i < 30; ++i )
+		EXPECT_EQ( i, values[ i ] );
+}
+
+TEST_F( pipeline, async_stage )
+{
+	q::channel< int > in( queue, 10 );
+	q::channel< int > out( queue, 10 );
+
+	auto writable = in.get_writable( );
+	for ( int i = 0; i < 5; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	auto tp = tp_queue;
+
+	auto p = q::pipeline< int >( queue, 4 )
+	.stage( q::stage_mode::serial_in_order, [ tp ]( int i )
+	{
+		return q::with( tp, i )
+		.then( [ ]( int i )
+		{
+			return i + 100;
+		} );
+	} );
+
+	run( p.run( in.get_readable( ), out.get_writable( ) ) );
+
+	std::vector< int > expected{ 100, 101, 102, 103, 104 };
+	EXPECT_EQ( expected, read_all( out.get_readable( ) ) );
+}
+
+TEST_F( pipeline, stage_error )
+{
+	q::channel< int > in( queue, 10 );
+	q::channel< int > out( queue, 10 );
+
+	auto writable = in.get_writable( );
+	for ( int i = 0; i < 5; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	auto p = q::pipeline< int >( queue, 1 )
+	.stage( q::stage_mode::serial_in_order, [ ]( int i )
+	{
+		if ( i == 2 )
+			Q_THROW( Error( ) );
+		return i;
+	} );
+
+	run(
+		p.run( in.get_readable( ), out.get_writable( ) )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+		.then( [ this, out ]( ) mutable
+		{
+			auto readable = out.get_readable( );
+
+			std::vector< int > expected{ 0, 1 };
+			EXPECT_EQ( expected, read_all( readable ) );
+
+			return readable.read( )
+			.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+			.fail( EXPECT_CALL_WRAPPER(
+				[ ]( const Error& ) { }
+			) );
+		} )
+	);
+}
+
+TEST_F( pipeline, full_output_holds_tokens )
+{
+	q::channel< int > in( queue, 100 );
+	q::channel< int > out( queue, 1 );
+
+	auto writable = in.get_writable( );
+	for ( int i = 0; i < 50; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	int read = 0;
+	int consumed = 0;
+	int max_ahead = 0;
+
+	auto p = q::pipeline< int >( queue, 2 )
+	.stage( q::stage_mode::serial_in_order, [ &read ]( int i )
+	{
+		++read;
+		return i;
+	} );
+
+	auto readable = out.get_readable( );
+
+	// The reader starts late, and then reads slowly
+	auto reader = q::with( tp_queue )
+	.then( [ ]( )
+	{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+	} )
+	.then( [ readable, &read, &consumed, &max_ahead ]( ) mutable
+	{
+		return readable.consume(
+			[ &read, &consumed, &max_ahead ]( int i )
+			{
+				EXPECT_EQ( consumed, i );
+				++consumed;
+				max_ahead =
+					std::max( max_ahead, read - consumed );
+
+				std::this_thread::sleep_for(
+					std::chrono::milliseconds( 1 ) );
+			} );
+	}, queue );
+
+	run( q::all(
+		p.run( in.get_readable( ), out.get_writable( ) ),
+		std::move( reader )
+	) );
+
+	EXPECT_EQ( 50, consumed );
+	// The tokens, and what the output buffers before pausing
+	EXPECT_LE( max_ahead, 4 );
+}
@@ -0,0 +1,173 @@
+
+#include <q/priority_channel.hpp>
+#include <q/select.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( priority_channel );
+
+TEST_F( priority_channel, highest_lane_first )
+{
+	q::priority_channel< std::string > ch( queue, { 10, 10, 10 } );
+
+	EXPECT_EQ( 3U, ch.lanes( ) );
+
+	EXPECT_TRUE( ch.write( 2, "bulk 1" ) );
+	EXPECT_TRUE( ch.write( 2, "bulk 2" ) );
+	EXPECT_TRUE( ch.write( 1, "normal" ) );
+	EXPECT_TRUE( ch.write( 0, "control" ) );
+
+	std::vector< std::string > expected{
+		"control", "normal", "bulk 1", "bulk 2"
+	};
+
+	for ( auto& s : expected )
+	{
+		std::tuple< std::string > value;
+		EXPECT_TRUE( ch.try_read( value ) );
+		EXPECT_EQ( s, std::get< 0 >( value ) );
+	}
+
+	std::tuple< std::string > value;
+	EXPECT_FALSE( ch.try_read( value ) );
+}
+
+TEST_F( priority_channel, read_waiting )
+{
+	q::priority_channel< int, std::string > ch( queue, { 1, 1 } );
+
+	auto promise = ch.read( )
+	.then( EXPECT_CALL_WRAPPER( [ ]( int i, std::string s )
+	{
+		EXPECT_EQ( 17, i );
+		EXPECT_EQ( "bulk", s );
+	} ) );
+
+	EXPECT_TRUE( ch.write( 1, 17, "bulk" ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( priority_channel, backpressure_per_lane )
+{
+	q::priority_channel< int > ch( queue, { 1, 2 } );
+
+	EXPECT_TRUE( ch.write( 1, 1 ) );
+	EXPECT_TRUE( ch.write( 1, 2 ) );
+	EXPECT_TRUE( ch.should_write( 1 ) );
+	EXPECT_TRUE( ch.write( 1, 3 ) );
+	EXPECT_FALSE( ch.should_write( 1 ) );
+
+	// The control lane isn't affected by the full bulk lane
+	EXPECT_TRUE( ch.should_write( 0 ) );
+	EXPECT_EQ( 3U, ch.size( 1 ) );
+
+	ch.set_resume_notification( 1, EXPECT_CALL_WRAPPER( [ ]( ) { } ) );
+
+	std::tuple< int > value;
+	EXPECT_TRUE( ch.try_read( value ) );
+	EXPECT_FALSE( ch.should_write( 1 ) );
+	EXPECT_TRUE( ch.try_read( value ) );
+	EXPECT_TRUE( ch.try_read( value ) );
+	EXPECT_TRUE( ch.should_write( 1 ) );
+
+	run( q::with( queue ) );
+
+	EXPECT_THROW( ch.should_write( 2 ), std::out_of_range );
+}
+
+TEST_F( priority_channel, consume_until_closed )
+{
+	q::priority_channel< int > ch( queue, { 10, 10 } );
+
+	for ( int i = 0; i < 3; ++i )
+		EXPECT_TRUE( ch.write( 1, i ) );
+	EXPECT_TRUE( ch.write( 0, 100 ) );
+	ch.close( );
+
+	EXPECT_FALSE( ch.write( 0, 200 ) );
+
+	std::vector< int > values;
+
+	run(
+		ch.consume( [ &values ]( int i )
+		{
+			values.push_back( i );
+		} )
+		.then( [ &values ]( )
+		{
+			std::vector< int > expected{ 100, 0, 1, 2 };
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}
+
+TEST_F( priority_channel, close_with_error )
+{
+	q::priority_channel< int > ch( queue, { 10 } );
+
+	auto promise = ch.read( )
+	.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+	.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) );
+
+	ch.close( Error( ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( priority_channel, consume_error_closes_channel )
+{
+	q::priority_channel< int > ch( queue, { 10 } );
+
+	EXPECT_TRUE( ch.write( 0, 1 ) );
+	EXPECT_TRUE( ch.write( 0, 2 ) );
+
+	run(
+		ch.consume( [ ]( int )
+		{
+			Q_THROW( Error( ) );
+		} )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+
+	EXPECT_TRUE( ch.is_closed( ) );
+	EXPECT_EQ( 0U, ch.size( 0 ) );
+}
+
+TEST_F( priority_channel, select_readable )
+{
+	q::priority_channel< int > ch( queue, { 10, 10 } );
+	q::channel< int > other( queue, 5 );
+
+	EXPECT_TRUE( ch.write( 1, 17 ) );
+	EXPECT_TRUE( ch.write( 0, 4711 ) );
+
+	std::vector< q::readable< int > > readables{
+		ch.get_readable( ), other.get_readable( )
+	};
+
+	run(
+		q::select( readables )
+		.then( EXPECT_CALL_WRAPPER( [ ]( std::size_t index, int value )
+		{
+			EXPECT_EQ( std::size_t( 0 ), index );
+			EXPECT_EQ( 4711, value );
+		} ) )
+	);
+}
+
+TEST_F( priority_channel, readable_closed_while_empty )
+{
+	q::priority_channel< int > ch( queue, { 10, 10 } );
+
+	auto readable = ch.get_readable( );
+
+	readable.close( );
+
+	// Closed right away, not when the next value can't be delivered
+	EXPECT_TRUE( ch.is_closed( ) );
+	EXPECT_FALSE( ch.write( 0, 17 ) );
+
+	run( q::with( queue ) );
+}
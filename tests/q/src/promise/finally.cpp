@@ -182,3 +182,27 @@ TEST_F( finally, asynchronous_with_value_asynchronous_failed_finally )
 		} ) )
 	);
 }
+
+TEST_F( finally, noexcept_with_exception )
+{
+	int calls = 0;
+
+	run(
+		q::with( queue )
+		.then( [ ]( ) -> long
+		{
+			Q_THROW( Error( ) );
+		} )
+		.finally( [ &calls ]( ) noexcept
+		{
+			++calls;
+		} )
+		.fail( EXPECT_CALL_WRAPPER(
+		[ &calls ]( Error& ) -> long
+		{
+			EXPECT_EQ( 1, calls );
+			return 0;
+		} ) )
+		.then( [ ]( long ) { } )
+	);
+}
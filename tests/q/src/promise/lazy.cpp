@@ -0,0 +1,86 @@
+
+#include "../core.hpp"
+
+Q_TEST_MAKE_SCOPE( lazy );
+
+TEST_F( lazy, fused_values )
+{
+	auto promise = q::lazy_with( queue, 4, 5 )
+	.then( [ ]( int a, int b )
+	{
+		return a + b;
+	} )
+	.then( [ ]( int value )
+	{
+		return std::make_tuple( value, std::string( "x" ) );
+	} )
+	.then( [ ]( std::tuple< int, std::string > value )
+	{
+		return std::get< 1 >( value ) + std::to_string( std::get< 0 >( value ) );
+	} )
+	.start( )
+	.then( EXPECT_CALL_WRAPPER( [ ]( std::string value )
+	{
+		EXPECT_EQ( value, "x9" );
+	} ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( lazy, not_scheduled_until_started )
+{
+	bool called = false;
+
+	auto lazy = q::make_lazy( queue, [ &called ]( )
+	{
+		called = true;
+		return 17;
+	} )
+	.then( [ ]( int value )
+	{
+		return value + 1;
+	} );
+
+	EXPECT_FALSE( called );
+
+	q::promise< int > promise = std::move( lazy );
+
+	run( promise.then( EXPECT_CALL_WRAPPER( [ &called ]( int value )
+	{
+		EXPECT_TRUE( called );
+		EXPECT_EQ( value, 18 );
+	} ) ) );
+}
+
+TEST_F( lazy, exception_skips_remaining_stages )
+{
+	auto promise = q::lazy_with( queue, 1 )
+	.then( [ ]( int ) -> int
+	{
+		Q_THROW( Error( ) );
+	} )
+	.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+	.start( )
+	.fail( EXPECT_CALL_WRAPPER( [ ]( Error& ) { } ) );
+
+	run( std::move( promise ) );
+}
+
+TEST_F( lazy, promise_returning_function_starts_pipeline )
+{
+	auto promise = q::lazy_with( queue, 3 )
+	.then( [ ]( int value )
+	{
+		return value * 2;
+	} )
+	.then( [ this ]( int value )
+	{
+		return q::with( queue, value + 1 );
+	} )
+	.then( EXPECT_CALL_WRAPPER( [ ]( int value )
+	{
+		EXPECT_EQ( value, 7 );
+	} ) );
+
+	run( std::move( promise ) );
+}
@@ -120,3 +120,22 @@ TEST_F( tap, tuple_to_promise )
 		} ) )
 	);
 }
+
+TEST_F( tap, noexcept_values_to_value )
+{
+	int calls = 0;
+
+	run(
+		q::with( queue, 17 )
+		.tap( [ &calls ]( int value ) noexcept
+		{
+			++calls;
+			EXPECT_EQ( 17, value );
+		} )
+		.then( [ &calls ]( int value ) noexcept
+		{
+			EXPECT_EQ( 1, calls );
+			EXPECT_EQ( 17, value );
+		} )
+	);
+}
@@ -261,3 +261,164 @@ TEST_F( then, tuple_to_promise )
 	);
 }
 
+
+TEST_F( then, noexcept_values_to_value )
+{
+	int i = 17;
+	std::string s = "hello";
+	int calls = 0;
+
+	run(
+		q::with( queue, i, s )
+		.then( [ &calls ]( int i, std::string&& s ) noexcept -> long
+		{
+			++calls;
+			return ( s[ 0 ] - s[ 1 ] ) * i;
+		} )
+		.then( [ &calls ]( long value ) noexcept
+		{
+			++calls;
+			EXPECT_EQ( 3 * 17, value );
+		} )
+		.then( [ &calls ]( ) noexcept
+		{
+			EXPECT_EQ( 2, calls );
+		} )
+	);
+}
+
+TEST_F( then, noexcept_forwards_exception )
+{
+	run(
+		q::with( queue )
+		.then( [ ]( ) -> long
+		{
+			Q_THROW( Error( ) );
+		} )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( long ) noexcept { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+}
+
+namespace {
+
+Q_MAKE_SIMPLE_EXCEPTION( move_exception );
+
+struct throwing_move
+{
+	throwing_move( ) = default;
+
+	throwing_move( throwing_move&& )
+	{
+		Q_THROW( move_exception( ) );
+	}
+};
+
+} // anonymous namespace
+
+TEST_F( then, noexcept_with_throwing_result_move )
+{
+	// The function can't throw, but moving its result into the promise can
+	run(
+		q::with( queue )
+		.then( [ ]( ) noexcept
+		{
+			return throwing_move( );
+		} )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( throwing_move&& ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const move_exception& ) { } ) )
+	);
+}
+
+namespace {
+
+struct copy_counter
+{
+	copy_counter( std::atomic< int >& copies )
+	: copies_( &copies )
+	{ }
+
+	copy_counter( const copy_counter& other )
+	: copies_( other.copies_ )
+	{
+		++*copies_;
+	}
+
+	copy_counter( copy_counter&& ) = default;
+	copy_counter& operator=( copy_counter&& ) = default;
+	copy_counter& operator=( const copy_counter& ) = delete;
+
+	std::atomic< int >* copies_;
+};
+
+} // anonymous namespace
+
+TEST_F( then, shared_by_const_ref_without_copies )
+{
+	std::atomic< int > copies( 0 );
+
+	auto shared = q::with( queue, copy_counter( copies ), 5 ).share( );
+
+	auto prom1 = shared.then( EXPECT_CALL_WRAPPER(
+	[ ]( const copy_counter&, const int& i )
+	{
+		EXPECT_EQ( 5, i );
+	} ) );
+	auto prom2 = shared.then( EXPECT_CALL_WRAPPER(
+	[ ]( const copy_counter&, int i )
+	{
+		EXPECT_EQ( 5, i );
+	} ) );
+
+	run( q::all( std::move( prom1 ), std::move( prom2 ) ) );
+
+	EXPECT_EQ( 0, copies.load( ) );
+}
+
+TEST_F( then, shared_by_value_copies_once )
+{
+	std::atomic< int > copies( 0 );
+
+	auto shared = q::with( queue, copy_counter( copies ) ).share( );
+
+	auto prom = shared.then( EXPECT_CALL_WRAPPER(
+	[ ]( copy_counter )
+	{ } ) );
+
+	run( std::move( prom ) );
+
+	EXPECT_EQ( 1, copies.load( ) );
+}
+
+TEST_F( then, shared_last_listener_moves )
+{
+	std::atomic< int > copies( 0 );
+
+	auto prom = q::with( queue, copy_counter( copies ) ).share( )
+	.then( EXPECT_CALL_WRAPPER(
+	[ ]( copy_counter&& )
+	{ } ) );
+
+	run( std::move( prom ) );
+
+	EXPECT_EQ( 0, copies.load( ) );
+}
+
+TEST_F( then, shared_copies_only_what_is_needed )
+{
+	std::atomic< int > copies( 0 );
+
+	auto shared = q::with(
+		queue, copy_counter( copies ), copy_counter( copies ) ).share( );
+
+	auto prom1 = shared.then( EXPECT_CALL_WRAPPER(
+	[ ]( const copy_counter&, copy_counter&& )
+	{ } ) );
+	auto prom2 = shared.then( EXPECT_CALL_WRAPPER(
+	[ ]( const copy_counter&, const copy_counter& )
+	{ } ) );
+
+	run( q::all( std::move( prom1 ), std::move( prom2 ) ) );
+
+	EXPECT_EQ( 1, copies.load( ) );
+}
@@ -0,0 +1,239 @@
+
+#include <q/select.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( select );
+
+TEST_F( select, buffered_value )
+{
+	q::channel< int > ch_a( queue, 5 );
+	q::channel< int > ch_b( queue, 5 );
+
+	EXPECT_TRUE( ch_b.get_writable( ).write( 17 ) );
+
+	std::vector< q::readable< int > > readables{
+		ch_a.get_readable( ), ch_b.get_readable( )
+	};
+
+	run(
+		q::select( readables )
+		.then( EXPECT_CALL_WRAPPER( [ ]( std::size_t index, int value )
+		{
+			EXPECT_EQ( std::size_t( 1 ), index );
+			EXPECT_EQ( 17, value );
+		} ) )
+	);
+}
+
+TEST_F( select, first_written_value_only )
+{
+	q::channel< int > ch_a( queue, 5 );
+	q::channel< int > ch_b( queue, 5 );
+
+	auto writable_a = ch_a.get_writable( );
+	auto writable_b = ch_b.get_writable( );
+	auto readable_a = ch_a.get_readable( );
+
+	std::vector< q::readable< int > > readables{
+		readable_a, ch_b.get_readable( )
+	};
+
+	auto selected = q::select( readables );
+
+	EXPECT_TRUE( writable_b.write( 47 ) );
+	EXPECT_TRUE( writable_a.write( 11 ) );
+
+	run(
+		std::move( selected )
+		.then( EXPECT_CALL_WRAPPER( [ ]( std::size_t index, int value )
+		{
+			EXPECT_EQ( std::size_t( 1 ), index );
+			EXPECT_EQ( 47, value );
+		} ) )
+		.then( [ readable_a ]( ) mutable
+		{
+			// The other channel keeps its value
+			return readable_a.read( );
+		} )
+		.then( EXPECT_CALL_WRAPPER( [ ]( int value )
+		{
+			EXPECT_EQ( 11, value );
+		} ) )
+	);
+}
+
+TEST_F( select, claimed_waiter_does_not_block_reads )
+{
+	q::channel< int > ch_a(
+		queue, 5, q::channel_storage( q::channel_storage::mpmc_ring ) );
+	q::channel< int > ch_b( queue, 5 );
+
+	auto writable_a = ch_a.get_writable( );
+	auto readable_a = ch_a.get_readable( );
+
+	std::vector< q::readable< int > > readables{
+		readable_a, ch_b.get_readable( )
+	};
+
+	auto selected = q::select( readables );
+
+	EXPECT_TRUE( ch_b.get_writable( ).write( 47 ) );
+
+	// The waiter left in the first channel is claimed, and doesn't stop
+	// values from being read, even before it is purged
+	std::tuple< int > value;
+	EXPECT_TRUE( writable_a.write( 11 ) );
+	EXPECT_TRUE( readable_a.try_read( value ) );
+	EXPECT_EQ( 11, std::get< 0 >( value ) );
+
+	run(
+		std::move( selected )
+		.then( EXPECT_CALL_WRAPPER( [ ]( std::size_t index, int value )
+		{
+			EXPECT_EQ( std::size_t( 1 ), index );
+			EXPECT_EQ( 47, value );
+		} ) )
+	);
+}
+
+TEST_F( select, all_closed )
+{
+	q::channel< int > ch_a( queue, 5 );
+	q::channel< int > ch_b( queue, 5 );
+
+	ch_a.get_writable( ).close( );
+
+	std::vector< q::readable< int > > readables{
+		ch_a.get_readable( ), ch_b.get_readable( )
+	};
+
+	auto selected = q::select( readables );
+
+	ch_b.get_writable( ).close( );
+
+	run(
+		std::move( selected )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( std::size_t, int ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER(
+			[ ]( const q::channel_closed_exception& ) { }
+		) )
+	);
+}
+
+TEST_F( select, error )
+{
+	q::channel< int > ch_a( queue, 5 );
+	q::channel< int > ch_b( queue, 5 );
+
+	std::vector< q::readable< int > > readables{
+		ch_a.get_readable( ), ch_b.get_readable( )
+	};
+
+	auto selected = q::select( readables );
+
+	ch_a.get_writable( ).close( Error( ) );
+
+	run(
+		std::move( selected )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( std::size_t, int ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+}
+
+TEST_F( select, merge )
+{
+	q::channel< int > ch_a( queue, 5 );
+	q::channel< int > ch_b( queue, 5 );
+
+	auto writable_a = ch_a.get_writable( );
+	auto writable_b = ch_b.get_writable( );
+
+	EXPECT_TRUE( writable_a.write( 1 ) );
+	EXPECT_TRUE( writable_a.write( 2 ) );
+	EXPECT_TRUE( writable_b.write( 10 ) );
+
+	auto merged = q::merge_channels( std::vector< q::readable< int > >{
+		ch_a.get_readable( ), ch_b.get_readable( )
+	} );
+
+	std::vector< int > a_values;
+	std::vector< int > b_values;
+
+	auto consumed = merged.consume( [ & ]( int value )
+	{
+		( value < 10 ? a_values : b_values ).push_back( value );
+	} );
+
+	run(
+		q::with( queue )
+		.then( [ &, writable_a, writable_b ]( ) mutable
+		{
+			EXPECT_TRUE( writable_b.write( 20 ) );
+			EXPECT_TRUE( writable_a.write( 3 ) );
+			writable_a.close( );
+			writable_b.close( );
+
+			return std::move( consumed );
+		} )
+		.then( [ & ]( )
+		{
+			// Values from the same channel keep their order
+			std::vector< int > expected_a{ 1, 2, 3 };
+			std::vector< int > expected_b{ 10, 20 };
+			EXPECT_EQ( expected_a, a_values );
+			EXPECT_EQ( expected_b, b_values );
+		} )
+	);
+}
+
+TEST_F( select, merge_error )
+{
+	q::channel< int > ch_a( queue, 5 );
+	q::channel< int > ch_b( queue, 5 );
+
+	auto writable_b = ch_b.get_writable( );
+
+	auto merged = q::merge_channels( std::vector< q::readable< int > >{
+		ch_a.get_readable( ), ch_b.get_readable( )
+	} );
+
+	ch_a.get_writable( ).close( Error( ) );
+
+	run(
+		merged.consume( [ ]( int ) { } )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+		.then( [ writable_b ]( )
+		{
+			// The other channel is closed too
+			EXPECT_TRUE( writable_b.is_closed( ) );
+		} )
+	);
+}
+
+TEST_F( select, merge_closed_while_waiting )
+{
+	q::channel< int > ch_a( queue, 5 );
+	q::channel< int > ch_b( queue, 5 );
+
+	auto writable_a = ch_a.get_writable( );
+	auto writable_b = ch_b.get_writable( );
+
+	// All channels are empty, so the merger waits for a value
+	auto merged = q::merge_channels( std::vector< q::readable< int > >{
+		ch_a.get_readable( ), ch_b.get_readable( )
+	} );
+
+	merged.close( );
+
+	run(
+		q::with( queue )
+		.then( [ writable_a, writable_b ]( ) mutable
+		{
+			EXPECT_TRUE( writable_a.is_closed( ) );
+			EXPECT_TRUE( writable_b.is_closed( ) );
+			EXPECT_FALSE( writable_a.write( 1 ) );
+		} )
+	);
+}
@@ -0,0 +1,299 @@
+
+#include <q/stream.hpp>
+
+#include "core.hpp"
+
+Q_TEST_MAKE_SCOPE( stream );
+
+TEST_F( stream, map_filter_consume )
+{
+	q::channel< int > ch( queue, 10 );
+	auto writable = ch.get_writable( );
+
+	for ( int i = 1; i <= 6; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	std::vector< std::string > values;
+
+	run(
+		ch.get_readable( )
+		.filter( [ ]( int i ) { return i % 2 == 0; } )
+		.map( [ ]( int i ) { return std::to_string( i * 10 ); } )
+		.consume( [ & ]( std::string&& s )
+		{
+			values.push_back( std::move( s ) );
+		} )
+		.then( [ & ]( )
+		{
+			std::vector< std::string > expected{ "20", "40", "60" };
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}
+
+TEST_F( stream, map_two_types )
+{
+	q::channel< int, std::string > ch( queue, 10 );
+	auto writable = ch.get_writable( );
+
+	EXPECT_TRUE( writable.write( 2, "ab" ) );
+	EXPECT_TRUE( writable.write( 3, "c" ) );
+	writable.close( );
+
+	std::vector< std::size_t > values;
+
+	run(
+		ch.get_readable( )
+		.map( [ ]( int i, std::string s )
+		{
+			return i * s.size( );
+		} )
+		.consume( [ & ]( std::size_t n )
+		{
+			values.push_back( n );
+		} )
+		.then( [ & ]( )
+		{
+			std::vector< std::size_t > expected{ 4, 3 };
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}
+
+TEST_F( stream, take_closes_source )
+{
+	q::channel< int > ch( queue, 10 );
+	auto writable = ch.get_writable( );
+
+	for ( int i = 1; i <= 5; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+
+	std::vector< int > values;
+
+	run(
+		ch.get_readable( )
+		.take( 2 )
+		.consume( [ & ]( int i )
+		{
+			values.push_back( i );
+		} )
+		.then( [ &, writable ]( )
+		{
+			std::vector< int > expected{ 1, 2 };
+			EXPECT_EQ( expected, values );
+			EXPECT_TRUE( writable.is_closed( ) );
+		} )
+	);
+}
+
+TEST_F( stream, batch_flushes_remainder )
+{
+	q::channel< int > ch( queue, 10 );
+	auto writable = ch.get_writable( );
+
+	for ( int i = 1; i <= 5; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	std::vector< std::vector< int > > batches;
+
+	run(
+		ch.get_readable( )
+		.batch( 2 )
+		.consume( [ & ]( std::vector< int >&& batch )
+		{
+			batches.push_back( std::move( batch ) );
+		} )
+		.then( [ & ]( )
+		{
+			std::vector< std::vector< int > > expected{
+				{ 1, 2 }, { 3, 4 }, { 5 }
+			};
+			EXPECT_EQ( expected, batches );
+		} )
+	);
+}
+
+TEST_F( stream, consume_promise_function )
+{
+	q::channel< int > ch( queue, 10 );
+	auto writable = ch.get_writable( );
+
+	for ( int i = 1; i <= 4; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+	writable.close( );
+
+	int sum = 0;
+
+	run(
+		ch.get_readable( )
+		.filter( [ ]( int i ) { return i > 1; } )
+		.consume( [ & ]( int i )
+		{
+			return q::with( queue ).then( [ &, i ]( )
+			{
+				sum += i;
+			} );
+		} )
+		.then( [ & ]( )
+		{
+			EXPECT_EQ( 2 + 3 + 4, sum );
+		} )
+	);
+}
+
+TEST_F( stream, consume_error )
+{
+	q::channel< int > ch( queue, 10 );
+
+	ch.get_writable( ).close( Error( ) );
+
+	run(
+		ch.get_readable( )
+		.map( [ ]( int i ) { return i; } )
+		.consume( [ ]( int ) { } )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER( [ ]( const Error& ) { } ) )
+	);
+}
+
+TEST_F( stream, to_readable )
+{
+	q::channel< int > ch( queue, 2 );
+	auto writable = ch.get_writable( );
+
+	auto mapped = ch.get_readable( )
+		.map( [ ]( int i ) { return i * 2; } )
+		.to_readable( );
+
+	std::vector< int > values;
+
+	auto consumed = mapped.consume( [ & ]( int i )
+	{
+		values.push_back( i );
+	} );
+
+	run(
+		q::with( queue )
+		.then( [ &, writable ]( ) mutable
+		{
+			for ( int i = 1; i <= 5; ++i )
+				EXPECT_TRUE( writable.write( i ) );
+			writable.close( );
+
+			return std::move( consumed );
+		} )
+		.then( [ & ]( )
+		{
+			std::vector< int > expected{ 2, 4, 6, 8, 10 };
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}
+
+TEST_F( stream, to_readable_closed_by_reader )
+{
+	q::channel< int > ch( queue, 2 );
+	auto writable = ch.get_writable( );
+
+	auto taken = ch.get_readable( ).take( 1 ).to_readable( );
+
+	EXPECT_TRUE( writable.write( 1 ) );
+
+	run(
+		taken.read( )
+		.then( EXPECT_CALL_WRAPPER( [ ]( int i )
+		{
+			EXPECT_EQ( 1, i );
+		} ) )
+		.then( [ taken ]( ) mutable
+		{
+			return taken.read( );
+		} )
+		.then( EXPECT_NO_CALL_WRAPPER( [ ]( int ) { } ) )
+		.fail( EXPECT_CALL_WRAPPER(
+			[ ]( const q::channel_closed_exception& ) { }
+		) )
+		.then( [ writable ]( )
+		{
+			EXPECT_TRUE( writable.is_closed( ) );
+		} )
+	);
+}
+
+TEST_F( stream, window )
+{
+	q::channel< int > ch( queue, 10 );
+	auto writable = ch.get_writable( );
+
+	for ( int i = 1; i <= 3; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+
+	auto windows = ch.get_readable( )
+		.window( std::chrono::milliseconds( 10 ) );
+
+	std::vector< std::vector< int > > values;
+
+	run(
+		q::with( queue )
+		.delay( std::chrono::milliseconds( 30 ) )
+		.then( [ writable ]( ) mutable
+		{
+			EXPECT_TRUE( writable.write( 4 ) );
+			writable.close( );
+		} )
+		.then( [ &, windows ]( ) mutable
+		{
+			return windows.consume(
+				[ & ]( std::vector< int >&& window )
+				{
+					values.push_back( std::move( window ) );
+				} );
+		} )
+		.then( [ & ]( )
+		{
+			std::vector< std::vector< int > > expected{
+				{ 1, 2, 3 }, { 4 }
+			};
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}
+
+TEST_F( stream, debounce )
+{
+	q::channel< int > ch( queue, 10 );
+	auto writable = ch.get_writable( );
+
+	for ( int i = 1; i <= 3; ++i )
+		EXPECT_TRUE( writable.write( i ) );
+
+	auto debounced = ch.get_readable( )
+		.debounce( std::chrono::milliseconds( 10 ) );
+
+	std::vector< int > values;
+
+	run(
+		q::with( queue )
+		.delay( std::chrono::milliseconds( 30 ) )
+		.then( [ writable ]( ) mutable
+		{
+			EXPECT_TRUE( writable.write( 4 ) );
+			EXPECT_TRUE( writable.write( 5 ) );
+			writable.close( );
+		} )
+		.then( [ &, debounced ]( ) mutable
+		{
+			return debounced.consume( [ & ]( int i )
+			{
+				values.push_back( i );
+			} );
+		} )
+		.then( [ & ]( )
+		{
+			std::vector< int > expected{ 3, 5 };
+			EXPECT_EQ( expected, values );
+		} )
+	);
+}